@@ -0,0 +1,79 @@
+//
+// Created by Kevin Tan on 2022/3/20.
+//
+
+#ifndef CODE_ARENA_H
+#define CODE_ARENA_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// Hands out memory from large blocks by bumping a pointer, and frees it all at once when destroyed.
+// Everything made in it must be gone by then, and is never freed before.
+class Arena {
+    static constexpr size_t BLOCK_SIZE = 1 << 16;
+
+    vector<unique_ptr<char[]>> blocks;
+    char *next = nullptr, *end = nullptr;
+
+    static inline char *align_up(char *p, size_t alignment) {
+        return (char *) (((uintptr_t) p + alignment - 1) & ~(uintptr_t) (alignment - 1));
+    }
+
+public:
+    template<typename T>
+    struct Allocator {  // for `allocate_shared`, so that an object and its control block come from the arena
+        using value_type = T;
+
+        Arena *arena;
+
+        explicit Allocator(Arena *arena) : arena(arena) {}
+
+        template<typename U>
+        Allocator(const Allocator<U> &other) : arena(other.arena) {}  // NOLINT: rebinding must be implicit
+
+        inline T *allocate(size_t n) { return (T *) arena->allocate(n * sizeof(T), alignof(T)); }
+
+        inline void deallocate(T *, size_t) {}  // with the arena
+
+        template<typename U>
+        inline bool operator==(const Allocator<U> &other) const { return arena == other.arena; }
+
+        template<typename U>
+        inline bool operator!=(const Allocator<U> &other) const { return arena != other.arena; }
+    };
+
+    Arena() = default;
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(size_t size, size_t alignment) {
+        char *p = align_up(next, alignment);
+        if (next == nullptr || p + size > end) {
+            size_t block_size = size + alignment > BLOCK_SIZE ? size + alignment : BLOCK_SIZE;
+            blocks.emplace_back(new char[block_size]);
+            next = blocks.back().get();
+            end = next + block_size;
+            p = align_up(next, alignment);
+        }
+        next = p + size;
+        return p;
+    }
+
+    template<typename T, typename... Args>
+    inline shared_ptr<T> make(Args &&...args) {  // destroyed when the last reference goes
+        return allocate_shared<T>(Allocator<T>(this), forward<Args>(args)...);
+    }
+
+    template<typename T, typename... Args>
+    inline T *create(Args &&...args) {  // never destroyed, `T` must not need it
+        return new(allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+    }
+};
+
+#endif //CODE_ARENA_H
@@ -0,0 +1,134 @@
+//
+// Created by Kevin Tan on 2022/3/21.
+//
+
+#ifndef CODE_AST_H
+#define CODE_AST_H
+
+#include <algorithm>
+#include "object.h"
+
+using NodeId = int;  // index into `Ast::nodes`
+
+constexpr NodeId NO_NODE = -1;
+
+enum class NodeKind : unsigned char {
+    COMP_UNIT,  // children: DECLs, then FUNC_DEFs, then the MAIN_FUNC_DEF
+    DECL,  // children: VAR_DEFs, none for constants
+    VAR_DEF,  // `object` the variable, children: [its array size] [INIT_VAL], whatever did not go to the data image
+    INIT_VAL,  // children: the values of an initializer, flattened
+    FUNC_DEF,  // `object` the function, `op` 1 if it returns at its end without a return statement, child: BLOCK
+    MAIN_FUNC_DEF,  // `object` the function, child: BLOCK
+
+    BLOCK,  // children: DECLs and statements, none for an empty statement
+    EXPR_STMT,  // child: the expression, whose value is dropped
+    ASSIGN,  // `object` the variable, children: [the subscripted place, if it is indexed] the value
+    IF,  // children: condition, then, [else]
+    WHILE,  // children: condition, body
+    BREAK,
+    CONTINUE,
+    RETURN,  // child: [value]
+    PRINTF,  // `object` the format string, children: arguments
+
+    // expressions, `type` is that of their value
+    CONSTANT,  // `object` a number
+    NAME,  // `object` a variable or a constant
+    SUBSCRIPT,  // children: array, index
+    UNARY,  // `op` an UnaryOpCode, child: operand
+    BINARY,  // `op` a BinaryOpCode but the logical ones, children: operands
+    LOGICAL,  // `op` BINARY_LOGICAL_AND or BINARY_LOGICAL_OR, children: operands, only in a Cond
+    CALL,  // `object` the function, null if it is undefined, children: arguments
+    GETINT
+};
+
+struct Node {  // 32 bytes
+    NodeId first = NO_NODE;  // child
+    NodeId next = NO_NODE;  // sibling
+    TypeCode type;
+    NodeKind kind;
+    unsigned char op;
+    ObjectP object;
+
+    Node(NodeKind kind, TypeCode type, int op, const ObjectP &object) :
+            type(type), kind(kind), op((unsigned char) op), object(object) {}
+};
+
+// The typed syntax tree of a CompUnit or of one of its items, kept in one vector and linked by indexes,
+// so that a deep tree is walked and freed without recursion. It refers to the objects the parser checked it with.
+class Ast {
+public:
+    vector<Node> nodes;
+    NodeId root = NO_NODE;
+    bool discarding = false;  // no node is made, `add` gives NO_NODE, for checking alone
+
+    inline const Node &operator[](NodeId id) const { return nodes[id]; }
+
+    inline Node &operator[](NodeId id) { return nodes[id]; }
+
+    inline bool constant(NodeId id, int &value) const {  // whether `id` is an int known when compiling, and which
+        auto &n = nodes[id];
+        if ((n.kind == NodeKind::CONSTANT || n.kind == NodeKind::NAME) && n.object->is_const &&
+            n.object->type == TypeCode::INT) {
+            value = static_cast<const IntObject *>(n.object.get())->value;
+            return true;
+        }
+        return false;
+    }
+
+    inline NodeId add(NodeKind kind, TypeCode type = TypeCode::VOID, int op = 0, const ObjectP &object = nullptr) {
+        if (discarding) {
+            return NO_NODE;
+        }
+        nodes.emplace_back(kind, type, op, object);
+        return (NodeId) nodes.size() - 1;
+    }
+
+    template<typename Iter>
+    void adopt(NodeId parent, Iter begin, Iter end) {  // appends the nodes in [begin, end) to the children of `parent`
+        if (parent == NO_NODE) {
+            return;
+        }
+        NodeId last = nodes[parent].first;
+        for (; last != NO_NODE && nodes[last].next != NO_NODE; last = nodes[last].next);
+        for (; begin != end; ++begin) {
+            if (last == NO_NODE) {
+                nodes[parent].first = *begin;
+            } else {
+                nodes[last].next = *begin;
+            }
+            last = *begin;
+        }
+    }
+
+    inline void adopt(NodeId parent, NodeId child) { adopt(parent, &child, &child + 1); }
+
+    inline void append(NodeId parent, NodeId &last, NodeId child) {  // after `last`, the last child so far
+        if (parent == NO_NODE) {
+            return;
+        }
+        (last == NO_NODE ? nodes[parent].first : nodes[last].next) = child;
+        last = child;
+    }
+
+    void postorder(NodeId root, vector<NodeId> &order, vector<NodeId> &pending) const {
+        // appends the nodes under `root` to `order`, children first, `pending` is scratch
+        auto begin = (long) order.size();
+        pending.assign(1, root);
+        while (!pending.empty()) {  // root, then children from the last, reversed
+            NodeId n = pending.back();
+            pending.pop_back();
+            order.push_back(n);
+            for (NodeId c = nodes[n].first; c != NO_NODE; c = nodes[c].next) {
+                pending.push_back(c);
+            }
+        }
+        reverse(order.begin() + begin, order.end());
+    }
+
+    void clear() {
+        nodes.clear();
+        root = NO_NODE;
+    }
+};
+
+#endif //CODE_AST_H
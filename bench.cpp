@@ -0,0 +1,776 @@
+//
+// Created by Kevin Tan on 2022/3/12.
+//
+
+#include <atomic>
+#include <ratio>
+#include <chrono>
+#include <cstddef>
+#include <sstream>
+#include <thread>
+
+#include "scan.h"
+#include "tokenizer.h"
+#include "session.h"
+#include "module.h"
+#include "cache.h"
+#include "peephole.h"
+#include "profile.h"
+#include "vm.h"
+
+using Seconds = chrono::duration<double, ratio<1, 1>>;
+
+static atomic<size_t> allocations(0);  // heap allocations so far, counted to compare how the front end allocates
+
+void *operator new(size_t size) {
+    allocations++;
+    if (void *p = malloc(size)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+// Generates a valid SysY program of about `size` bytes, made of many small functions that mix
+// comments, format strings and expressions the way machine-generated sources do.
+static string generate_program(size_t size) {
+    std::ostringstream out;
+    out << "const int SCALE = 3;\nint table[16];\n\n";
+    int n = 0;
+    while ((size_t) out.tellp() < size) {
+        out << "// helper number " << n << ", generated\n"
+            << "int f" << n << "(int a, int b) {\n"
+            << "    /* accumulate a few terms\n"
+            << "       before returning */\n"
+            << "    int x = a * SCALE + b % 7, y = 0;\n"
+            << "    while (x > 0 && y <= " << n % 100 << ") {\n"
+            << "        x = x - (b + 1) / 2;\n"
+            << "        y = y + 1;\n"
+            << "    }\n"
+            << "    if (x != y || !a) { printf(\"f" << n << " %d %d\\n\", x, y); }\n"
+            << "    return x + y;\n"
+            << "}\n\n";
+        n++;
+    }
+    out << "int main() {\n    printf(\"%d\\n\", f0(1, 2));\n    return 0;\n}\n";
+    return padded(out.str());
+}
+
+// Splits a program like `generate_program` into `count` modules of about `size` bytes each, the first one
+// calling into the others through extern declarations.
+static vector<string> generate_modules(size_t size, int count) {
+    vector<string> result;
+    for (int m = 0; m < count; m++) {
+        std::ostringstream out;
+        out << "const int SCALE = 3;\n";
+        for (int k = 1; m == 0 && k < count; k++) {
+            out << "extern int f" << k << "_0(int a, int b);\n";
+        }
+        out << '\n';
+        int n = 0;
+        while ((size_t) out.tellp() < size) {
+            out << "int f" << m << '_' << n << "(int a, int b) {\n"
+                << "    int x = a * SCALE + b % 7, y = 0;\n"
+                << "    while (x > 0 && y <= " << n % 100 << ") {\n"
+                << "        x = x - (b + 1) / 2;\n"
+                << "        y = y + 1;\n"
+                << "    }\n"
+                << "    if (x != y || !a) { printf(\"f" << n << " %d %d\\n\", x, y); }\n"
+                << "    return x + y;\n"
+                << "}\n\n";
+            n++;
+        }
+        if (m == 0) {
+            out << "int main() {\n    int s = f0_0(1, 2);\n";
+            for (int k = 1; k < count; k++) {
+                out << "    s = s + f" << k << "_0(1, 2);\n";
+            }
+            out << "    printf(\"%d\\n\", s);\n    return 0;\n}\n";
+        }
+        result.push_back(out.str());
+    }
+    return result;
+}
+
+static const char *const LOOP_PROGRAM =  // spends its time in a hot loop
+        "int a[1000];\n"
+        "int main() {\n"
+        "    int i = 0, s = 0, r = 0;\n"
+        "    while (r < 300) {\n"
+        "        i = 0;\n"
+        "        while (i < 1000) {\n"
+        "            a[i] = a[i] + i * r;\n"
+        "            s = s + a[i] % 7;\n"
+        "            i = i + 1;\n"
+        "        }\n"
+        "        r = r + 1;\n"
+        "    }\n"
+        "    printf(\"%d\\n\", s);\n"
+        "    return 0;\n"
+        "}\n";
+
+static const char *const BRANCHY_PROGRAM =  // a hot loop of breaks, continues and nested branches
+        "int main() {\n"
+        "    int i = 0, s = 0, t;\n"
+        "    while (1) {\n"
+        "        if (i >= 1000000) break;\n"
+        "        t = i % 7;\n"
+        "        t = t * 3;\n"
+        "        if (t > 9) {\n"
+        "            if (t == 12) {\n"
+        "                s = s + t;\n"
+        "            }\n"
+        "        } else {\n"
+        "            s = s - 1;\n"
+        "        }\n"
+        "        i = i + 1;\n"
+        "        if (t == 15) continue;\n"
+        "        s = s + 1;\n"
+        "    }\n"
+        "    printf(\"%d\\n\", s);\n"
+        "    return 0;\n"
+        "}\n";
+
+static const struct {
+    const char *name;
+    const char *source;
+} CORPUS[] = {  // the programs profiled to mine superinstructions
+        {"hot loop", LOOP_PROGRAM},
+        {"branchy loop", BRANCHY_PROGRAM},
+        {"bubble sort",
+                "int a[1000];\n"
+                "int main() {\n"
+                "    int i = 0, j, t, seed = 12345;\n"
+                "    while (i < 1000) {\n"
+                "        seed = (seed * 1103 + 12345) % 65536;\n"
+                "        a[i] = seed;\n"
+                "        i = i + 1;\n"
+                "    }\n"
+                "    i = 0;\n"
+                "    while (i < 1000) {\n"
+                "        j = 0;\n"
+                "        while (j < 1000 - i - 1) {\n"
+                "            if (a[j] > a[j + 1]) {\n"
+                "                t = a[j];\n"
+                "                a[j] = a[j + 1];\n"
+                "                a[j + 1] = t;\n"
+                "            }\n"
+                "            j = j + 1;\n"
+                "        }\n"
+                "        i = i + 1;\n"
+                "    }\n"
+                "    printf(\"%d %d\\n\", a[0], a[999]);\n"
+                "    return 0;\n"
+                "}\n"},
+        {"matrix product",
+                "int a[60][60], b[60][60], c[60][60];\n"
+                "int main() {\n"
+                "    int i = 0, j, k, s;\n"
+                "    while (i < 60) {\n"
+                "        j = 0;\n"
+                "        while (j < 60) {\n"
+                "            a[i][j] = i + j;\n"
+                "            b[i][j] = i - j;\n"
+                "            j = j + 1;\n"
+                "        }\n"
+                "        i = i + 1;\n"
+                "    }\n"
+                "    i = 0;\n"
+                "    while (i < 60) {\n"
+                "        j = 0;\n"
+                "        while (j < 60) {\n"
+                "            s = 0;\n"
+                "            k = 0;\n"
+                "            while (k < 60) {\n"
+                "                s = s + a[i][k] * b[k][j];\n"
+                "                k = k + 1;\n"
+                "            }\n"
+                "            c[i][j] = s;\n"
+                "            j = j + 1;\n"
+                "        }\n"
+                "        i = i + 1;\n"
+                "    }\n"
+                "    printf(\"%d %d\\n\", c[0][0], c[59][59]);\n"
+                "    return 0;\n"
+                "}\n"},
+        {"recursion",
+                "int fib(int n) {\n"
+                "    if (n < 2) {\n"
+                "        return n;\n"
+                "    }\n"
+                "    return fib(n - 1) + fib(n - 2);\n"
+                "}\n"
+                "int main() {\n"
+                "    printf(\"%d\\n\", fib(24));\n"
+                "    return 0;\n"
+                "}\n"}
+};
+
+static Seconds run_program(const string &source, vector<long long> *dispatched = nullptr,
+                           OpcodeProfile *profile = nullptr) {
+    // counting the dispatches at each offset if `dispatched` is set, into `profile` if that is set too
+    Error error;
+    Tokenizer tokenizer(source.c_str(), (long long) source.size(), error);
+    Parser parser(tokenizer.tokens, error);
+    ostringstream out;
+    StackMachine machine(parser.instructions, move(parser.data_image), out);
+    auto start = chrono::high_resolution_clock::now();
+    if (dispatched != nullptr) {
+        machine.run(*dispatched);
+    } else {
+        machine.run();
+    }
+    Seconds duration(chrono::high_resolution_clock::now() - start);
+    if (profile != nullptr) {
+        profile->add(machine.bytecode, *dispatched);
+    }
+    return duration;
+}
+
+static void bench_lexer() {
+    cout << "lexer throughput" << endl;
+    for (size_t mb = 1; mb <= 32; mb *= 2) {
+        string source = generate_program(mb << 20);
+        Error error;
+        auto start = chrono::high_resolution_clock::now();
+        Tokenizer tokenizer(source.c_str(), (long long) source.size(), error);
+        Seconds duration(chrono::high_resolution_clock::now() - start);
+        cout << '\t' << mb << " MB\t" << tokenizer.tokens.size() << " tokens\t" << duration.count() << " s\t"
+             << (double) source.size() / (1 << 20) / duration.count() << " MB/s" << endl;
+    }
+}
+
+// Mostly comments and long format strings, where the scanners in `scan` do the work.
+static string generate_text_heavy_program(size_t size) {
+    std::ostringstream out;
+    int n = 0;
+    while ((size_t) out.tellp() < size) {
+        out << "/*\n * helper number " << n << ", generated from the table below\n";
+        for (int i = 0; i < 8; i++) {
+            out << " *     row " << i << ":    lorem ipsum dolor sit amet, consectetur adipiscing elit\n";
+        }
+        out << " */\n"
+            << "void f" << n << "(int a) {\n"
+            << "    // print the value together with a long explanation of what it means\n"
+            << "    printf(\"the value of the accumulated sum for helper " << n
+            << " is %d, which should be compared with the reference table in the comment above\\n\", a);\n"
+            << "}\n\n";
+        n++;
+    }
+    out << "int main() {\n    return 0;\n}\n";
+    return padded(out.str());
+}
+
+static void bench_scan() {
+    cout << "comment and string heavy lexer throughput" << endl;
+    string source = generate_text_heavy_program(32 << 20);
+    for (const char *isa: {"scalar", "sse2", "avx2"}) {
+        if (!scan::use_isa(isa)) {
+            cout << '\t' << isa << "\tnot supported" << endl;
+            continue;
+        }
+        Error error;
+        auto start = chrono::high_resolution_clock::now();
+        Tokenizer tokenizer(source.c_str(), (long long) source.size(), error);
+        Seconds duration(chrono::high_resolution_clock::now() - start);
+        cout << '\t' << isa << '\t' << tokenizer.tokens.size() << " tokens\t" << duration.count() << " s\t"
+             << (double) source.size() / (1 << 20) / duration.count() << " MB/s" << endl;
+    }
+}
+
+static void bench_parallel() {
+    cout << "parallel lexer scaling" << endl;
+    string source = generate_program(32 << 20);
+    Error serial_error;
+    Tokenizer serial(source.c_str(), (long long) source.size(), serial_error);
+    int cores = (int) std::thread::hardware_concurrency();
+    for (int threads = 1; threads <= max(cores, 1); threads *= 2) {
+        Error error;
+        auto start = chrono::high_resolution_clock::now();
+        Tokenizer tokenizer(source.c_str(), (long long) source.size(), error, threads);
+        Seconds duration(chrono::high_resolution_clock::now() - start);
+        bool same = tokenizer.tokens.types == serial.tokens.types && tokenizer.tokens.lines == serial.tokens.lines &&
+                    tokenizer.tokens.values == serial.tokens.values;
+        cout << '\t' << threads << " threads\t" << duration.count() << " s\t"
+             << (double) source.size() / (1 << 20) / duration.count() << " MB/s"
+             << (same ? "" : "\tdiffers from the serial tokens") << endl;
+        if (threads < cores && threads * 2 > cores) {
+            threads = cores / 2;  // also measure all the cores
+        }
+    }
+}
+
+static bool same_code(const vector<InstructionP> &a, const vector<InstructionP> &b) {
+    // by what is laid out and linked: the opcodes, the jump targets and where calls go
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i]->opcode != b[i]->opcode) {
+            return false;
+        }
+        switch (a[i]->opcode) {
+            case JUMP_ABSOLUTE:
+            case POP_JUMP_IF_FALSE:
+            case POP_JUMP_IF_TRUE:
+                if (static_pointer_cast<JumpInstruction>(a[i])->get_offset() !=
+                    static_pointer_cast<JumpInstruction>(b[i])->get_offset()) {
+                    return false;
+                }
+                break;
+            case CALL_FUNCTION: {
+                auto f = static_pointer_cast<CallFunction>(a[i])->get_func();
+                auto g = static_pointer_cast<CallFunction>(b[i])->get_func();
+                if ((f == nullptr) != (g == nullptr) || (f != nullptr && f->code_offset != g->code_offset)) {
+                    return false;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+static void bench_parallel_parser() {
+    cout << "parallel function body compilation scaling" << endl;
+    string source = generate_program(16 << 20);
+    Error serial_error;
+    Tokenizer tokenizer(source.c_str(), (long long) source.size(), serial_error);
+    Parser serial(tokenizer.tokens, serial_error);
+    int cores = (int) std::thread::hardware_concurrency();
+    for (int threads = 1; threads <= max(cores, 1); threads *= 2) {
+        Error error;
+        auto start = chrono::high_resolution_clock::now();
+        unique_ptr<Parser> parser(new Parser(tokenizer.tokens, error, nullptr, threads));
+        Seconds duration(chrono::high_resolution_clock::now() - start);
+        bool same = same_code(parser->instructions, serial.instructions);
+        cout << '\t' << threads << " threads\t" << duration.count() << " s\t"
+             << (double) source.size() / (1 << 20) / duration.count() << " MB/s"
+             << (same ? "" : "\tdiffers from the serial code") << endl;
+        if (threads < cores && threads * 2 > cores) {
+            threads = cores / 2;  // also measure all the cores
+        }
+    }
+}
+
+static void bench_source() {
+    cout << "source loading and tokenizing, read vs mmap" << endl;
+    const char *filename = "bench_source.txt";
+    for (size_t mb = 8; mb <= 32; mb *= 2) {
+        {
+            ofstream file(filename, std::ios::binary);
+            file << generate_program(mb << 20);
+        }
+        for (bool use_mmap: {false, true}) {
+            Error error;
+            auto start = chrono::high_resolution_clock::now();
+            Tokenizer tokenizer(filename, error, use_mmap);
+            Seconds duration(chrono::high_resolution_clock::now() - start);
+            cout << '\t' << mb << " MB\t" << (use_mmap ? "mmap" : "read") << '\t' << duration.count() << " s" << endl;
+        }
+    }
+    remove(filename);
+}
+
+static void bench_parser() {
+    cout << "parser throughput, and what freeing what it made takes" << endl;
+    for (size_t mb = 1; mb <= 16; mb *= 4) {
+        string source = generate_program(mb << 20);
+        for (bool use_arena: {false, true}) {
+            Error error;
+            Tokenizer tokenizer(source.c_str(), (long long) source.size(), error);
+            Parser::use_arena = use_arena;
+            size_t before = allocations;
+            auto start = chrono::high_resolution_clock::now();
+            unique_ptr<Parser> parser(new Parser(tokenizer.tokens, error));
+            Seconds duration(chrono::high_resolution_clock::now() - start);
+            size_t cnt = parser->instructions.size();
+            size_t allocated = allocations - before;
+            start = chrono::high_resolution_clock::now();
+            parser.reset();
+            Seconds freeing(chrono::high_resolution_clock::now() - start);
+            cout << '\t' << mb << " MB\t" << (use_arena ? "arena" : "heap") << '\t' << cnt << " instructions\t"
+                 << duration.count() << " s\t" << (double) source.size() / (1 << 20) / duration.count() << " MB/s\t"
+                 << allocated << " allocations\t" << freeing.count() << " s to free" << endl;
+        }
+    }
+    Parser::use_arena = true;
+}
+
+static void bench_session() {
+    cout << "incremental recompilation after editing one function" << endl;
+    for (size_t mb = 1; mb <= 16; mb *= 4) {
+        string source = generate_program(mb << 20);
+        Session session;
+        auto start = chrono::high_resolution_clock::now();
+        session.compile(source);
+        Seconds full(chrono::high_resolution_clock::now() - start);
+        cout << '\t' << mb << " MB\tfull\t" << full.count() * 1000 << " ms" << endl;
+
+        auto middle = source.find("    return x + y;", source.size() / 2);
+        for (const char *edit: {"    return x + y + 1;", "\n\n    return x + y;"}) {  // then also move lines
+            string edited = source;
+            edited.replace(middle, strlen("    return x + y;"), edit);
+            start = chrono::high_resolution_clock::now();
+            session.compile(edited);
+            Seconds duration(chrono::high_resolution_clock::now() - start);
+            cout << '\t' << mb << " MB\tedit\t" << duration.count() * 1000 << " ms\t" << session.reparsed
+                 << " items parsed\t" << session.relexed << " bytes lexed" << endl;
+        }
+    }
+}
+
+static void bench_check() {
+    cout << "checking throughput, against compiling" << endl;
+    for (size_t mb = 1; mb <= 16; mb *= 4) {
+        string source = generate_program(mb << 20);
+        Error tokenizer_error;
+        Tokenizer tokenizer(source.c_str(), (long long) source.size(), tokenizer_error);
+        for (CompileMode mode: {CompileMode::EAGER, CompileMode::CHECK_ONLY}) {
+            Error error;
+            size_t before = allocations;
+            auto start = chrono::high_resolution_clock::now();
+            unique_ptr<Parser> parser(new Parser(tokenizer.tokens, error, nullptr, 1, mode));
+            parser.reset();
+            Seconds duration(chrono::high_resolution_clock::now() - start);
+            cout << '\t' << mb << " MB\t" << (mode == CompileMode::EAGER ? "compile" : "check") << '\t'
+                 << duration.count() << " s\t" << (double) source.size() / (1 << 20) / duration.count() << " MB/s\t"
+                 << allocations - before << " allocations" << endl;
+        }
+    }
+}
+
+static void bench_lazy() {
+    cout << "compiling and running a program that calls few of its functions, eager vs lazy" << endl;
+    for (size_t mb = 1; mb <= 16; mb *= 4) {
+        string source = generate_program(mb << 20);
+        Error tokenizer_error;
+        Tokenizer tokenizer(source.c_str(), (long long) source.size(), tokenizer_error);
+        for (CompileMode mode: {CompileMode::EAGER, CompileMode::LAZY, CompileMode::LAZY_CHECKED}) {
+            Error error;
+            auto start = chrono::high_resolution_clock::now();
+            unique_ptr<Parser> parser(new Parser(tokenizer.tokens, error, nullptr, 1, mode));
+            Seconds compiling(chrono::high_resolution_clock::now() - start);
+            ostringstream out;
+            StackMachine machine(parser->instructions, move(parser->data_image), out, parser.get());
+            start = chrono::high_resolution_clock::now();
+            machine.run();
+            Seconds running(chrono::high_resolution_clock::now() - start);
+            const char *name = mode == CompileMode::EAGER ? "eager" : mode == CompileMode::LAZY ? "lazy" : "checked";
+            cout << '\t' << mb << " MB\t" << name << '\t' << compiling.count() << " s to compile\t"
+                 << running.count() << " s to run\t" << parser->instructions.size() << " instructions" << endl;
+        }
+    }
+}
+
+static void bench_modules() {
+    cout << "rebuilding a program of 8 modules after editing one of them" << endl;
+    const int count = 8;
+    vector<string> filenames;
+    for (int m = 0; m < count; m++) {
+        filenames.push_back("bench_module_" + to_string(m) + ".txt");
+    }
+    for (size_t mb = 1; mb <= 16; mb *= 4) {
+        vector<string> sources = generate_modules((mb << 20) / count, count);
+        for (int m = 0; m < count; m++) {
+            ofstream file(filenames[m], std::ios::binary);
+            file << sources[m];
+        }
+        Program program;
+        for (const char *build: {"full", "edit", "none"}) {
+            if (strcmp(build, "edit") == 0) {
+                string &source = sources[count / 2];
+                source.replace(source.find("    return x + y;", source.size() / 2), strlen("    return x + y;"),
+                               "    return x + y + 1;");
+                ofstream file(filenames[count / 2], std::ios::binary);
+                file << source;
+            }
+            auto start = chrono::high_resolution_clock::now();
+            bool linked = program.build(filenames);
+            Seconds duration(chrono::high_resolution_clock::now() - start);
+            cout << '\t' << mb << " MB\t" << build << '\t' << duration.count() * 1000 << " ms\t" << program.compiled
+                 << " modules compiled\t" << program.instructions.size() << " instructions"
+                 << (linked ? "" : "\tlink failed") << endl;
+        }
+    }
+    for (auto &filename: filenames) {
+        remove(filename.c_str());
+    }
+}
+
+static size_t instruction_bytes(const vector<InstructionP> &instructions) {
+    // of the array and of each instruction with its control block, not counting the objects it refers to
+    size_t result = instructions.capacity() * sizeof(InstructionP);
+    for (auto &i: instructions) {
+        result += 2 * sizeof(long);
+        switch (i->opcode) {
+            case LOAD_NAME:
+            case LOAD_FAST:
+            case STORE_NAME:
+            case LOAD_LOCAL:
+            case STORE_LOCAL:
+                result += sizeof(LoadName);
+                break;
+            case JUMP_ABSOLUTE:
+            case POP_JUMP_IF_FALSE:
+            case POP_JUMP_IF_TRUE:
+                result += sizeof(JumpInstruction);
+                break;
+            case CALL_PRINTF:
+                result += sizeof(PrintF);
+                break;
+            case CALL_FUNCTION:
+                result += sizeof(CallFunction);
+                break;
+            case UNARY_OP:
+                result += sizeof(UnaryOperation);
+                break;
+            case BINARY_OP:
+                result += sizeof(BinaryOperation);
+                break;
+            default:
+                result += sizeof(Instruction);
+        }
+    }
+    return result;
+}
+
+static void bench_bytecode() {
+    cout << "code size as instructions and as bytecode, and running from bytecode" << endl;
+    for (size_t mb = 1; mb <= 16; mb *= 4) {
+        string source = generate_program(mb << 20);
+        Error error;
+        Tokenizer tokenizer(source.c_str(), (long long) source.size(), error);
+        Parser parser(tokenizer.tokens, error);
+        auto start = chrono::high_resolution_clock::now();
+        Bytecode bytecode;
+        bytecode.assemble(parser.instructions);
+        Seconds duration(chrono::high_resolution_clock::now() - start);
+        size_t before = instruction_bytes(parser.instructions), after = bytecode.code.capacity() * sizeof(Code);
+        cout << '\t' << mb << " MB\t" << parser.instructions.size() << " instructions\t" << before / 1024
+             << " KB as instructions\t" << after / 1024 << " KB as bytecode (" << (double) before / after
+             << "x smaller)\tassembled in " << duration.count() * 1000 << " ms" << endl;
+    }
+    string source = padded(LOOP_PROGRAM);
+    Error error;
+    Tokenizer tokenizer(source.c_str(), (long long) source.size(), error);
+    Parser parser(tokenizer.tokens, error);
+    ostringstream out;
+    StackMachine machine(parser.instructions, move(parser.data_image), out);
+    auto start = chrono::high_resolution_clock::now();
+    machine.run();
+    Seconds duration(chrono::high_resolution_clock::now() - start);
+    cout << "\thot loop\t" << duration.count() << " s" << endl;
+}
+
+static void bench_cache() {
+    cout << "starting a program cold vs from the bytecode cached for it" << endl;
+    const char *filename = "bench_cache.txt", *dir = "bench_cache";
+    for (size_t mb = 1; mb <= 16; mb *= 4) {
+        {
+            ofstream file(filename, std::ios::binary);
+            file << generate_program(mb << 20);
+        }
+        string key;
+        {
+            auto start = chrono::high_resolution_clock::now();
+            SourceFile source(filename, true);
+            BytecodeCache cache(dir);
+            key = BytecodeCache::key(source.data(), source.length());
+            Error error;
+            Tokenizer tokenizer(source.data(), source.length(), error);
+            Parser parser(tokenizer.tokens, error);
+            Bytecode bytecode;
+            bytecode.assemble(parser.instructions);
+            cache.store(key, bytecode, parser.data_image);
+            Seconds duration(chrono::high_resolution_clock::now() - start);
+            cout << '\t' << mb << " MB\tcold\t" << duration.count() * 1000 << " ms to compile and store" << endl;
+        }
+        {
+            auto start = chrono::high_resolution_clock::now();
+            SourceFile source(filename, true);
+            BytecodeCache cache(dir);
+            Bytecode bytecode;
+            vector<ObjectP> data_image;
+            bool hit = cache.load(BytecodeCache::key(source.data(), source.length()), bytecode, data_image);
+            Seconds duration(chrono::high_resolution_clock::now() - start);
+            cout << '\t' << mb << " MB\t" << (hit ? "hit" : "miss") << '\t' << duration.count() * 1000
+                 << " ms to hash and load\t" << bytecode.code.size() << " instructions" << endl;
+        }
+        {
+            // a file whose first local load is out of its frame, fused or not, is not run but compiled again
+            string path = string(dir) + "/" + key + ".sybc";
+            BytecodeCache cache(dir);
+            Bytecode bytecode;
+            vector<ObjectP> data_image;
+            size_t i = 0;
+            if (cache.load(key, bytecode, data_image)) {
+                for (; i < bytecode.code.size() && Bytecode::base_opcode(bytecode.code[i].opcode) != LOAD_LOCAL; i++);
+            }
+            bytecode = Bytecode();  // so that the file is no longer mapped
+            {
+                fstream file(path, ios::in | ios::out | ios::binary);
+                size_t header = 4 + sizeof(uint32_t) + sizeof(uint64_t);  // see `Bytecode`
+                file.seekp((streamoff) (header + i * sizeof(Code) + offsetof(Code, arg)));
+                int32_t slot = 100000000;
+                file.write((const char *) &slot, sizeof(slot));
+            }
+            bool rejected = !cache.load(key, bytecode, data_image);
+            cout << '\t' << mb << " MB\t" << (rejected ? "rejected" : "LOADED") << " with a local slot out of its frame"
+                 << endl;
+        }
+        remove((string(dir) + "/" + key + ".sybc").c_str());
+    }
+    remove(filename);
+    remove(dir);
+}
+
+static void bench_peephole() {
+    cout << "code as generated vs after the peephole pass, and running it" << endl;
+    for (bool enabled: {false, true}) {
+        PeepholeOptimizer::enabled = enabled;
+        const char *name = enabled ? "peephole" : "as generated";
+        for (size_t mb = 1; mb <= 16; mb *= 4) {
+            string source = generate_program(mb << 20);
+            Error error;
+            Tokenizer tokenizer(source.c_str(), (long long) source.size(), error);
+            auto start = chrono::high_resolution_clock::now();
+            Parser parser(tokenizer.tokens, error);
+            Seconds duration(chrono::high_resolution_clock::now() - start);
+            cout << '\t' << mb << " MB\t" << name << '\t' << parser.instructions.size() << " instructions\t"
+                 << duration.count() << " s to compile" << endl;
+        }
+        for (const char *program: {LOOP_PROGRAM, BRANCHY_PROGRAM}) {
+            string source = padded(program);
+            Error error;
+            Tokenizer tokenizer(source.c_str(), (long long) source.size(), error);
+            Parser parser(tokenizer.tokens, error);
+            ostringstream out;
+            StackMachine machine(parser.instructions, move(parser.data_image), out);
+            auto start = chrono::high_resolution_clock::now();
+            machine.run();
+            Seconds duration(chrono::high_resolution_clock::now() - start);
+            cout << '\t' << (program == LOOP_PROGRAM ? "hot loop" : "branchy loop") << '\t' << name << '\t'
+                 << machine.bytecode.code.size() << " instructions\t" << duration.count() << " s\t" << out.str();
+        }
+    }
+}
+
+static void bench_ngrams(const vector<string> &filenames) {
+    // what superinstructions could save, mined from `filenames`, or from `CORPUS` if none are given
+    vector<string> sources;
+    for (auto &filename: filenames) {
+        ifstream file(filename, ios::binary);
+        stringstream source;
+        source << file.rdbuf();
+        sources.push_back(padded(source.str()));
+    }
+    if (sources.empty()) {
+        for (auto &program: CORPUS) {
+            sources.push_back(padded(program.source));
+        }
+    }
+    cout << "opcode n-grams run most in " << sources.size() << " programs" << endl;
+    Bytecode::use_superinstructions = false;
+    OpcodeProfile profile;
+    vector<long long> dispatched;
+    for (auto &source: sources) {
+        run_program(source, &dispatched, &profile);
+    }
+    Bytecode::use_superinstructions = true;
+    for (size_t length = 2; length <= OpcodeProfile::MAX_LENGTH; length++) {
+        for (auto &gram: profile.top(length, 8)) {
+            // fused, each run saves all but one dispatch
+            cout << '\t' << gram.second << " runs\t" << 100.0 * (double) gram.second * (double) (length - 1) /
+                                                       (double) profile.dispatches << "% of dispatches saved\t"
+                 << OpcodeProfile::name(gram.first) << endl;
+        }
+    }
+}
+
+static void bench_superinstructions() {
+    cout << "dispatches and time to run each instruction on its own vs with superinstructions" << endl;
+    long long total_dispatches[2] = {0, 0};
+    double total_seconds[2] = {0, 0};
+    for (auto &program: CORPUS) {
+        long long dispatches[2];
+        double seconds[2];
+        for (int fused = 0; fused < 2; fused++) {
+            Bytecode::use_superinstructions = fused != 0;
+            vector<long long> dispatched;
+            run_program(program.source, &dispatched);
+            dispatches[fused] = 0;
+            for (long long d: dispatched) {
+                dispatches[fused] += d;
+            }
+            seconds[fused] = 1e9;
+            for (int i = 0; i < 3; i++) {  // the best of a few, the runs are short
+                seconds[fused] = min(seconds[fused], run_program(program.source).count());
+            }
+            total_dispatches[fused] += dispatches[fused];
+            total_seconds[fused] += seconds[fused];
+        }
+        cout << '\t' << program.name << '\t' << dispatches[0] << " -> " << dispatches[1] << " dispatches ("
+             << 100.0 * (double) (dispatches[0] - dispatches[1]) / (double) dispatches[0] << "% fewer)\t"
+             << seconds[0] << " -> " << seconds[1] << " s (" << 100.0 * (seconds[0] - seconds[1]) / seconds[0]
+             << "% less)" << endl;
+    }
+    cout << "\tcorpus\t" << total_dispatches[0] << " -> " << total_dispatches[1] << " dispatches ("
+         << 100.0 * (double) (total_dispatches[0] - total_dispatches[1]) / (double) total_dispatches[0] << "% fewer)\t"
+         << total_seconds[0] << " -> " << total_seconds[1] << " s ("
+         << 100.0 * (total_seconds[0] - total_seconds[1]) / total_seconds[0] << "% less)" << endl;
+    Bytecode::use_superinstructions = true;
+}
+
+int main(int argc, char **argv) {
+    string suite = argc > 1 ? argv[1] : "all";
+    if (suite == "lexer" || suite == "all") {
+        bench_lexer();
+    }
+    if (suite == "scan" || suite == "all") {
+        bench_scan();
+    }
+    if (suite == "parallel" || suite == "all") {
+        bench_parallel();
+        bench_parallel_parser();
+    }
+    if (suite == "source" || suite == "all") {
+        bench_source();
+    }
+    if (suite == "parser" || suite == "all") {
+        bench_parser();
+    }
+    if (suite == "session" || suite == "all") {
+        bench_session();
+    }
+    if (suite == "check" || suite == "all") {
+        bench_check();
+    }
+    if (suite == "lazy" || suite == "all") {
+        bench_lazy();
+    }
+    if (suite == "modules" || suite == "all") {
+        bench_modules();
+    }
+    if (suite == "bytecode" || suite == "all") {
+        bench_bytecode();
+    }
+    if (suite == "cache" || suite == "all") {
+        bench_cache();
+    }
+    if (suite == "peephole" || suite == "all") {
+        bench_peephole();
+    }
+    if (suite == "ngrams" || suite == "all") {
+        bench_ngrams(vector<string>(argv + min(argc, 2), argv + argc));  // the sources to mine, if any
+    }
+    if (suite == "superinstructions" || suite == "all") {
+        bench_superinstructions();
+    }
+    return EXIT_SUCCESS;
+}
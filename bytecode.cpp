@@ -0,0 +1,627 @@
+//
+// Created by Kevin Tan on 2022/3/25.
+//
+
+#include <algorithm>
+#include "bytecode.h"
+
+static const struct {
+    OpCode opcode;
+    const char *name;  // with the tabs before its operands
+} MNEMONICS[] = {  // by opcode
+        {NAME(LOAD_NAME) "\t\t"},
+        {NAME(LOAD_FAST) "\t\t"},
+        {NAME(STORE_NAME) "\t\t"},
+        {NAME(LOAD_LOCAL) "\t\t"},
+        {NAME(STORE_LOCAL) "\t\t"},
+        {NAME(POP_TOP)},
+        {NAME(BUILD_ARRAY)},
+        {NAME(INIT_ARRAY)},
+        {NAME(SUBSCR_ARRAY)},
+        {NAME(STORE_SUBSCR)},
+        {NAME(CALL_PRINTF) "\t\t"},
+        {NAME(CALL_GETINT)},
+        {NAME(EXIT_INTERP) "\n"},
+        {NAME(JUMP_ABSOLUTE) "\t\t"},
+        {NAME(POP_JUMP_IF_FALSE) "\t"},
+        {NAME(POP_JUMP_IF_TRUE) "\t"},
+        {NAME(CALL_FUNCTION) "\t\t"},
+        {NAME(RETURN_VALUE) "\n"},
+        {NAME(UNARY_OP) "\t\t"},
+        {NAME(BINARY_OP) "\t\t"},
+        {NAME(NOP)}
+};
+
+static const char *const UNARY_SYMBOLS[] = {"+", "-", "!"};  // by UnaryOpCode
+
+static const char *const BINARY_SYMBOLS[] = {  // by BinaryOpCode
+        "", "+", "-", "*", "/", "%", "==", "!=", "<", "<=", ">", ">=", "&&", "||"
+};
+
+bool Bytecode::use_superinstructions = true;
+
+const vector<Superinstruction> &Bytecode::superinstructions() {
+#define SUPERINSTRUCTION_ENTRY(name, ...) {name, #name, {__VA_ARGS__}},
+    static const vector<Superinstruction> table{SUPERINSTRUCTIONS(SUPERINSTRUCTION_ENTRY)};
+#undef SUPERINSTRUCTION_ENTRY
+    return table;
+}
+
+bool Bytecode::can_fuse(OpCode opcode, bool last) {
+    // what only moves values between the stack, the names and the slots, or computes, and a jump at the end
+    switch (opcode) {
+        case LOAD_NAME:
+        case LOAD_FAST:
+        case STORE_NAME:
+        case LOAD_LOCAL:
+        case STORE_LOCAL:
+        case POP_TOP:
+        case SUBSCR_ARRAY:
+        case STORE_SUBSCR:
+        case UNARY_OP:
+        case BINARY_OP:
+            return true;
+        case JUMP_ABSOLUTE:
+        case POP_JUMP_IF_FALSE:
+        case POP_JUMP_IF_TRUE:
+            return last;
+        default:
+            return false;
+    }
+}
+
+template<typename T>
+int Bytecode::pool(vector<shared_ptr<T>> &pool, const shared_ptr<T> &p) {
+    auto it = pool_index.emplace(p.get(), (int) pool.size());
+    if (it.second) {
+        pool.push_back(p);
+    }
+    return it.first->second;
+}
+
+void Bytecode::assemble(const vector<InstructionP> &instructions, size_t from) {
+    code.reserve(instructions.size());
+    for (size_t i = from; i < instructions.size(); i++) {
+        auto &in = instructions[i];
+        Code c{(uint8_t) in->opcode, 0, 0};
+        switch (in->opcode) {
+            case LOAD_FAST:
+                c.arg = pool(constants, static_pointer_cast<LoadFast>(in)->object);
+                break;
+            case LOAD_NAME:
+            case STORE_NAME: {
+                auto &o = in->opcode == LOAD_NAME ? static_pointer_cast<LoadName>(in)->object :
+                          static_pointer_cast<StoreName>(in)->object;
+                c.arg = o->slot;
+                c.op = in->opcode == STORE_NAME && static_pointer_cast<StoreName>(in)->keep;
+                if (o->slot < 0) {  // not declared, in code with errors
+                    break;
+                }
+                if ((size_t) o->slot >= names.size()) {
+                    names.resize((size_t) o->slot + 1);
+                }
+                names[o->slot] = o;
+                break;
+            }
+            case LOAD_LOCAL:
+                c.arg = static_pointer_cast<LoadLocal>(in)->object->slot;
+                break;
+            case STORE_LOCAL:  // a constant is never stored to in code without errors, which is all that is run
+                c.arg = static_pointer_cast<StoreLocal>(in)->object->slot;
+                c.op = static_pointer_cast<StoreLocal>(in)->keep;
+                break;
+            case JUMP_ABSOLUTE:
+            case POP_JUMP_IF_FALSE:
+            case POP_JUMP_IF_TRUE:
+                c.arg = (int32_t) static_pointer_cast<JumpInstruction>(in)->get_offset();
+                break;
+            case CALL_PRINTF:
+                c.arg = pool(formats, static_pointer_cast<PrintF>(in)->format_string);
+                break;
+            case CALL_FUNCTION:
+                c.arg = pool(funcs, static_pointer_cast<CallFunction>(in)->get_func());
+                break;
+            case UNARY_OP:
+                c.op = (uint8_t) static_pointer_cast<UnaryOperation>(in)->unary_opcode;
+                break;
+            case BINARY_OP:
+                c.op = (uint8_t) static_pointer_cast<BinaryOperation>(in)->binary_opcode;
+                break;
+            default:
+                break;
+        }
+        code.push_back(c);
+    }
+    if (use_superinstructions) {
+        fuse(from);
+    }
+}
+
+void Bytecode::fuse(size_t from) {
+    // from left to right, the longest superinstruction that runs what follows
+    for (size_t i = from; i < code.size();) {
+        const Superinstruction *fused = nullptr;
+        for (auto &s: superinstructions()) {
+            bool longer = fused == nullptr || s.opcodes.size() > fused->opcodes.size();
+            if (!longer || i + s.opcodes.size() > code.size()) {
+                continue;
+            }
+            size_t j = 0;
+            for (; j < s.opcodes.size() && code[i + j].opcode == s.opcodes[j]; j++);
+            if (j == s.opcodes.size()) {
+                fused = &s;
+            }
+        }
+        if (fused != nullptr) {
+            code[i].opcode = (uint8_t) fused->opcode;
+            i += fused->opcodes.size();
+        } else {
+            i++;
+        }
+    }
+}
+
+namespace {
+    enum ObjectFlag {
+        CONST = 1,
+        GLOBAL = 2,
+        NAMED = 4
+    };
+
+    class Writer {
+        ostream &out;
+    public:
+        explicit Writer(ostream &out) : out(out) {}
+
+        template<typename T>
+        void put(T value) {
+            out.write((const char *) &value, sizeof(T));
+        }
+
+        void put_string(StringRef s) {
+            put((uint32_t) s.length);
+            out.write(s.data, s.length);
+        }
+
+        template<typename T>
+        void put_objects(const vector<shared_ptr<T>> &objects) {
+            put((uint32_t) objects.size());
+            for (auto &o: objects) {
+                put_object(o);
+            }
+        }
+
+        void put_object(const ObjectP &o) {
+            // type:u8 flags:u8 slot:i32 [name:string line:i32], then what its type has
+            put((uint8_t) o->type);
+            put((uint8_t) ((o->is_const ? CONST : 0) | (o->is_global ? GLOBAL : 0) |
+                           (o->ident_info != nullptr ? NAMED : 0)));
+            put((int32_t) o->slot);
+            if (o->ident_info != nullptr) {
+                put_string(o->ident_info->name());
+                put((int32_t) o->ident_info->line);
+            }
+            switch (o->type) {
+                case TypeCode::INT:
+                    put((int32_t) cast<IntObject>(o)->value);
+                    break;
+                case TypeCode::INT_ARRAY: {  // dims:u32 i64..., elements:i64 (-1 without them) i32...
+                    auto array = cast<ArrayObject>(o);
+                    put((uint32_t) array->dims.size());
+                    for (long long d: array->dims) {
+                        put((int64_t) d);
+                    }
+                    put((int64_t) (array->data == nullptr ? -1 : (long long) array->data->size()));
+                    if (array->data != nullptr) {
+                        for (auto &e: *array->data) {
+                            put((int32_t) cast<IntObject>(e)->value);
+                        }
+                    }
+                    break;
+                }
+                case TypeCode::CHAR_ARRAY:
+                    put_string(cast<StringObject>(o)->value);
+                    break;
+                case TypeCode::FUNCTION: {
+                    auto func = cast<FuncObject>(o);
+                    put((uint8_t) func->return_type);
+                    put((int32_t) func->slot_cnt);
+                    put((int64_t) func->code_offset);
+                    put_objects(func->params);
+                    put_objects(func->locals);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    };
+
+    class Reader {
+        const char *p, *end;
+    public:
+        bool ok = true;  // until something is read past the end
+
+        Reader(const char *data, long long length) : p(data), end(data + length) {}
+
+        inline bool has(long long length) {
+            ok = ok && length >= 0 && end - p >= length;
+            return ok;
+        }
+
+        template<typename T>
+        T get() {
+            T value{};
+            if (has(sizeof(T))) {
+                memcpy(&value, p, sizeof(T));
+                p += sizeof(T);
+            }
+            return value;
+        }
+
+        StringRef get_string() {
+            auto length = (long long) get<uint32_t>();
+            if (!has(length)) {
+                return {};
+            }
+            StringRef result(p, length);
+            p += length;
+            return result;
+        }
+
+        const char *take(long long length) {
+            const char *result = p;
+            if (has(length)) {
+                p += length;
+            }
+            return result;
+        }
+
+        template<typename T>
+        bool get_objects(vector<shared_ptr<T>> &objects) {
+            auto cnt = get<uint32_t>();
+            objects.clear();
+            for (uint32_t i = 0; ok && i < cnt; i++) {
+                objects.push_back(std::static_pointer_cast<T>(get_object()));
+            }
+            return ok;
+        }
+
+        ObjectP get_object() {
+            auto type = (TypeCode) get<uint8_t>();
+            auto flags = get<uint8_t>();
+            auto slot = get<int32_t>();
+            IdentP ident;
+            if (flags & NAMED) {
+                StringRef name = get_string();
+                auto line = get<int32_t>();
+                ident = make_shared<Identifier>(line, SymbolPool::global().intern(name));
+            }
+            ObjectP result;
+            switch (type) {
+                case TypeCode::INT:
+                    result = make_shared<IntObject>(get<int32_t>());
+                    break;
+                case TypeCode::INT_ARRAY: {
+                    auto array = make_shared<ArrayObject>();
+                    auto dim_cnt = get<uint32_t>();
+                    for (uint32_t i = 0; ok && i < dim_cnt; i++) {
+                        array->dims.push_back(get<int64_t>());
+                    }
+                    auto size = get<int64_t>();
+                    if (size >= 0 && has(size * (long long) sizeof(int32_t))) {
+                        array->alloc(size);
+                        for (int64_t i = 0; i < size; i++) {
+                            array->data->push_back(make_shared<IntObject>(get<int32_t>()));
+                        }
+                    }
+                    result = array;
+                    break;
+                }
+                case TypeCode::CHAR_ARRAY:
+                    result = make_shared<StringObject>(get_string());
+                    break;
+                case TypeCode::FUNCTION: {
+                    auto func = make_shared<FuncObject>((TypeCode) get<uint8_t>());
+                    func->slot_cnt = get<int32_t>();
+                    func->code_offset = get<int64_t>();
+                    get_objects(func->params);
+                    get_objects(func->locals);
+                    result = func;
+                    break;
+                }
+                default:
+                    result = make_shared<Object>(type);
+            }
+            result->is_const = (flags & CONST) != 0;
+            result->is_global = (flags & GLOBAL) != 0;
+            result->slot = slot;
+            result->ident_info = ident;
+            return result;
+        }
+    };
+}
+
+void Bytecode::save(ostream &out, const vector<ObjectP> &data_image) const {
+    Writer writer(out);
+    out.write("SYBC", 4);
+    writer.put(VERSION);
+    writer.put((uint64_t) code.size());
+    out.write((const char *) code.data(), (std::streamsize) (code.size() * sizeof(Code)));
+    writer.put_objects(constants);
+    writer.put((uint32_t) formats.size());
+    for (auto &f: formats) {
+        writer.put_string(f->value);
+        writer.put((int32_t) f->fmt_char_cnt);
+    }
+    writer.put_objects(funcs);
+    writer.put_objects(data_image);
+}
+
+bool Bytecode::load(const shared_ptr<SourceFile> &source, vector<ObjectP> &data_image) {
+    Reader reader(source->data(), source->length());
+    const char *magic = reader.take(4);
+    if (!reader.ok || memcmp(magic, "SYBC", 4) != 0 || reader.get<uint32_t>() != VERSION) {
+        return false;
+    }
+    auto cnt = reader.get<uint64_t>();
+    if (!reader.has((long long) (cnt * sizeof(Code)))) {
+        return false;
+    }
+    const char *data = reader.take((long long) (cnt * sizeof(Code)));
+    code.resize(cnt);
+    memcpy(code.data(), data, cnt * sizeof(Code));
+    reader.get_objects(constants);
+    auto format_cnt = reader.get<uint32_t>();
+    formats.clear();
+    for (uint32_t i = 0; reader.ok && i < format_cnt; i++) {
+        StringRef literal = reader.get_string();
+        auto fmt_char_cnt = reader.get<int32_t>();
+        if (reader.ok) {
+            formats.push_back(make_shared<FormatString>(FormatLiteral{literal, fmt_char_cnt}));
+        }
+    }
+    reader.get_objects(funcs);
+    reader.get_objects(data_image);
+    if (!reader.ok) {
+        return false;
+    }
+    for (auto &f: funcs) {
+        if (f->code_offset < 0 || (size_t) f->code_offset >= code.size() || f->slot_cnt < 0) {
+            return false;
+        }
+        for (auto &p: f->params) {
+            if (p->slot < 0 || p->slot >= f->slot_cnt) {
+                return false;
+            }
+        }
+    }
+    for (size_t i = 0; i < code.size(); i++) {  // so that what is run only refers to what is there
+        auto &c = code[i];
+        if (c.opcode > NOP) {  // a superinstruction runs what follows as it would have been
+            if (c.opcode >= OPCODE_CNT) {
+                return false;
+            }
+            auto &opcodes = superinstructions()[c.opcode - NOP - 1].opcodes;
+            if (i + opcodes.size() > code.size()) {
+                return false;
+            }
+            for (size_t j = 1; j < opcodes.size(); j++) {
+                if (code[i + j].opcode != opcodes[j]) {
+                    return false;
+                }
+            }
+        }
+        size_t limit;
+        switch (base_opcode(c.opcode)) {
+            case UNARY_OP:
+                if (c.op > UNARY_NOT) {
+                    return false;
+                }
+                continue;
+            case BINARY_OP:
+                if (c.op == NOTHING || c.op > BINARY_LOGICAL_OR) {
+                    return false;
+                }
+                continue;
+            case LOAD_FAST:
+                limit = constants.size();
+                break;
+            case LOAD_NAME:
+            case STORE_NAME:
+                limit = data_image.size();
+                break;
+            case JUMP_ABSOLUTE:
+            case POP_JUMP_IF_FALSE:
+            case POP_JUMP_IF_TRUE:
+                limit = code.size();
+                break;
+            case CALL_PRINTF:
+                limit = formats.size();
+                break;
+            case CALL_FUNCTION:
+                limit = funcs.size();
+                break;
+            default:
+                continue;
+        }
+        if (c.arg < 0 || (size_t) c.arg >= limit) {
+            return false;
+        }
+    }
+    // A local is in the frame of the function whose code it is in. That is found by following the code as it can
+    // run from the entry, so a function never called is not checked, and none is entered but through a call.
+    vector<int> frame_of(code.size(), -2);  // index into `funcs`, -1 before main is called, -2 if never reached
+    vector<pair<size_t, int>> pending{{0, -1}};
+    while (!pending.empty()) {
+        size_t i = pending.back().first;
+        int frame = pending.back().second;
+        pending.pop_back();
+        for (; i < code.size() && frame_of[i] != frame; i++) {
+            if (frame_of[i] != -2) {  // run in two frames
+                return false;
+            }
+            frame_of[i] = frame;
+            auto &c = code[i];
+            OpCode opcode = base_opcode(c.opcode);  // what follows it in a superinstruction is walked on its own
+            switch (opcode) {
+                case LOAD_LOCAL:
+                case STORE_LOCAL:
+                    if (frame < 0 || c.arg < 0 || c.arg >= funcs[frame]->slot_cnt) {
+                        return false;
+                    }
+                    break;
+                case CALL_FUNCTION:
+                    pending.emplace_back((size_t) funcs[c.arg]->code_offset, c.arg);
+                    break;
+                case JUMP_ABSOLUTE:
+                case POP_JUMP_IF_FALSE:
+                case POP_JUMP_IF_TRUE:
+                    pending.emplace_back((size_t) c.arg, frame);
+                    break;
+                case RETURN_VALUE:
+                    if (frame < 0) {
+                        return false;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            if (opcode == JUMP_ABSOLUTE || opcode == RETURN_VALUE || opcode == EXIT_INTERP) {
+                break;
+            }
+        }
+        if (i == code.size()) {  // would run past the end
+            return false;
+        }
+    }
+    names = data_image;
+    pool_index.clear();
+    file = source;
+    return true;
+}
+
+string Disassembler::mnemonic(OpCode opcode) {
+    const char *name = MNEMONICS[opcode].name;
+    return {name, strcspn(name, "\t\n")};
+}
+
+void Disassembler::print(ostream &out, size_t offset, const FuncObject *func) const {
+    // as the instruction it was assembled from read, `func` is the function it runs in if known
+    Code c = bytecode.code[offset];
+    c.opcode = (uint8_t) Bytecode::base_opcode(c.opcode);
+    out << MNEMONICS[c.opcode].name;
+    switch (c.opcode) {
+        case LOAD_NAME:
+        case STORE_NAME: {
+            if (c.arg < 0 || (size_t) c.arg >= bytecode.names.size() || bytecode.names[c.arg] == nullptr) {
+                break;
+            }
+            auto &o = bytecode.names[c.arg];
+            IdentP i = o->ident_info;
+            if (i != nullptr && (o->type == TypeCode::INT || o->type == TypeCode::INT_ARRAY)) {
+                out << i->name() << "\t\t(" << (o->type == TypeCode::INT ? "INT" : "INT_ARRAY")
+                    << ", global slot " << c.arg << ", declared in line " << i->line << ')';
+            }
+            break;
+        }
+        case LOAD_FAST: {
+            auto &o = bytecode.constants[c.arg];
+            IdentP i = o->ident_info;
+            switch (o->type) {
+                case TypeCode::INT:
+                    if (i == nullptr) {
+                        out << cast<IntObject>(o)->value;
+                    } else {
+                        out << i->name() << "\t\t(INT, declared in line " << i->line << " at " << o << ')';
+                    }
+                    break;
+                case TypeCode::INT_ARRAY:
+                    if (i != nullptr) {
+                        out << i->name() << "\t\t(INT_ARRAY, declared in line " << i->line << " at " << o << ')';
+                    }
+                    break;
+                default:
+                    out << "\t\t" << cast<StringObject>(o)->value;
+            }
+            break;
+        }
+        case LOAD_LOCAL:
+        case STORE_LOCAL:
+            if (func != nullptr && (size_t) c.arg < func->locals.size()) {
+                auto &o = func->locals[c.arg];
+                IdentP i = o->ident_info;
+                if (i != nullptr && (o->type == TypeCode::INT || o->type == TypeCode::INT_ARRAY)) {
+                    out << i->name() << "\t\t(" << (o->type == TypeCode::INT ? "INT" : "INT_ARRAY")
+                        << ", slot " << c.arg << ", declared in line " << i->line << ')';
+                }
+            } else {
+                out << "slot " << c.arg;
+            }
+            break;
+        case CALL_PRINTF:
+            out << bytecode.formats[c.arg]->value;
+            break;
+        case JUMP_ABSOLUTE:
+        case POP_JUMP_IF_FALSE:
+        case POP_JUMP_IF_TRUE:
+            if (c.arg >= 0) {
+                out << c.arg << '\n';
+            }
+            break;
+        case CALL_FUNCTION: {
+            auto &f = bytecode.funcs[c.arg];
+            if (f != nullptr) {
+                out << f->ident_info->name() << "\t\t(" << f->params.size() << " args, offset " << f->code_offset
+                    << ", declared in line " << f->ident_info->line << " at " << f << ")\n";
+            }
+            break;
+        }
+        case UNARY_OP:
+            out << UNARY_SYMBOLS[c.op];
+            break;
+        case BINARY_OP:
+            out << BINARY_SYMBOLS[c.op];
+            break;
+        default:
+            break;
+    }
+    if ((c.opcode == STORE_NAME || c.opcode == STORE_LOCAL) && c.op) {
+        out << ", kept on the stack";
+    }
+}
+
+ostream &operator<<(ostream &out, const Disassembler &self) {
+    // a slot is named by the function it is in, which is known for the code reachable from where it is called
+    auto &code = self.bytecode.code;
+    vector<const FuncObject *> owner(code.size(), nullptr);
+    for (auto &f: self.bytecode.funcs) {
+        if (f == nullptr || f->code_offset < 0) {
+            continue;
+        }
+        vector<long long> starts{f->code_offset};
+        while (!starts.empty()) {
+            long long i = starts.back();
+            starts.pop_back();
+            for (; i >= 0 && i < (long long) code.size() && owner[i] == nullptr; i++) {
+                owner[i] = f.get();
+                auto opcode = Bytecode::base_opcode(code[i].opcode);
+                if (opcode == JUMP_ABSOLUTE || opcode == POP_JUMP_IF_FALSE || opcode == POP_JUMP_IF_TRUE) {
+                    starts.push_back(code[i].arg);
+                }
+                if (opcode == JUMP_ABSOLUTE || opcode == RETURN_VALUE || opcode == EXIT_INTERP) {
+                    break;
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < code.size(); i++) {
+        if (code[i].opcode > NOP) {
+            out << '\t' << Bytecode::superinstructions()[code[i].opcode - NOP - 1].name << ':' << endl;
+        }
+        out << i << '\t';
+        self.print(out, i, owner[i]);
+        out << endl;
+    }
+    return out;
+}
@@ -0,0 +1,86 @@
+//
+// Created by Kevin Tan on 2022/3/25.
+//
+
+#ifndef CODE_BYTECODE_H
+#define CODE_BYTECODE_H
+
+#include <cstdint>
+#include "instruction.h"
+
+struct Superinstruction {  // as `SUPERINSTRUCTIONS` defines it
+    OpCode opcode;
+    const char *name;
+    vector<OpCode> opcodes;  // that it runs
+};
+
+struct Code {  // an instruction as it is run, of a fixed width so that code is one array fetched in order
+    uint8_t opcode;  // OpCode
+    uint8_t op;  // UnaryOpCode of UNARY_OP, BinaryOpCode of BINARY_OP, 1 if a store keeps the value
+    int32_t arg;  // by opcode, see `Bytecode`
+};
+
+// Instructions assembled into `Code`, with what they refer to either inlined or pooled:
+//   LOAD_FAST                          index into `constants`
+//   LOAD_NAME, STORE_NAME              global slot
+//   LOAD_LOCAL, STORE_LOCAL            frame slot, see `FuncObject::locals`
+//   JUMP_ABSOLUTE, POP_JUMP_IF_*       target offset
+//   CALL_PRINTF                        index into `formats`
+//   CALL_FUNCTION                      index into `funcs`
+// A superinstruction takes the place of the opcode of the first instruction it runs, the others stay as they are,
+// with their operands, so no offset changes and a jump into them runs the rest one by one.
+// It is saved as a file of, in native byte order:
+//   "SYBC" VERSION:u32 count:u64 Code[count]
+//   `constants`, `formats`, `funcs` and the data segment, each as a count:u32 and that many objects
+class Bytecode {
+    unordered_map<const void *, int> pool_index;  // of what is pooled already
+    shared_ptr<SourceFile> file;  // loaded from, the format strings point into it
+
+    template<typename T>
+    int pool(vector<shared_ptr<T>> &pool, const shared_ptr<T> &p);
+
+    void fuse(size_t from);
+
+public:
+    vector<Code> code;
+    vector<ObjectP> constants;
+    vector<FormatStringP> formats;
+    vector<FuncObjectP> funcs;
+    vector<ObjectP> names;  // global variables by slot, as declared, only to name them
+
+    static constexpr uint32_t VERSION = 3;  // of the file format, changes with it and with the opcodes
+
+    static bool use_superinstructions;  // off to run every instruction on its own, as when profiling to mine them
+
+    static const vector<Superinstruction> &superinstructions();  // by opcode from NOP + 1 on
+
+    static bool can_fuse(OpCode opcode, bool last);  // whether a superinstruction can run it, and if not as `last`
+
+    static inline OpCode base_opcode(uint8_t opcode) {  // what runs first, the opcode itself if it is not fused
+        return opcode <= NOP ? (OpCode) opcode : superinstructions()[opcode - NOP - 1].opcodes[0];
+    }
+
+    // appends `instructions[from:]`, with what superinstructions can run fused
+    void assemble(const vector<InstructionP> &instructions, size_t from = 0);
+
+    void save(ostream &out, const vector<ObjectP> &data_image) const;
+
+    // from what `save` wrote, false if it is not such a file or is of another version
+    bool load(const shared_ptr<SourceFile> &source, vector<ObjectP> &data_image);
+};
+
+// The listing of `bytecode`, only made when it is printed.
+class Disassembler {
+    const Bytecode &bytecode;
+
+    void print(ostream &out, size_t offset, const FuncObject *func) const;
+
+public:
+    explicit Disassembler(const Bytecode &bytecode) : bytecode(bytecode) {}
+
+    static string mnemonic(OpCode opcode);  // the name of an opcode up to NOP
+
+    friend ostream &operator<<(ostream &out, const Disassembler &self);
+};
+
+#endif //CODE_BYTECODE_H
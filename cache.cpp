@@ -0,0 +1,152 @@
+//
+// Created by Kevin Tan on 2022/3/26.
+//
+
+#include <cstdio>
+#include <atomic>
+#include "cache.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+BytecodeCache::BytecodeCache(string dir) : dir(move(dir)) {
+#ifdef _WIN32
+    _mkdir(this->dir.c_str());
+#else
+    mkdir(this->dir.c_str(), 0777);
+#endif  // fails if it exists already, and if it cannot be made, nothing is cached
+}
+
+namespace {
+    class Sha256 {  // FIPS 180-4
+        uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        uint8_t block[64] = {};
+        size_t filled = 0;
+        uint64_t total = 0;
+
+        static inline uint32_t rotr(uint32_t x, int n) { return x >> n | x << (32 - n); }
+
+        void compress(const uint8_t *p) {
+            static const uint32_t k[64] = {
+                    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+            uint32_t w[64];
+            for (int i = 0; i < 16; i++) {
+                w[i] = (uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16 | (uint32_t) p[4 * i + 2] << 8 |
+                       p[4 * i + 3];
+            }
+            for (int i = 16; i < 64; i++) {
+                uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ w[i - 15] >> 3;
+                uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ w[i - 2] >> 10;
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+            uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+            for (int i = 0; i < 64; i++) {
+                uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+                uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+            state[5] += f;
+            state[6] += g;
+            state[7] += h;
+        }
+
+    public:
+        void update(const char *data, long long size) {
+            auto p = (const uint8_t *) data;
+            total += (uint64_t) size;
+            for (; filled != 0 && size > 0; size--) {
+                block[filled++] = *p++;
+                if (filled == 64) {
+                    compress(block);
+                    filled = 0;
+                }
+            }
+            for (; size >= 64; size -= 64, p += 64) {
+                compress(p);
+            }
+            for (; size > 0; size--) {
+                block[filled++] = *p++;
+            }
+        }
+
+        string hex_digest() {
+            uint64_t bits = total * 8;
+            uint8_t tail[72] = {0x80};
+            auto pad = (long long) (filled < 56 ? 56 - filled : 120 - filled);
+            for (int i = 0; i < 8; i++) {
+                tail[pad + i] = (uint8_t) (bits >> (56 - 8 * i));
+            }
+            update((const char *) tail, pad + 8);
+            char result[65];
+            for (int i = 0; i < 8; i++) {
+                snprintf(result + 8 * i, 9, "%08x", state[i]);
+            }
+            return result;
+        }
+    };
+}
+
+string BytecodeCache::key(const char *source, long long length) {
+    // SHA-256 over the version and the source, so that a file found under it was compiled from this very source
+    Sha256 hash;
+    string version = COMPILER_VERSION "/" + std::to_string(Bytecode::VERSION);
+    hash.update(version.c_str(), (long long) version.size() + 1);
+    hash.update(source, length);
+    return hash.hex_digest();
+}
+
+bool BytecodeCache::load(const string &key, Bytecode &bytecode, vector<ObjectP> &data_image) const {
+    string path = dir + "/" + key + ".sybc";
+    if (!ifstream(path).is_open()) {
+        return false;
+    }
+    return bytecode.load(make_shared<SourceFile>(path, true), data_image);
+}
+
+void BytecodeCache::store(const string &key, const Bytecode &bytecode, const vector<ObjectP> &data_image) const {
+    static std::atomic<int> stored(0);
+    string path = dir + "/" + key + ".sybc";
+    string temp = path + "." + std::to_string(getpid()) + "." + std::to_string(stored++) + ".tmp";
+    {
+        ofstream file(temp, std::ios::binary);
+        if (!file.is_open()) {
+            return;
+        }
+        bytecode.save(file, data_image);
+        if (!file.good()) {
+            file.close();
+            remove(temp.c_str());
+            return;
+        }
+    }
+    if (rename(temp.c_str(), path.c_str()) != 0) {  // on Windows, when another process has stored it first
+        remove(temp.c_str());
+    }
+}
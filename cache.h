@@ -0,0 +1,28 @@
+//
+// Created by Kevin Tan on 2022/3/26.
+//
+
+#ifndef CODE_CACHE_H
+#define CODE_CACHE_H
+
+#include "bytecode.h"
+
+#define COMPILER_VERSION "2022.3.28"  // changes whenever the code compiled from a source may change
+
+// Bytecode compiled before, in files named by a SHA-256 of the source and of the compiler version, so that running
+// a source again skips compiling it. A file is written in full under a name of its own and then renamed into
+// place, so processes sharing the directory only ever see whole files, the same for the same key.
+class BytecodeCache {
+    string dir;
+
+public:
+    explicit BytecodeCache(string dir);
+
+    static string key(const char *source, long long length);
+
+    bool load(const string &key, Bytecode &bytecode, vector<ObjectP> &data_image) const;  // false if not cached
+
+    void store(const string &key, const Bytecode &bytecode, const vector<ObjectP> &data_image) const;
+};
+
+#endif //CODE_CACHE_H
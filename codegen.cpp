@@ -0,0 +1,250 @@
+//
+// Created by Kevin Tan on 2022/3/21.
+//
+
+#include "codegen.h"
+#include "peephole.h"
+
+void CodeGenerator::generate(NodeId node) {
+    auto &n = ast[node];
+    switch (n.kind) {
+        case NodeKind::COMP_UNIT: {
+            // the globals are set up, then main is called, the functions follow
+            instructions.reserve(instructions.size() + ast.nodes.size());  // about one for each node
+            entry = nullptr;
+            for (NodeId c = n.first; c != NO_NODE; c = ast[c].next) {
+                if (entry == nullptr && ast[c].kind != NodeKind::DECL) {
+                    entry = make<CallFunction>();
+                    instructions.push_back(entry);
+                    instructions.push_back(make<Exit>());
+                }
+                if (ast[c].kind == NodeKind::MAIN_FUNC_DEF) {
+                    entry->set_func(cast<FuncObject>(ast[c].object));
+                }
+                generate(c);
+            }
+            if (entry == nullptr) {
+                entry = make<CallFunction>();
+                instructions.push_back(entry);
+                instructions.push_back(make<Exit>());
+            }
+            break;
+        }
+        case NodeKind::DECL:
+            for (NodeId c = n.first; c != NO_NODE; c = ast[c].next) {
+                gen_var_def(c);
+            }
+            break;
+        case NodeKind::FUNC_DEF:
+        case NodeKind::MAIN_FUNC_DEF:
+            gen_func_def(node);
+            break;
+        default:
+            ERROR_LIMITED_SUPPORT(COMP_UNIT or DECL or FUNC_DEF or MAIN_FUNC_DEF);
+    }
+}
+
+void CodeGenerator::gen_func_def(NodeId node) {
+    auto &n = ast[node];
+    auto begin = (long long) instructions.size();
+    cast<FuncObject>(n.object)->code_offset = begin;
+    gen_stmt(n.first);
+    if (n.op != 0) {
+        instructions.push_back(make<ReturnValue>());
+    }
+    if (PeepholeOptimizer::enabled) {
+        PeepholeOptimizer(instructions, begin).run();
+    }
+}
+
+void CodeGenerator::gen_var_def(NodeId node) {
+    auto &n = ast[node];
+    for (NodeId c = n.first; c != NO_NODE; c = ast[c].next) {
+        if (ast[c].kind == NodeKind::INIT_VAL) {
+            for (NodeId v = ast[c].first; v != NO_NODE; v = ast[v].next) {
+                gen_expr(v);
+            }
+            if (n.object->type == TypeCode::INT_ARRAY) {
+                instructions.push_back(make<InitArray>(cast<ArrayObject>(n.object)));
+                // array is flattened for convenience,
+                // and need to be considered well when passed to functions
+            }
+        } else {
+            gen_expr(c);  // the size
+            instructions.push_back(make<BuildArray>());
+        }
+        emit_store(n.object);
+    }
+}
+
+void CodeGenerator::gen_stmt(NodeId node) {
+    auto &n = ast[node];
+    switch (n.kind) {
+        case NodeKind::BLOCK:
+            for (NodeId c = n.first; c != NO_NODE; c = ast[c].next) {
+                if (ast[c].kind == NodeKind::DECL) {
+                    generate(c);
+                } else {
+                    gen_stmt(c);
+                }
+            }
+            break;
+        case NodeKind::EXPR_STMT:
+            gen_expr(n.first);
+            instructions.push_back(make<PopTop>());
+            break;
+        case NodeKind::ASSIGN: {
+            NodeId value = n.first;
+            if (ast[value].next != NO_NODE) {  // into an element
+                gen_expr(value);
+                gen_expr(ast[value].next);
+                instructions.push_back(make<StoreSubscript>());
+            } else {
+                gen_expr(value);
+                emit_store(n.object);
+            }
+            break;
+        }
+        case NodeKind::IF: {
+            NodeId then = ast[n.first].next, otherwise = ast[then].next;
+            vector<JumpInstructionP> control_jump_instructions;
+            gen_cond(n.first, control_jump_instructions);
+            gen_stmt(then);
+            if (otherwise != NO_NODE) {
+                auto ja = make<JumpAbsolute>();
+                instructions.push_back(ja);
+                relocate_jump_instructions(control_jump_instructions);
+                gen_stmt(otherwise);
+                ja->set_offset((long long) instructions.size());
+            } else {
+                relocate_jump_instructions(control_jump_instructions);
+            }
+            break;
+        }
+        case NodeKind::WHILE: {
+            auto offset = (long long) instructions.size();
+            loop_info.emplace_back(offset);
+            vector<JumpInstructionP> control_jump_instructions;
+            int value;
+            if (!ast.constant(n.first, value)) {  // the parser drops a loop whose condition is always false
+                gen_cond(n.first, control_jump_instructions);
+            }
+            gen_stmt(ast[n.first].next);
+            instructions.push_back(make<JumpAbsolute>(offset));
+            relocate_jump_instructions(control_jump_instructions);
+            relocate_jump_instructions(loop_info.back().break_instructions);
+            loop_info.pop_back();
+            break;
+        }
+        case NodeKind::BREAK: {
+            auto ja = make<JumpAbsolute>();
+            instructions.push_back(ja);
+            loop_info.back().break_instructions.push_back(ja);
+            break;
+        }
+        case NodeKind::CONTINUE:
+            instructions.push_back(make<JumpAbsolute>(loop_info.back().start));
+            break;
+        case NodeKind::RETURN:
+            if (n.first != NO_NODE) {
+                gen_expr(n.first);
+            }
+            instructions.push_back(make<ReturnValue>());
+            break;
+        case NodeKind::PRINTF:
+            for (NodeId c = n.first; c != NO_NODE; c = ast[c].next) {
+                gen_expr(c);
+            }
+            instructions.push_back(make<PrintF>(cast<FormatString>(n.object)));
+            break;
+        default:
+            ERROR_NOT_SUPPORTED(expression as a statement);
+    }
+}
+
+void CodeGenerator::chain(NodeId node, int op, vector<NodeId> &operands) const {
+    // the operands of a chain of the logical `op`, which leans left
+    operands.clear();
+    for (; ast[node].kind == NodeKind::LOGICAL && ast[node].op == op; node = ast[node].first) {
+        operands.push_back(ast[ast[node].first].next);
+    }
+    operands.push_back(node);
+    reverse(operands.begin(), operands.end());
+}
+
+void CodeGenerator::gen_cond(NodeId node, vector<JumpInstructionP> &control_jump_instructions) {
+    // a false operand of an LAndExp skips to the next operand of the LOrExp, or past the statement if it is the last,
+    // a true operand of the LOrExp skips to the statement
+    eval_jump_instructions.clear();
+    and_eval_jump_instructions.clear();
+    chain(node, BinaryOpCode::BINARY_LOGICAL_OR, or_operands);
+    for (size_t i = 0; i < or_operands.size(); i++) {
+        chain(or_operands[i], BinaryOpCode::BINARY_LOGICAL_AND, and_operands);
+        for (size_t j = 0; j < and_operands.size(); j++) {
+            gen_expr(and_operands[j]);
+            if (j + 1 < and_operands.size()) {
+                auto bez = make<PopJumpIfFalse>();
+                instructions.push_back(bez);
+                and_eval_jump_instructions.push_back(bez);
+            }
+        }
+        if (i + 1 < or_operands.size()) {
+            auto bnz = make<PopJumpIfTrue>();
+            instructions.push_back(bnz);
+            eval_jump_instructions.push_back(bnz);
+            relocate_jump_instructions(and_eval_jump_instructions);
+            and_eval_jump_instructions.clear();
+        }
+    }
+    auto bez = make<PopJumpIfFalse>();
+    instructions.push_back(bez);
+    control_jump_instructions.push_back(bez);
+    control_jump_instructions.insert(control_jump_instructions.end(),
+                                     and_eval_jump_instructions.begin(), and_eval_jump_instructions.end());
+    relocate_jump_instructions(eval_jump_instructions);
+}
+
+void CodeGenerator::gen_expr(NodeId node) {
+    order.clear();
+    if (ast[node].first == NO_NODE) {
+        order.push_back(node);
+    } else {
+        ast.postorder(node, order, pending);
+    }
+    for (NodeId i: order) {
+        auto &n = ast[i];
+        switch (n.kind) {
+            case NodeKind::CONSTANT:
+                instructions.push_back(make<LoadFast>(n.object));
+                break;
+            case NodeKind::NAME:
+                if (n.object->is_const) {
+                    instructions.push_back(make<LoadFast>(n.object));
+                } else if (n.object->is_global) {
+                    instructions.push_back(make<LoadName>(n.object));
+                } else {
+                    instructions.push_back(make<LoadLocal>(n.object));
+                }
+                break;
+            case NodeKind::SUBSCRIPT:
+                instructions.push_back(make<SubscriptArray>());
+                break;
+            case NodeKind::UNARY:
+                instructions.push_back(make<UnaryOperation>((UnaryOpCode) n.op));
+                break;
+            case NodeKind::BINARY:
+                instructions.push_back(make<BinaryOperation>((BinaryOpCode) n.op));
+                break;
+            case NodeKind::CALL:
+                if (n.object != nullptr) {
+                    instructions.push_back(make<CallFunction>(cast<FuncObject>(n.object)));
+                }
+                break;
+            case NodeKind::GETINT:
+                instructions.push_back(make<GetInt>());
+                break;
+            default:  // LOGICAL is taken apart by `gen_cond`
+                ERROR_NOT_SUPPORTED(statement or logical operator in an expression);
+        }
+    }
+}
@@ -0,0 +1,72 @@
+//
+// Created by Kevin Tan on 2022/3/21.
+//
+
+#ifndef CODE_CODEGEN_H
+#define CODE_CODEGEN_H
+
+#include "arena.h"
+#include "ast.h"
+#include "instruction.h"
+
+struct LoopInfo {
+    long long start;
+    vector<JumpInstructionP> break_instructions;
+
+    explicit LoopInfo(long long start) : start(start) {}
+};
+
+// Emits the code of a checked `Ast`, with jumps absolute as if it started at offset 0 of `instructions`.
+// It can run again on the same tree, the parser is not needed.
+class CodeGenerator {
+    const Ast &ast;
+    vector<InstructionP> &instructions;
+    Arena *arena;  // where the instructions are made if set
+    shared_ptr<CallFunction> entry;  // the call to main of the last COMP_UNIT generated
+    vector<LoopInfo> loop_info;
+    vector<NodeId> order, pending;  // scratch of `gen_expr`
+    vector<NodeId> or_operands, and_operands;  // scratch of `gen_cond`
+    vector<JumpInstructionP> eval_jump_instructions, and_eval_jump_instructions;
+
+    template<typename T, typename... Args>
+    inline shared_ptr<T> make(Args &&...args) {
+        return arena != nullptr ? arena->make<T>(forward<Args>(args)...) : make_shared<T>(forward<Args>(args)...);
+    }
+
+    inline void relocate_jump_instructions(vector<JumpInstructionP> &is) const {
+        for (auto &i: is) {
+            i->set_offset((long long) instructions.size());
+        }
+    }
+
+    inline void emit_store(const ObjectP &object) {  // a local goes to its frame slot
+        if (object->is_global) {
+            instructions.push_back(make<StoreName>(object));
+        } else {
+            instructions.push_back(make<StoreLocal>(object));
+        }
+    }
+
+    void gen_func_def(NodeId node);
+
+    void gen_var_def(NodeId node);
+
+    void gen_stmt(NodeId node);
+
+    void chain(NodeId node, int op, vector<NodeId> &operands) const;
+
+    void gen_cond(NodeId node, vector<JumpInstructionP> &control_jump_instructions);
+
+    void gen_expr(NodeId node);
+
+public:
+    CodeGenerator(const Ast &ast, vector<InstructionP> &instructions, Arena *arena = nullptr) :
+            ast(ast), instructions(instructions), arena(arena) {}
+
+    void generate(NodeId node);  // a COMP_UNIT, or a DECL, FUNC_DEF or MAIN_FUNC_DEF on its own
+
+    // to be bound to main by whoever compiles its body apart from the CompUnit
+    inline const shared_ptr<CallFunction> &get_entry() const { return entry; }
+};
+
+#endif //CODE_CODEGEN_H
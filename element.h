@@ -29,137 +29,122 @@ using std::vector;
 using std::unordered_map;
 using std::move;
 
-struct Element {
-    string fullname;
+// Grammar elements, only named in the syntax trace, see `Parser::trace`.
 
-    Element() = default;
-
-    explicit Element(string &&name) : fullname(move(name)) {}
-
-    friend ostream &operator<<(ostream &out, const Element &self) {
-        out << self.fullname;
-        return out;
-    }
-
-    virtual ~Element() = default;
-};
-
-using ElementP = shared_ptr<Element>;
-
-struct CompUnit : public Element {
-    explicit CompUnit() : Element("<CompUnit>") {}
+struct CompUnit {
+    static const char *name() { return "<CompUnit>"; }
 };
 
-struct ConstDecl : public Element {
-    explicit ConstDecl() : Element("<ConstDecl>") {}
+struct ConstDecl {
+    static const char *name() { return "<ConstDecl>"; }
 };
 
-struct ConstDef : public Element {
-    explicit ConstDef() : Element("<ConstDef>") {}
+struct ConstDef {
+    static const char *name() { return "<ConstDef>"; }
 };
 
-struct ConstInitVal : public Element {
-    explicit ConstInitVal() : Element("<ConstInitVal>") {}
+struct ConstInitVal {
+    static const char *name() { return "<ConstInitVal>"; }
 };
 
-struct VarDecl : public Element {
-    explicit VarDecl() : Element("<VarDecl>") {}
+struct VarDecl {
+    static const char *name() { return "<VarDecl>"; }
 };
 
-struct VarDef : public Element {
-    explicit VarDef() : Element("<VarDef>") {}
+struct VarDef {
+    static const char *name() { return "<VarDef>"; }
 };
 
-struct InitVal : public Element {
-    explicit InitVal() : Element("<InitVal>") {}
+struct InitVal {
+    static const char *name() { return "<InitVal>"; }
 };
 
-struct FuncDef : public Element {
-    explicit FuncDef() : Element("<FuncDef>") {}
+struct FuncDef {
+    static const char *name() { return "<FuncDef>"; }
 };
 
-struct MainFuncDef : public Element {
-    explicit MainFuncDef() : Element("<MainFuncDef>") {}
+struct MainFuncDef {
+    static const char *name() { return "<MainFuncDef>"; }
 };
 
-struct FuncType : public Element {
-    explicit FuncType() : Element("<FuncType>") {}
+struct FuncType {
+    static const char *name() { return "<FuncType>"; }
 };
 
-struct FuncFormalParams : public Element {
-    explicit FuncFormalParams() : Element("<FuncFParams>") {}
+struct FuncFormalParams {
+    static const char *name() { return "<FuncFParams>"; }
 };
 
-struct FuncFormalParam : public Element {
-    explicit FuncFormalParam() : Element("<FuncFParam>") {}
+struct FuncFormalParam {
+    static const char *name() { return "<FuncFParam>"; }
 };
 
-struct Block : public Element {
-    explicit Block() : Element("<Block>") {}
+struct Block {
+    static const char *name() { return "<Block>"; }
 };
 
-struct Statement : public Element {
-    explicit Statement() : Element("<Stmt>") {}
+struct Statement {
+    static const char *name() { return "<Stmt>"; }
 };
 
-struct NormalExpr : public Element {
-    explicit NormalExpr() : Element("<Exp>") {}
+struct NormalExpr {
+    static const char *name() { return "<Exp>"; }
 };
 
-struct ConditionExpr : public Element {
-    explicit ConditionExpr() : Element("<Cond>") {}
+struct ConditionExpr {
+    static const char *name() { return "<Cond>"; }
 };
 
-struct LValue : public Element {
-    explicit LValue() : Element("<LVal>") {}
+struct LValue {
+    static const char *name() { return "<LVal>"; }
 };
 
-struct PrimaryExpr : public Element {
-    explicit PrimaryExpr() : Element("<PrimaryExp>") {}
+struct PrimaryExpr {
+    static const char *name() { return "<PrimaryExp>"; }
 };
 
-struct Number : public Element {
-    explicit Number() : Element("<Number>") {}
+struct Number {
+    static const char *name() { return "<Number>"; }
 };
 
-struct UnaryExpr : public Element {
-    explicit UnaryExpr() : Element("<UnaryExp>") {}
+struct UnaryExpr {
+    static const char *name() { return "<UnaryExp>"; }
 };
 
-struct UnaryOp : public Element {
-    explicit UnaryOp() : Element("<UnaryOp>") {}
+struct UnaryOp {
+    static const char *name() { return "<UnaryOp>"; }
 };
 
-struct FuncRealParams : public Element {
-    explicit FuncRealParams() : Element("<FuncRParams>") {}
+struct FuncRealParams {
+    static const char *name() { return "<FuncRParams>"; }
 };
 
-struct MulDivExpr : public Element {
-    explicit MulDivExpr() : Element("<MulExp>") {}
+struct MulDivExpr {
+    static const char *name() { return "<MulExp>"; }
 };
 
-struct AddSubExpr : public Element {
-    explicit AddSubExpr() : Element("<AddExp>") {}
+struct AddSubExpr {
+    static const char *name() { return "<AddExp>"; }
 };
 
-struct RelationalExpr : public Element {
-    explicit RelationalExpr() : Element("<RelExp>") {}
+struct RelationalExpr {
+    static const char *name() { return "<RelExp>"; }
 };
 
-struct EqualExpr : public Element {
-    explicit EqualExpr() : Element("<EqExp>") {}
+struct EqualExpr {
+    static const char *name() { return "<EqExp>"; }
 };
 
-struct LogicalAndExpr : public Element {
-    explicit LogicalAndExpr() : Element("<LAndExp>") {}
+struct LogicalAndExpr {
+    static const char *name() { return "<LAndExp>"; }
 };
 
-struct LogicalOrExpr : public Element {
-    explicit LogicalOrExpr() : Element("<LOrExp>") {}
+struct LogicalOrExpr {
+    static const char *name() { return "<LOrExp>"; }
 };
 
-struct ConstExpr : public Element {
-    explicit ConstExpr() : Element("<ConstExp>") {}
+struct ConstExpr {
+    static const char *name() { return "<ConstExp>"; }
 };
 
 #endif //CODE_ELEMENT_H
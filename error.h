@@ -8,7 +8,7 @@
 #include <iostream>
 #include <queue>
 
-#define ERROR_EXPECTED_GOT(expected, got) do { cerr << "In " << __func__ << " line " << __LINE__ << " source code line " << (*(got))->line << ", expected "#expected", got " << **(got) << endl; exit(-1); } while (0)
+#define ERROR_EXPECTED_GOT(expected, got) do { cerr << "In " << __func__ << " line " << __LINE__ << " source code line " << (got)->line << ", expected "#expected", got " << *(got) << endl; exit(-1); } while (0)
 #define ERROR_NOT_SUPPORTED(got) do { cerr << "In " << __func__ << " line " << __LINE__ << ", "#got" is not supported." << endl; exit(-1); } while (0)
 #define ERROR_LIMITED_SUPPORT_WITH_LINE(line, support) do { cerr << "In " << __func__ << " line " << __LINE__ << " source code line " << (line) << ", only supports "#support << endl; exit(-1); } while (0)
 #define ERROR_LIMITED_SUPPORT(support) do { cerr << "In " << __func__ << " line " << __LINE__ << ", only supports "#support << endl; exit(-1); } while (0)
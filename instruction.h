@@ -5,24 +5,15 @@
 #ifndef CODE_INSTRUCTION_H
 #define CODE_INSTRUCTION_H
 
-#include <sstream>
 #include <utility>
 #include "token.h"
 #include "opcode.h"
 
-class Instruction {
+class Instruction {  // as emitted and linked, it is run once assembled into `Bytecode`
 public:
     OpCode opcode;
-    std::stringstream name;
 
-    Instruction(OpCode opcode, const char *name) : opcode(opcode) {
-        this->name << name;
-    }
-
-    friend ostream &operator<<(ostream &out, const Instruction &self) {
-        out << self.name.str();
-        return out;
-    }
+    explicit Instruction(OpCode opcode) : opcode(opcode) {}
 
     virtual ~Instruction() = default;
 };
@@ -33,50 +24,18 @@ class LoadName : public Instruction {
 public:
     ObjectP object;
 
-    explicit LoadName(const ObjectP &object) : Instruction(NAME(LOAD_NAME) "\t\t"), object(object) {
-        IdentP i = object->ident_info;
-        switch (object->type) {
-            case TypeCode::INT: {
-                name << i->name << "\t\t(INT, declared in line " << i->line << ')';
-                break;
-            }
-            case TypeCode::INT_ARRAY: {
-                name << i->name << "\t\t(INT_ARRAY, declared in line " << i->line << ')';
-                break;
-            }
-            default:
-//                ERROR_LIMITED_SUPPORT(INT or INT_ARRAY);
-                break;
-        }
-    }
+    explicit LoadName(const ObjectP &object) : Instruction(LOAD_NAME), object(object) {}
 };
 
 class LoadFast : public Instruction {
 public:
     ObjectP object;
 
-    explicit LoadFast(const ObjectP &object) : Instruction(NAME(LOAD_FAST) "\t\t"), object(object) {
+    explicit LoadFast(const ObjectP &object) : Instruction(LOAD_FAST), object(object) {
         switch (object->type) {
-            case TypeCode::INT: {
-                auto o = cast<IntObject>(object);
-                if (object->ident_info == nullptr) {
-                    name << o->value;
-                } else {
-                    name << o->ident_info->name << "\t\t(INT, declared in line "
-                         << o->ident_info->line << " at " << o << ')';
-                }
-                break;
-            }
-            case TypeCode::INT_ARRAY: {
-                auto o = cast<ArrayObject>(object);
-                if (object->ident_info != nullptr) {
-                    name << o->ident_info->name << "\t\t(INT_ARRAY, declared in line "
-                         << o->ident_info->line << " at " << o << ')';
-                }
-                break;
-            }
+            case TypeCode::INT:
+            case TypeCode::INT_ARRAY:
             case TypeCode::CHAR_ARRAY:
-                name << "\t\t" << cast<StringObject>(object)->value;
                 break;
             default:
                 ERROR_LIMITED_SUPPORT(INT or INT_ARRAY or CHAR_ARRAY);
@@ -86,83 +45,89 @@ public:
 
 class BuildArray : public Instruction {
 public:
-    explicit BuildArray() : Instruction(NAME(BUILD_ARRAY)) {}
+    explicit BuildArray() : Instruction(BUILD_ARRAY) {}
 };
 
 class InitArray : public Instruction {
 public:
-    explicit InitArray(const ArrayObjectP &array) : Instruction(NAME(INIT_ARRAY)) {}
+    explicit InitArray(const ArrayObjectP &array) : Instruction(INIT_ARRAY) {}
 };
 
 class SubscriptArray : public Instruction {
 public:
-    explicit SubscriptArray() : Instruction(NAME(SUBSCR_ARRAY)) {}
+    explicit SubscriptArray() : Instruction(SUBSCR_ARRAY) {}
 };
 
 class StoreSubscript : public Instruction {
 public:
-    explicit StoreSubscript() : Instruction(NAME(STORE_SUBSCR)) {}
+    explicit StoreSubscript() : Instruction(STORE_SUBSCR) {}
 };
 
 class StoreName : public Instruction {
 public:
     ObjectP object;
+    bool keep = false;  // the value stays on the stack, as if loaded back
+
+    explicit StoreName(const ObjectP &object) : Instruction(STORE_NAME), object(object) {
+        IdentP i = object->ident_info;
+        if (i != nullptr && object->type != TypeCode::INT && object->type != TypeCode::INT_ARRAY) {
+            ERROR_LIMITED_SUPPORT_WITH_LINE(i->line, INT or INT_ARRAY assignment);
+        }
+    }
+};
+
+class LoadLocal : public Instruction {  // a local is addressed by its slot instead of being looked up by name
+public:
+    ObjectP object;
+
+    explicit LoadLocal(const ObjectP &object) : Instruction(LOAD_LOCAL), object(object) {}
+};
+
+class StoreLocal : public Instruction {
+public:
+    ObjectP object;
+    bool keep = false;  // the value stays on the stack, as if loaded back
 
-    explicit StoreName(const ObjectP &object) : Instruction(NAME(STORE_NAME) "\t\t"), object(object) {
+    explicit StoreLocal(const ObjectP &object) : Instruction(STORE_LOCAL), object(object) {
         IdentP i = object->ident_info;
-        if (i != nullptr) {
-            switch (object->type) {
-                case TypeCode::INT:
-                    name << i->name << "\t\t(INT, declared in line " << i->line << ')';
-                    break;
-                case TypeCode::INT_ARRAY:
-                    name << i->name << "\t\t(INT_ARRAY, declared in line " << i->line << ')';
-                    break;
-                default:
-                    ERROR_LIMITED_SUPPORT_WITH_LINE(i->line, INT or INT_ARRAY assignment);
-            }
+        if (i != nullptr && object->type != TypeCode::INT && object->type != TypeCode::INT_ARRAY) {
+            ERROR_LIMITED_SUPPORT_WITH_LINE(i->line, INT or INT_ARRAY assignment);
         }
     }
 };
 
 class PopTop : public Instruction {  // used when value is not used
 public:
-    explicit PopTop() : Instruction(NAME(POP_TOP)) {}
+    explicit PopTop() : Instruction(POP_TOP) {}
 };
 
 class Exit : public Instruction {
 public:
-    explicit Exit() : Instruction(NAME(EXIT_INTERP) "\n") {}
+    explicit Exit() : Instruction(EXIT_INTERP) {}
 };
 
 class PrintF : public Instruction {
 public:
     FormatStringP format_string;
 
-    explicit PrintF(const FormatStringP &format_string) : Instruction(NAME(CALL_PRINTF) "\t\t"),
-                                                          format_string(format_string) {
-        name << format_string->value;
-    }
+    explicit PrintF(const FormatStringP &format_string) : Instruction(CALL_PRINTF), format_string(format_string) {}
 };
 
 class GetInt : public Instruction {
 public:
-    explicit GetInt() : Instruction(NAME(CALL_GETINT)) {}
+    explicit GetInt() : Instruction(CALL_GETINT) {}
 };
 
 class JumpInstruction : public Instruction {
-    long long offset = 0;
+    long long offset = -1;  // not known yet
 public:
-    JumpInstruction(OpCode opcode, const char *name) : Instruction(opcode, name) {}
+    explicit JumpInstruction(OpCode opcode) : Instruction(opcode) {}
 
-    JumpInstruction(OpCode opcode, const char *name, long long offset) : Instruction(opcode, name) {
+    JumpInstruction(OpCode opcode, long long offset) : Instruction(opcode) {
         set_offset(offset);
     }
 
-    inline void set_offset(long long o) {
-        offset = o;
-        name << o << '\n';
-    }
+    inline void set_offset(long long o) { offset = o; }
 
     inline long long get_offset() const { return offset; }
 };
@@ -171,113 +136,63 @@ using JumpInstructionP = shared_ptr<JumpInstruction>;
 
 class JumpAbsolute : public JumpInstruction {
 public:
-    JumpAbsolute() : JumpInstruction(NAME(JUMP_ABSOLUTE) "\t\t") {}
+    JumpAbsolute() : JumpInstruction(JUMP_ABSOLUTE) {}
 
-    explicit JumpAbsolute(long long offset) : JumpInstruction(NAME(JUMP_ABSOLUTE) "\t\t", offset) {}
+    explicit JumpAbsolute(long long offset) : JumpInstruction(JUMP_ABSOLUTE, offset) {}
 };
 
 class PopJumpIfFalse : public JumpInstruction {
 public:
-    PopJumpIfFalse() : JumpInstruction(NAME(POP_JUMP_IF_FALSE) "\t") {}
+    PopJumpIfFalse() : JumpInstruction(POP_JUMP_IF_FALSE) {}
 
-    explicit PopJumpIfFalse(long long offset) : JumpInstruction(NAME(POP_JUMP_IF_FALSE) "\t", offset) {}
+    explicit PopJumpIfFalse(long long offset) : JumpInstruction(POP_JUMP_IF_FALSE, offset) {}
 };
 
 class PopJumpIfTrue : public JumpInstruction {
 public:
-    PopJumpIfTrue() : JumpInstruction(NAME(POP_JUMP_IF_TRUE) "\t") {}
+    PopJumpIfTrue() : JumpInstruction(POP_JUMP_IF_TRUE) {}
 
-    explicit PopJumpIfTrue(long long offset) : JumpInstruction(NAME(POP_JUMP_IF_TRUE) "\t", offset) {}
+    explicit PopJumpIfTrue(long long offset) : JumpInstruction(POP_JUMP_IF_TRUE, offset) {}
 };
 
 class CallFunction : public Instruction {
     FuncObjectP func;
 public:
-    CallFunction() : Instruction(NAME(CALL_FUNCTION) "\t\t") {}
+    CallFunction() : Instruction(CALL_FUNCTION) {}
 
-    explicit CallFunction(const FuncObjectP &func) : Instruction(NAME(CALL_FUNCTION) "\t\t") { set_func(func); }
+    explicit CallFunction(const FuncObjectP &func) : Instruction(CALL_FUNCTION) { set_func(func); }
 
-    inline void set_func(const FuncObjectP &f) {
-        func = f;
-        name << f->ident_info->name << "\t\t(" << f->params.size() << " args, offset " << f->code_offset
-             << ", declared in line " << f->ident_info->line << " at " << f << ")\n";
-    }
+    inline void set_func(const FuncObjectP &f) { func = f; }
 
     inline FuncObjectP get_func() const { return func; }
 };
 
+class CodeLoader {  // compiles a function when it is first called
+public:
+    // appends the code of `func` to the instructions being run and sets its `code_offset`, false if it has errors
+    virtual bool load(const FuncObjectP &func) = 0;
+};
+
 class ReturnValue : public Instruction {
 public:
-    explicit ReturnValue() : Instruction(NAME(RETURN_VALUE) "\n") {}
+    explicit ReturnValue() : Instruction(RETURN_VALUE) {}
 };
 
 class UnaryOperation : public Instruction {
 public:
     UnaryOpCode unary_opcode;
 
-    explicit UnaryOperation(UnaryOpCode opcode) : Instruction(NAME(UNARY_OP) "\t\t"), unary_opcode(opcode) {
-        switch (opcode) {
-            case UNARY_POSITIVE:
-                name << '+';
-                break;
-            case UNARY_NEGATIVE:
-                name << '-';
-                break;
-            case UNARY_NOT:
-                name << '!';
-                break;
-        }
-    }
+    explicit UnaryOperation(UnaryOpCode opcode) : Instruction(UNARY_OP), unary_opcode(opcode) {}
 };
 
 class BinaryOperation : public Instruction {
 public:
     BinaryOpCode binary_opcode;
 
-    explicit BinaryOperation(BinaryOpCode opcode) : Instruction(NAME(BINARY_OP) "\t\t"), binary_opcode(opcode) {
-        switch (opcode) {
-            case BINARY_ADD:
-                name << '+';
-                break;
-            case BINARY_SUB:
-                name << '-';
-                break;
-            case BINARY_MUL:
-                name << '*';
-                break;
-            case BINARY_DIV:
-                name << '/';
-                break;
-            case BINARY_MOD:
-                name << '%';
-                break;
-            case BINARY_EQ:
-                name << "==";
-                break;
-            case BINARY_NE:
-                name << "!=";
-                break;
-            case BINARY_LT:
-                name << '<';
-                break;
-            case BINARY_LE:
-                name << "<=";
-                break;
-            case BINARY_GT:
-                name << '>';
-                break;
-            case BINARY_GE:
-                name << ">=";
-                break;
-            case BINARY_LOGICAL_AND:
-                name << "&&";
-                break;
-            case BINARY_LOGICAL_OR:
-                name << "||";
-                break;
-            default:
-                cerr << "In " << __func__ << " line " << __LINE__
-                     << " source code line, NOTHING binary operation shouldn't be generated." << endl;
+    explicit BinaryOperation(BinaryOpCode opcode) : Instruction(BINARY_OP), binary_opcode(opcode) {
+        if (opcode == NOTHING) {
+            cerr << "In " << __func__ << " line " << __LINE__
+                 << " source code line, NOTHING binary operation shouldn't be generated." << endl;
         }
     }
 };
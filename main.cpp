@@ -1,32 +1,231 @@
 #include <ratio>
 #include <chrono>
+#include <thread>
 
 #include "tokenizer.h"
 #include "parser.h"
+#include "session.h"
+#include "module.h"
+#include "cache.h"
 #include "vm.h"
 
-int main() {
+static int watch(const string &filename) {
+    // recompiles the source incrementally whenever it changes, until interrupted
+    Session session;
+    while (true) {
+        ifstream file(filename, ios::binary);
+        if (!file.is_open()) {
+            perror("Failed to open source file");
+            exit(EXIT_FAILURE);
+        }
+        stringstream source;
+        source << file.rdbuf();
+        auto start = chrono::high_resolution_clock::now();
+        if (session.compile(source.str())) {
+            chrono::duration<double, milli> duration_ms(chrono::high_resolution_clock::now() - start);
+            cout << "Compiled in " << duration_ms.count() << " ms, " << session.reparsed << " items parsed, "
+                 << session.relexed << " bytes lexed, " << session.instructions.size() << " instructions" << endl;
+            cout << session.error;
+        }
+        this_thread::sleep_for(chrono::milliseconds(200));
+    }
+}
+
+static int watch(const vector<string> &filenames) {
+    // relinks the modules whenever one of them changes, compiling only those that changed, until interrupted
+    Program program;
+    while (true) {
+        auto start = chrono::high_resolution_clock::now();
+        bool linked = program.build(filenames);
+        if (program.compiled > 0) {
+            chrono::duration<double, milli> duration_ms(chrono::high_resolution_clock::now() - start);
+            cout << "Built in " << duration_ms.count() << " ms, " << program.compiled << " modules compiled, "
+                 << program.instructions.size() << " instructions" << endl;
+            program.print_errors(cout);
+            if (!linked) {
+                for (auto &e: program.link_errors) {
+                    cout << e << endl;
+                }
+            }
+        }
+        this_thread::sleep_for(chrono::milliseconds(200));
+    }
+}
+
+static int run_modules(const vector<string> &filenames, bool listing) {
+    // compiles each source as a module and links them, errors go to error.txt with the file they are in
+    Program program;
+    bool linked = program.build(filenames);
+    if (program.has_errors()) {
+        ofstream error_stream("error.txt");
+        if (!error_stream.is_open()) {
+            perror("Failed to create error file");
+            exit(EXIT_FAILURE);
+        }
+        program.print_errors(error_stream);
+        return EXIT_SUCCESS;
+    }
+    if (!linked) {
+        for (auto &e: program.link_errors) {
+            cerr << e << endl;
+        }
+        return EXIT_FAILURE;
+    }
+    ofstream result("pcoderesult.txt");
+    if (!result.is_open()) {
+        perror("Failed to create result file");
+        exit(EXIT_FAILURE);
+    }
+    StackMachine machine(program.instructions, program.globals(), result);
+    if (listing) {
+        cout << machine;
+    }
+    auto start = chrono::high_resolution_clock::now();
+    machine.run();
+    chrono::duration<double, ratio<1, 1>> duration_s(chrono::high_resolution_clock::now() - start);
+    cout << "Process finished in " << duration_s.count() << " seconds" << endl;
+    return EXIT_SUCCESS;
+}
+
+static int run_cached(const string &filename, const string &dir, bool use_mmap, int threads, bool listing) {
+    // runs the bytecode cached for the source if there is, otherwise compiles it eagerly and caches it
+    SourceFile source(filename, use_mmap);
+    BytecodeCache cache(dir);
+    string key = BytecodeCache::key(source.data(), source.length());
+    Bytecode bytecode;
+    vector<ObjectP> data_image;
     Error error;
+    unique_ptr<Tokenizer> tokenizer;  // the objects compiled live in the parser, and the format strings in the source
+    unique_ptr<Parser> parser;
+    auto start = chrono::high_resolution_clock::now();
+    bool hit = cache.load(key, bytecode, data_image);
+    if (!hit) {
+        bytecode = Bytecode();  // what a stale file left
+        tokenizer.reset(new Tokenizer(source.data(), source.length(), error, threads));
+        parser.reset(new Parser(tokenizer->tokens, error, nullptr, threads));
+        if (!error.errors.empty()) {
+            ofstream error_stream("error.txt");
+            if (!error_stream.is_open()) {
+                perror("Failed to create error file");
+                exit(EXIT_FAILURE);
+            }
+            error_stream << error;
+            return EXIT_SUCCESS;
+        }
+        bytecode.assemble(parser->instructions);
+        cache.store(key, bytecode, parser->data_image);
+        data_image = move(parser->data_image);
+    }
+    chrono::duration<double, milli> load_ms(chrono::high_resolution_clock::now() - start);
+    cout << (hit ? "Loaded from cache in " : "Compiled and cached in ") << load_ms.count() << " ms" << endl;
 
-    Tokenizer tokenizer("testfile.txt", error);
+    ofstream result("pcoderesult.txt");
+    if (!result.is_open()) {
+        perror("Failed to create result file");
+        exit(EXIT_FAILURE);
+    }
+    StackMachine machine(move(bytecode), move(data_image), result);
+    if (listing) {
+        cout << machine;
+    }
+    start = chrono::high_resolution_clock::now();
+    machine.run();
+    chrono::duration<double, ratio<1, 1>> duration_s(chrono::high_resolution_clock::now() - start);
+    cout << "Process finished in " << duration_s.count() << " seconds" << endl;
+    return EXIT_SUCCESS;
+}
 
-//    ofstream output("output.txt");
-    Parser parser(tokenizer.tokens, error);
-//    output << parser;
+int main(int argc, char **argv) {
+    // Usage: Code [--mmap] [-j threads | --stream | --watch] [--syntax] [--check | --lazy [--full-check]] [--listing]
+    //             [source file, testfile.txt by default]
+    //        Code [--mmap] [-j threads] --cache dir [--listing] [source file]
+    //        Code [--watch | --listing] module... (more than one source file, linked together)
+    vector<string> filenames;
+    bool use_mmap = false;
+    int threads = 1;
+    bool streaming = false;
+    bool watching = false;
+    bool tracing = false;
+    bool listing = false;
+    bool lazy = false;
+    bool full_check = false;
+    bool checking = false;
+    string cache_dir;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--mmap") {
+            use_mmap = true;  // tokens refer to the mapped file instead of a copy of it
+        } else if (arg == "--stream") {
+            streaming = true;  // the parser pulls tokens from the tokenizer as it goes
+        } else if (arg == "--syntax") {
+            tracing = true;  // writes the tokens and grammar elements parsed to output.txt
+        } else if (arg == "--listing") {
+            listing = true;  // prints the code disassembled
+        } else if (arg == "--check") {
+            checking = true;  // only writes the errors to error.txt, compiling and running nothing
+        } else if (arg == "--lazy") {
+            lazy = true;  // compiles each function when it is first called
+        } else if (arg == "--full-check") {
+            full_check = true;  // with --lazy, reports the errors of the functions never called too
+        } else if (arg == "--watch") {
+            watching = true;  // keeps compiling the source as it is edited, reporting errors only
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cache_dir = argv[++i];  // runs the bytecode compiled from the same source before, kept in the directory
+        } else if (arg == "-j" && i + 1 < argc) {
+            threads = atoi(argv[++i]);  // tokenizes large sources and compiles function bodies in parallel
+        } else {
+            filenames.push_back(arg);
+        }
+    }
+    if (filenames.size() > 1) {
+        return watching ? watch(filenames) : run_modules(filenames, listing);
+    }
+    string filename = filenames.empty() ? "testfile.txt" : filenames[0];
+
+    if (watching) {
+        return watch(filename);
+    }
+    if (!cache_dir.empty()) {
+        return run_cached(filename, cache_dir, use_mmap, threads, listing);
+    }
 
-    if (error.errors.empty()) {
+    Error error;
+
+    Tokenizer tokenizer(filename, error, use_mmap, threads, streaming);
+
+    ofstream output;
+    if (tracing) {
+        output.open("output.txt");
+        if (!output.is_open()) {
+            perror("Failed to create output file");
+            exit(EXIT_FAILURE);
+        }
+    }
+    CompileMode mode = checking ? CompileMode::CHECK_ONLY : !lazy ? CompileMode::EAGER :
+                       full_check ? CompileMode::LAZY_CHECKED : CompileMode::LAZY;
+    Parser parser(tokenizer.tokens, error, tracing ? &output : nullptr, threads, mode);
+    output.close();
+
+    if (error.errors.empty() && !checking) {
         ofstream result("pcoderesult.txt");
         if (!result.is_open()) {
             perror("Failed to create result file");
             exit(EXIT_FAILURE);
         }
-        StackMachine machine(parser.instructions, parser.sym_table.back(), result);
-        cout << machine;
+        StackMachine machine(parser.instructions, move(parser.data_image), result, &parser);
+        if (listing && mode == CompileMode::EAGER) {
+            cout << machine;
+        }
         auto start = chrono::high_resolution_clock::now();
         machine.run();
         chrono::duration<double, ratio<1, 1>> duration_s(chrono::high_resolution_clock::now() - start);
+        if (listing && mode != CompileMode::EAGER) {
+            cout << machine;  // with the functions that were called
+        }
         cout << "Process finished in " << duration_s.count() << " seconds" << endl;
-    } else {
+    }
+    bool failed = !error.errors.empty();  // found before running, or in a function compiled when it was called
+    if (failed) {
         ofstream error_stream("error.txt");
         if (!error_stream.is_open()) {
             perror("Failed to create error file");
@@ -34,5 +233,5 @@ int main() {
         }
         error_stream << error;
     }
-    return EXIT_SUCCESS;
+    return checking && failed ? EXIT_FAILURE : EXIT_SUCCESS;  // so that a check can gate
 }
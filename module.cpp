@@ -0,0 +1,252 @@
+//
+// Created by Kevin Tan on 2022/3/24.
+//
+
+#include <sstream>
+#include "module.h"
+
+static bool same_type(const ObjectP &a, const ObjectP &b) {
+    // whether an extern declaration agrees with the definition it is bound to
+    if (a->type != b->type) {
+        return false;
+    }
+    if (a->type == TypeCode::INT_ARRAY) {
+        return cast<ArrayObject>(a)->dims == cast<ArrayObject>(b)->dims;
+    }
+    if (a->type != TypeCode::FUNCTION) {
+        return true;
+    }
+    auto f = cast<FuncObject>(a), g = cast<FuncObject>(b);
+    if (f->return_type != g->return_type || f->params.size() != g->params.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < f->params.size(); i++) {
+        if (!same_type(f->params[i], g->params[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static string quoted(const ObjectP &object) {
+    return '`' + object->ident_info->name().str() + '`';
+}
+
+void Module::compile(shared_ptr<const string> source) {
+    // item by item like `Session`, so that the code of each function can be moved on its own when linking
+    text = move(source);
+    init_code.clear();
+    code.clear();
+    base = 0;
+    jumps.clear();
+    funcs.clear();
+    main = nullptr;
+    defined.clear();
+    externs.clear();
+    imports.clear();
+    errors.clear();
+
+    Error error;
+    Tokenizer tokenizer(text->c_str(), (long long) text->size(), error);
+    Parser parser(tokenizer.tokens, error, HashMap());
+    parser.in_module = true;
+    ItemKind last = ItemKind::DECL;
+    for (auto tk = tokenizer.tokens.begin(); tk < tokenizer.tokens.end();) {
+        last = parser.parse_item(tk, last);
+        if (last == ItemKind::TAIL) {
+            break;  // what follows main is not parsed, as by `Parser::parse_comp_unit`
+        }
+        for (auto &d: parser.global_decls) {
+            if (d.second->is_extern) {
+                externs.push_back(d);
+            } else if (!d.second->is_const) {  // constants are used in place, so each module has its own
+                defined.push_back(d);
+            }
+        }
+        if (last == ItemKind::DECL) {  // initializers are expressions without conditions, so without jumps
+            init_code.insert(init_code.end(), parser.instructions.begin(), parser.instructions.end());
+        } else {
+            auto at = (long long) code.size();
+            for (auto &i: parser.instructions) {
+                if (i->opcode == JUMP_ABSOLUTE || i->opcode == POP_JUMP_IF_FALSE || i->opcode == POP_JUMP_IF_TRUE) {
+                    auto j = cast<JumpInstruction>(i);
+                    if (j->get_offset() >= 0) {
+                        j->set_offset(j->get_offset() + at);
+                    }
+                    jumps.push_back(j);
+                }
+            }
+            parser.item_func->code_offset = at;
+            funcs.push_back(parser.item_func);
+            if (last == ItemKind::MAIN) {
+                main = parser.item_func;
+            }
+            code.insert(code.end(), parser.instructions.begin(), parser.instructions.end());
+        }
+        parser.instructions.clear();
+    }
+    data_image.swap(parser.data_image);
+
+    for (auto block: {&init_code, &code}) {
+        for (auto &i: *block) {
+            ObjectP o;
+            switch (i->opcode) {
+                case LOAD_NAME:
+                    o = cast<LoadName>(i)->object;
+                    break;
+                case STORE_NAME:
+                    o = cast<StoreName>(i)->object;
+                    break;
+                case CALL_FUNCTION:
+                    o = cast<CallFunction>(i)->get_func();
+                    break;
+                default:
+                    continue;
+            }
+            if (o != nullptr && o->is_extern) {
+                imports.emplace_back(i, o->ident_info->symbol);
+            }
+        }
+    }
+    for (; !error.errors.empty(); error.errors.pop()) {
+        errors.push_back(error.errors.top());
+    }
+}
+
+void Module::move_code(long long to) {
+    if (to == base) {
+        return;
+    }
+    for (auto &j: jumps) {
+        if (j->get_offset() >= 0) {
+            j->set_offset(j->get_offset() + to - base);
+        }
+    }
+    for (auto &f: funcs) {
+        f->code_offset += to - base;
+    }
+    base = to;
+}
+
+bool Program::build(const vector<string> &filenames) {
+    compiled = 0;
+    modules.clear();
+    for (auto &filename: filenames) {
+        ifstream file(filename, ios::binary);
+        if (!file.is_open()) {
+            perror("Failed to open source file");
+            exit(EXIT_FAILURE);
+        }
+        stringstream source;
+        source << file.rdbuf();
+        auto &module = cache[filename];
+        if (module == nullptr) {
+            module.reset(new Module(filename));
+        }
+        if (module->text == nullptr || *module->text != source.str()) {
+            module->compile(make_shared<const string>(padded(source.str())));
+            compiled++;
+        }
+        modules.push_back(module.get());
+    }
+    return link();
+}
+
+bool Program::link() {
+    // lays the modules out like `CodeGenerator` does a CompUnit: the global declarations of each in order,
+    // the call to main, then the functions, and binds what each module declares extern to its definition
+    instructions.clear();
+    link_errors.clear();
+    unordered_map<SymbolId, pair<ObjectP, const Module *>> symbols;
+    FuncObjectP main;
+    int slot_cnt = 0;
+    for (Module *m: modules) {
+        for (auto &o: m->data_image) {
+            o->slot = slot_cnt++;
+        }
+        for (auto &d: m->defined) {
+            auto it = symbols.emplace(d.first, make_pair(d.second, m));
+            if (!it.second) {
+                link_errors.push_back(m->filename + ": multiple definition of " + quoted(d.second) +
+                                      ", first defined in " + it.first->second.second->filename);
+            }
+        }
+        if (m->main != nullptr) {
+            if (main == nullptr) {
+                main = m->main;
+            } else {
+                link_errors.push_back(m->filename + ": multiple definition of `main`");
+            }
+        }
+        instructions.insert(instructions.end(), m->init_code.begin(), m->init_code.end());
+    }
+    if (main == nullptr) {
+        link_errors.emplace_back("undefined reference to `main`");
+    }
+    instructions.push_back(make_shared<CallFunction>(main));
+    instructions.push_back(make_shared<Exit>());
+    for (Module *m: modules) {
+        m->move_code((long long) instructions.size());
+        instructions.insert(instructions.end(), m->code.begin(), m->code.end());
+    }
+
+    for (Module *m: modules) {
+        unordered_map<SymbolId, ObjectP> bound;
+        for (auto &e: m->externs) {
+            auto it = symbols.find(e.first);
+            if (it == symbols.end()) {
+                link_errors.push_back(m->filename + ": undefined reference to " + quoted(e.second));
+            } else if (!same_type(e.second, it->second.first)) {
+                link_errors.push_back(m->filename + ": " + quoted(e.second) + " is declared unlike its definition in " +
+                                      it->second.second->filename);
+            } else {
+                bound.emplace(e.first, it->second.first);
+            }
+        }
+        for (auto &import: m->imports) {
+            auto it = bound.find(import.second);
+            if (it == bound.end()) {
+                continue;
+            }
+            auto &i = import.first;
+            switch (i->opcode) {
+                case LOAD_NAME:
+                    cast<LoadName>(i)->object = it->second;
+                    break;
+                case STORE_NAME:
+                    cast<StoreName>(i)->object = it->second;
+                    break;
+                default:
+                    cast<CallFunction>(i)->set_func(cast<FuncObject>(it->second));
+            }
+        }
+    }
+    return link_errors.empty();
+}
+
+bool Program::has_errors() const {
+    for (Module *m: modules) {
+        if (!m->errors.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Program::print_errors(ostream &out) const {
+    for (Module *m: modules) {
+        for (auto &e: m->errors) {
+            out << m->filename << ' ' << e.first << ' ' << e.second << endl;
+        }
+    }
+}
+
+vector<ObjectP> Program::globals() const {
+    vector<ObjectP> result;
+    for (Module *m: modules) {
+        for (auto &o: m->data_image) {
+            result.push_back(o->type == TypeCode::INT_ARRAY ? cast<ArrayObject>(o)->clone() : o->copy());
+        }
+    }
+    return result;
+}
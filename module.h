@@ -0,0 +1,58 @@
+//
+// Created by Kevin Tan on 2022/3/24.
+//
+
+#ifndef CODE_MODULE_H
+#define CODE_MODULE_H
+
+#include "tokenizer.h"
+#include "parser.h"
+
+// A source file compiled on its own with its own symbol table. What it declares `extern` is left unbound
+// until `Program::link` binds it to what another module defines under the same name.
+struct Module {
+    string filename;
+    shared_ptr<const string> text;  // the source it was compiled from, its format strings refer to it
+    vector<InstructionP> init_code;  // of its global declarations, which has no jumps
+    vector<InstructionP> code;  // of its functions, jumps in it are absolute as if it started at `base`
+    long long base = 0;
+    vector<JumpInstructionP> jumps;
+    vector<FuncObjectP> funcs;  // defined in it, including main
+    FuncObjectP main;
+    vector<pair<SymbolId, ObjectP>> defined;  // global variables and functions it gives other modules
+    vector<pair<SymbolId, ObjectP>> externs;
+    vector<pair<InstructionP, SymbolId>> imports;  // instructions that refer to an extern, by its name
+    vector<ObjectP> data_image;  // its global variables by their slot within it
+    vector<Pair> errors;
+
+    explicit Module(string filename) : filename(move(filename)) {}
+
+    void compile(shared_ptr<const string> source);  // `source` must be `padded` for the tokenizer
+
+    void move_code(long long to);
+};
+
+// Modules compiled separately and linked into one program. A module is only compiled again when its source
+// changes, so a rebuild costs what was edited and a link.
+class Program {
+    unordered_map<string, unique_ptr<Module>> cache;  // by file name
+    vector<Module *> modules;  // of the last build, in order
+
+    bool link();
+
+public:
+    vector<InstructionP> instructions;
+    vector<string> link_errors;
+    size_t compiled = 0;  // modules compiled by the last `build`
+
+    // reads the sources, compiles those not in the cache and links them all, returns false if that fails
+    bool build(const vector<string> &filenames);
+
+    bool has_errors() const;
+
+    void print_errors(ostream &out) const;  // of each module, with its file name before each error
+
+    vector<ObjectP> globals() const;  // a fresh data segment for each run of `instructions`
+};
+
+#endif //CODE_MODULE_H
@@ -5,13 +5,13 @@
 #ifndef CODE_OBJECT_H
 #define CODE_OBJECT_H
 
-#include "element.h"
+#include "source.h"
 #include "token_code.h"
 #include "type_code.h"
 
 #define CACHE_LINE_SIZE 64
 
-class Identifier;
+struct Identifier;
 
 using IdentP = shared_ptr<Identifier>;
 
@@ -24,6 +24,8 @@ public:
     TypeCode type;
     bool is_const = false;
     bool is_global = false;
+    bool is_extern = false;  // declared by an ExternDecl, defined by another module
+    int slot = -1;  // of a local, index into the frame of its function, of a global variable, into the data segment
     IdentP ident_info;
 
     explicit Object(TypeCode val_type = TypeCode::VOID) : type(val_type) {};
@@ -96,6 +98,17 @@ public:
         return make_shared<ArrayObject>(*this);
     }
 
+    inline ArrayObjectP clone() const {  // unlike `copy`, does not share the elements
+        ArrayObjectP result = make_shared<ArrayObject>(*this);
+        if (data != nullptr) {
+            result->alloc((long long) data->size());
+            for (auto &i: *data) {
+                result->data->push_back(i->copy());
+            }
+        }
+        return result;
+    }
+
     void alloc(long long size = CACHE_LINE_SIZE / sizeof(ObjectP)) {
         data = make_shared<Array>();
         data->reserve(size);
@@ -104,11 +117,9 @@ public:
 
 class StringObject : public Object {
 public:
-    string value;
+    StringRef value;
 
-    explicit StringObject(const char *start, long long length) : Object(TypeCode::CHAR_ARRAY) {
-        value.assign(start, length);
-    }
+    explicit StringObject(StringRef value) : Object(TypeCode::CHAR_ARRAY), value(value) {}
 
     inline ObjectP copy() const override { return make_shared<StringObject>(*this); }
 };
@@ -117,7 +128,9 @@ class FuncObject : public Object {
 public:
     TypeCode return_type;
     vector<ObjectP> params;
-    long long code_offset = 0;
+    long long code_offset = 0;  // -1 until compiled when compiled lazily
+    int slot_cnt = 0;  // frame size, params take the first slots
+    vector<ObjectP> locals;  // by slot, what the slots of a frame hold as declared
 
     explicit FuncObject(TypeCode return_type) : Object(TypeCode::FUNCTION), return_type(return_type) {}
 
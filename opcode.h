@@ -5,10 +5,27 @@
 #ifndef CODE_OPCODE_H
 #define CODE_OPCODE_H
 
+// Superinstructions, each a name and the opcodes it runs in sequence with one dispatch, chosen from the n-grams
+// that `Bench ngrams` mines from a profile of its corpus. Everything else about them is made from this table.
+// Only the last opcode may jump, see `Bytecode::can_fuse`. `StackMachine::run_fused` may be specialized for one.
+#define SUPERINSTRUCTIONS(X) \
+    X(LOAD_LOCAL_FAST_BINARY_STORE, LOAD_LOCAL, LOAD_FAST, BINARY_OP, STORE_LOCAL)  /* i = i + 1 */ \
+    X(LOAD_LOCAL_FAST_BINARY_JUMP_IF_FALSE, LOAD_LOCAL, LOAD_FAST, BINARY_OP, POP_JUMP_IF_FALSE)  /* i < 60 */ \
+    X(LOAD_LOCAL_FAST_BINARY_JUMP_IF_TRUE, LOAD_LOCAL, LOAD_FAST, BINARY_OP, POP_JUMP_IF_TRUE) \
+    X(LOAD_LOCAL_FAST_BINARY, LOAD_LOCAL, LOAD_FAST, BINARY_OP) \
+    X(LOAD_NAME_LOCAL_SUBSCR, LOAD_NAME, LOAD_LOCAL, SUBSCR_ARRAY)  /* a[i] */ \
+    X(LOAD_LOCAL_SUBSCR, LOAD_LOCAL, SUBSCR_ARRAY)  /* [j] of a[i][j] */ \
+    X(LOAD_FAST_BINARY, LOAD_FAST, BINARY_OP) \
+    X(BINARY_STORE_LOCAL, BINARY_OP, STORE_LOCAL) \
+    X(BINARY_JUMP_IF_FALSE, BINARY_OP, POP_JUMP_IF_FALSE) \
+    X(STORE_LOCAL_JUMP, STORE_LOCAL, JUMP_ABSOLUTE)  /* the end of a loop body */
+
 enum OpCode {  // cannot use enum class because of macro string printing
     LOAD_NAME,
     LOAD_FAST,
     STORE_NAME,
+    LOAD_LOCAL,
+    STORE_LOCAL,
     POP_TOP,
     BUILD_ARRAY,
     INIT_ARRAY,
@@ -27,7 +44,12 @@ enum OpCode {  // cannot use enum class because of macro string printing
     UNARY_OP,
 
     BINARY_OP,
-    NOP
+    NOP,
+
+#define SUPERINSTRUCTION_OPCODE(name, ...) name,
+    SUPERINSTRUCTIONS(SUPERINSTRUCTION_OPCODE)
+#undef SUPERINSTRUCTION_OPCODE
+    OPCODE_CNT
 };
 
 enum UnaryOpCode {  // cannot use enum class because of macro string printing
@@ -2,45 +2,330 @@
 // Created by Kevin Tan on 2021/9/24.
 //
 
+#include <functional>
+#include <sstream>
+#include <thread>
 #include "parser.h"
 
-Parser::Parser(vector<TokenP> &tokens, Error &error) : tokens(tokens), error(error) {
-    if (!tokens.empty()) {
+bool Parser::use_arena = true;
+
+Parser::Parser(TokenStream &tokens, Error &error, ostream *trace_out, int threads, CompileMode mode) :
+        arena(use_arena ? new Arena : nullptr), tokens(tokens), error(error), checking(mode == CompileMode::CHECK_ONLY),
+        trace_out(trace_out) {
+    ast.discarding = checking;
+    if (tokens.begin() < tokens.end()) {
         auto tk = tokens.begin();
-        parse_comp_unit(tk);
+        bool out_of_order = trace_out == nullptr && tokens.source == nullptr;  // all tokens are kept and lexed
+        if (out_of_order && checking && threads > 1) {
+            check_comp_unit_parallel(tk, threads);
+        } else if (out_of_order && (mode == CompileMode::LAZY || mode == CompileMode::LAZY_CHECKED)) {
+            parse_comp_unit_lazy(tk, threads, mode == CompileMode::LAZY_CHECKED);
+        } else if (out_of_order && threads > 1) {
+            parse_comp_unit_parallel(tk, threads);  // generates the code too
+        } else {
+            ast.nodes.reserve((size_t) tokens.size() * 2 / 3);  // about as many, for all that is lexed up front
+            parse_comp_unit(tk);
+            tokens.skip_rest();
+            if (!checking) {
+                CodeGenerator(ast, instructions, arena.get()).generate(ast.root);
+            }
+        }
         for (auto &i: arrays) {
             i->dereference_cnt = 0;  // reset dereference_cnt for vm to use
         }
     }
 }
 
+Parser::Parser(TokenStream &tokens, Error &error, HashMap globals) : error(error), tokens(tokens), incremental(true) {
+    sym_table.enter();
+    for (auto &g: globals) {
+        sym_table.declare(g.first, g.second);
+        if (g.second->slot >= 0) {  // new global variables go after these
+            data_image.resize(max(data_image.size(), (size_t) g.second->slot + 1));
+            data_image[g.second->slot] = g.second;
+        }
+    }
+}
+
+Parser::Parser(TokenStream &tokens, Error &error, const SymbolTable &globals, bool checking) :
+        arena(use_arena ? new Arena : nullptr), error(error), tokens(tokens), checking(checking), shares_globals(true),
+        sym_table(globals) {
+    ast.discarding = checking;
+}
+
+ItemKind Parser::parse_item(TokenIter &tk, ItemKind last) {
+    // one item of the CompUnit with `instructions` holding only its code, which starts at offset 0
+    item_func = nullptr;
+    global_decls.clear();
+    identifiers.clear();
+    ast.clear();
+    ItemKind kind;
+    tokens.release(tk);
+    if (last == ItemKind::DECL && starts_with_decl(tk)) {
+        ast.root = parse_decl(tk, 0);
+        kind = ItemKind::DECL;
+    } else if (last <= ItemKind::FUNC && starts_with_func_def(tk)) {
+        ast.root = parse_func_def(tk);
+        kind = ItemKind::FUNC;
+    } else if (last <= ItemKind::FUNC && tk->token_type == TokenCode::INTTK) {
+        ast.root = parse_main_func_def(tk);
+        kind = ItemKind::MAIN;
+    } else {
+        return ItemKind::TAIL;  // where `parse_comp_unit` would stop
+    }
+    for (auto &i: arrays) {
+        i->dereference_cnt = 0;
+    }
+    arrays.clear();
+    CodeGenerator(ast, instructions, arena.get()).generate(ast.root);
+    return kind;
+}
+
 void Parser::parse_comp_unit(TokenIter &tk) {
     // CompUnit -> {Decl} {FuncDef} MainFuncDef
-    sym_table.emplace_back();
+    sym_table.enter();
+    ast.root = ast.add(NodeKind::COMP_UNIT);
+    NodeId last = NO_NODE;
     while (starts_with_decl(tk)) {
-        parse_decl(tk, 0);
+        tokens.release(tk);  // a streaming lexer only needs to keep the tokens of one item at a time
+        ast.append(ast.root, last, parse_decl(tk, 0));
     }
-    instructions.push_back(make_shared<CallFunction>());
-    entry_inst = instructions.back();
-    instructions.push_back(make_shared<Exit>());
     while (starts_with_func_def(tk)) {
-        parse_func_def(tk);
+        tokens.release(tk);
+        ast.append(ast.root, last, parse_func_def(tk));
+    }
+    if (tk->token_type == TokenCode::INTTK) {
+        ast.append(ast.root, last, parse_main_func_def(tk));
+    }
+    trace<CompUnit>();
+}
+
+static void run_in_parallel(int threads, const function<void(int)> &work) {  // `work(0)` on this thread
+    vector<std::thread> workers;
+    for (int i = 1; i < threads; i++) {
+        workers.emplace_back(work, i);
+    }
+    work(0);
+    for (auto &worker: workers) {
+        worker.join();
+    }
+}
+
+void Parser::parse_signatures(TokenIter &tk, vector<FuncJob> &jobs) {
+    // CompUnit -> {Decl} {FuncDef} MainFuncDef
+    // The declarations and the signatures, skipping the bodies. A body only sees the globals and the functions
+    // up to its own, so each can then be parsed and generated on its own by any thread, in any order.
+    sym_table.enter();
+    ast.root = ast.add(NodeKind::COMP_UNIT);
+    NodeId last = NO_NODE;
+    while (starts_with_decl(tk)) {
+        ast.append(ast.root, last, parse_decl(tk, 0));
+    }
+    while (starts_with_func_def(tk)) {
+        FuncObjectP func = parse_func_signature(tk);
+        int param_slots = slot_cnt;
+        sym_table.leave();
+        jobs.push_back({func, tk, sym_table.size(), param_slots, false});
+        tk = skip_block(tk);
+    }
+    if (tk->token_type == TokenCode::INTTK) {
+        FuncObjectP func = parse_main_func_signature(tk);
+        jobs.push_back({func, tk, sym_table.size(), 0, true});
+        tk = skip_block(tk);
+    }
+}
+
+void Parser::parse_comp_unit_parallel(TokenIter &tk, int threads) {
+    vector<FuncJob> jobs;
+    parse_signatures(tk, jobs);
+    vector<vector<InstructionP>> code;
+    threads = parse_jobs_parallel(jobs, threads, &code);
+
+    // linked as `CodeGenerator::generate` lays out a CompUnit
+    CodeGenerator generator(ast, instructions, arena.get());
+    generator.generate(ast.root);
+    if (!jobs.empty() && jobs.back().is_main) {
+        generator.get_entry()->set_func(jobs.back().func);
+    }
+    auto size = (long long) instructions.size();
+    for (auto &job: jobs) {
+        job.func->code_offset = size;
+        size += job.end - job.begin;
     }
-    if ((*tk)->token_type == TokenCode::INTTK) {
-        parse_main_func_def(tk);
+    instructions.resize((size_t) size);
+    atomic<size_t> next(0);
+    run_in_parallel(threads, [&](int) {
+        for (size_t i = next++; i < jobs.size(); i = next++) {
+            FuncJob &job = jobs[i];
+            long long shift = job.func->code_offset - job.begin;
+            for (long long j = job.begin; j < job.end; j++) {
+                InstructionP &inst = code[job.worker][j];
+                if (inst->opcode == JUMP_ABSOLUTE || inst->opcode == POP_JUMP_IF_FALSE ||
+                    inst->opcode == POP_JUMP_IF_TRUE) {
+                    auto jump = static_pointer_cast<JumpInstruction>(inst);
+                    jump->set_offset(jump->get_offset() + shift);
+                }
+                instructions[j + shift] = move(inst);
+            }
+        }
+    });
+}
+
+void Parser::parse_comp_unit_lazy(TokenIter &tk, int threads, bool check) {
+    // only the globals are set up before main is called, each body is compiled by `load`,
+    // main's right away when there is no check, since it is always called and its errors must be found
+    parse_signatures(tk, lazy_jobs);
+    if (check) {
+        parse_jobs_parallel(lazy_jobs, threads, nullptr);
+        lazy_checked = true;
+    }
+    for (size_t i = 0; i < lazy_jobs.size(); i++) {
+        lazy_jobs[i].func->code_offset = -1;
+        lazy_job_index[lazy_jobs[i].func.get()] = i;
+    }
+    CodeGenerator generator(ast, instructions, arena.get());
+    generator.generate(ast.root);
+    if (!lazy_jobs.empty() && lazy_jobs.back().is_main) {
+        generator.get_entry()->set_func(lazy_jobs.back().func);
+        if (!check) {
+            load(lazy_jobs.back().func);
+        }
     }
-    elements.push_back(make_shared<CompUnit>());
 }
 
-void Parser::parse_decl(TokenIter &tk, int nest_level) {
-    // Decl -> ConstDecl | VarDecl
-    switch ((*tk)->token_type) {
+void Parser::check_comp_unit_parallel(TokenIter &tk, int threads) {
+    vector<FuncJob> jobs;
+    parse_signatures(tk, jobs);
+    parse_jobs_parallel(jobs, threads, nullptr);
+}
+
+bool Parser::load(const FuncObjectP &func) {
+    // compiles the body of `func` at the end of `instructions`, where its jumps are absolute as they are made
+    auto found = lazy_job_index.find(func.get());
+    if (found == lazy_job_index.end()) {
+        return false;
+    }
+    auto error_cnt = error.errors.size();
+    ostringstream reported;
+    if (lazy_checked) {
+        message_out = &reported;  // already by the check
+    }
+    parse_func_job(lazy_jobs[found->second]);
+    message_out = &cerr;
+    CodeGenerator(ast, instructions, arena.get()).generate(ast.root);
+    lazy_job_index.erase(found);
+    return error.errors.size() == error_cnt;
+}
+
+int Parser::parse_jobs_parallel(vector<FuncJob> &jobs, int threads, vector<vector<InstructionP>> *code) {
+    // by workers on up to `threads` threads, each generating into its own vector of `code` if set,
+    // the errors and messages go where they would have serially, returns the threads used
+    threads = (int) min((size_t) threads, max(jobs.size(), (size_t) 1));
+    vector<Error> errors((size_t) threads);
+    if (code != nullptr) {
+        code->resize((size_t) threads);
+        worker_arenas.resize((size_t) threads);
+    }
+    atomic<size_t> next(0);
+    run_in_parallel(threads, [&](int i) {
+        Parser worker(tokens, errors[i], sym_table, code == nullptr);
+        worker.parse_func_bodies(jobs, next, i, code != nullptr);
+        if (code != nullptr) {
+            (*code)[i].swap(worker.instructions);
+            worker_arenas[i] = move(worker.arena);  // with the code made in it
+        }
+    });
+    for (auto &e: errors) {  // ordered by line as they are added
+        for (; !e.errors.empty(); e.errors.pop()) {
+            error.errors.push(e.errors.top());
+        }
+    }
+    for (auto &job: jobs) {
+        cerr << job.messages;
+        job.messages.clear();
+    }
+    return threads;
+}
+
+void Parser::parse_func_bodies(vector<FuncJob> &jobs, atomic<size_t> &next, int worker, bool generate) {
+    // parses the jobs it takes from `next` on until none is left, generating them into `instructions` if `generate`
+    CodeGenerator generator(ast, instructions, arena.get());
+    ostringstream messages;
+    message_out = &messages;
+    for (size_t i = next++; i < jobs.size(); i = next++) {
+        FuncJob &job = jobs[i];
+        parse_func_job(job);
+        if (generate) {
+            job.worker = worker;
+            job.begin = (long long) instructions.size();
+            generator.generate(ast.root);
+            job.end = (long long) instructions.size();
+        }
+        if (messages.tellp() > 0) {
+            job.messages = messages.str();
+            messages.str("");
+        }
+    }
+}
+
+NodeId Parser::parse_func_job(const FuncJob &job) {
+    // into `ast`, only the global scope is open
+    TokenIter tk = job.body;
+    sym_table.hide(job.scope_end, sym_table.size());
+    ast.clear();
+    if (!job.is_main) {
+        sym_table.enter();
+        for (auto &param: job.func->params) {
+            if (param->ident_info != nullptr) {
+                sym_table.declare(param->ident_info->symbol, param);
+            }
+        }
+    }
+    slot_cnt = job.param_slots;
+    locals.clear();
+    for (auto &param: job.func->params) {
+        if (param->slot >= 0) {
+            locals.push_back(param);
+        }
+    }
+    ast.root = parse_func_body(tk, job.func, job.is_main);
+    for (auto &a: arrays) {
+        a->dereference_cnt = 0;
+    }
+    arrays.clear();
+    return ast.root;
+}
+
+TokenIter Parser::skip_block(TokenIter tk) {
+    // past the Block at `tk` by its braces, which match wherever it parses without a fatal error,
+    // all tokens must have been lexed
+    if (tk->token_type != TokenCode::LBRACE) {
+        ERROR_EXPECTED_GOT(LBRACE, tk);
+    }
+    long long i = tk.position(), depth = 0;
+    for (long long size = tokens.size(); i < size; i++) {
+        TokenCode type = tokens[i].token_type;
+        if (type == TokenCode::LBRACE) {
+            depth++;
+        } else if (type == TokenCode::RBRACE && --depth == 0) {
+            return {&tokens, i + 1};
+        }
+    }
+    return {&tokens, i};
+}
+
+NodeId Parser::parse_decl(TokenIter &tk, int nest_level) {
+    // Decl -> ConstDecl | VarDecl | ExternDecl
+    if (starts_with_extern(tk)) {
+        parse_extern_decl(tk, nest_level);
+        return ast.add(NodeKind::DECL);  // defined by another module
+    }
+    switch (tk->token_type) {
         case TokenCode::CONSTTK:
             parse_const_decl(tk, nest_level);
-            break;
+            return ast.add(NodeKind::DECL);  // constants are used in place
         case TokenCode::INTTK:
-            parse_var_decl(tk, nest_level);
-            break;
+            return parse_var_decl(tk, nest_level);
         default:
             ERROR_EXPECTED_GOT(CONSTTK or INTTK, tk);
     }
@@ -48,74 +333,133 @@ void Parser::parse_decl(TokenIter &tk, int nest_level) {
 
 void Parser::parse_const_decl(TokenIter &tk, int nest_level) {
     // ConstDecl -> 'const' BType ConstDef { ',' ConstDef } ';'
-    if ((*tk)->token_type == TokenCode::CONSTTK) {
-        elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::CONSTTK) {
+        consume(tk);
     } else {
         ERROR_EXPECTED_GOT(CONSTTK, tk);
     }
-    if ((*tk)->token_type == TokenCode::INTTK) {
-        elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::INTTK) {
+        consume(tk);
     } else {
         ERROR_EXPECTED_GOT(INTTK, tk);
     }
     while (tk < tokens.end()) {
         parse_const_def(tk, nest_level);
-        if ((*tk)->token_type == TokenCode::COMMA) {
-            elements.push_back(*tk++);
-        } else if ((*tk)->token_type == TokenCode::SEMICN) {
-            elements.push_back(*tk++);
+        if (tk->token_type == TokenCode::COMMA) {
+            consume(tk);
+        } else if (tk->token_type == TokenCode::SEMICN) {
+            consume(tk);
             break;
         } else {
-            error(ErrorCode::MISSING_SEMICN, (*(tk - 1))->line);
+            error(ErrorCode::MISSING_SEMICN, (tk - 1)->line);
             break;
         }
     }
-    elements.push_back(make_shared<ConstDecl>());
+    trace<ConstDecl>();
 }
 
 ObjectP Parser::check_ident_valid_decl(TokenIter &tk, TypeCode type,
-                                       bool is_global = false, bool is_const = false, bool is_func = false) {
+                                       bool is_global = false, bool is_const = false, bool is_func = false,
+                                       bool is_extern = false) {
     ObjectP result;
     switch (type) {
         case TypeCode::VOID:
             assert(is_func);
-            result = make_shared<FuncObject>(TypeCode::VOID);
+            result = make<FuncObject>(TypeCode::VOID);
             break;
         case TypeCode::INT:
             if (is_func) {
-                result = make_shared<FuncObject>(TypeCode::INT);
+                result = make<FuncObject>(TypeCode::INT);
             } else {
-                result = make_shared<IntObject>();
+                result = make<IntObject>();
             }
             break;
         case TypeCode::INT_ARRAY: {
             assert(!is_func);
-            result = make_shared<ArrayObject>();
+            result = make<ArrayObject>();
             break;
         }
         default:
             ERROR_EXPECTED_GOT(type VOID or INT or INT_ARRAY, tk - 1);
     }
-    IdentP current = cast<Identifier>(*tk);
-    auto &last_table = sym_table.back();
-    if (last_table.find(current->name) == last_table.end()) {
+    SymbolId name = tokens.symbol(*tk);
+    if (!sym_table.declared_here(name)) {
         result->is_const = is_const;
         result->is_global = is_global;
-        result->ident_info = current;
-        last_table[current->name] = result;
+        result->is_extern = is_extern;
+        if (!is_global) {
+            result->slot = slot_cnt++;
+            locals.push_back(result);
+        } else if (!is_func && !is_const && !is_extern && !checking) {  // constants are used in place
+            result->slot = (int) data_image.size();
+            data_image.push_back(result);
+        }
+        result->ident_info = make<Identifier>(tk->line, name);
+        sym_table.declare(name, result);
+        if (incremental) {
+            identifiers.push_back(result->ident_info);
+            if (sym_table.depth() == 1) {
+                global_decls.emplace_back(name, result);
+            }
+        }
     } else {
-        error(ErrorCode::IDENT_REDEFINED, current->line);
+        error(ErrorCode::IDENT_REDEFINED, tk->line);
     }
-    elements.push_back(*tk++);
+    consume(tk);
     return result;
 }
 
+void Parser::parse_extern_decl(TokenIter &tk, int nest_level) {
+    // ExternDecl -> 'extern' BType Ident { '[' ConstExp ']' } ';' | 'extern' FuncType Ident '(' [FuncFParams] ')' ';'
+    // what another module defines, it gets no slot and its uses are bound to the definition by `Program::link`
+    if (nest_level != 0) {
+        ERROR_NOT_SUPPORTED(extern declarations outside the global scope of a module);
+    }
+    consume(tk);
+    if (tk->token_type == TokenCode::VOIDTK ||
+        (tk->token_type == TokenCode::INTTK && (tk + 2)->token_type == TokenCode::LPARENT)) {
+        FuncObjectP func = parse_func_signature(tk);
+        func->is_extern = true;
+        sym_table.leave();
+        item_func = nullptr;
+    } else {
+        if (tk->token_type == TokenCode::INTTK) {
+            consume(tk);
+        } else {
+            ERROR_EXPECTED_GOT(INTTK, tk);
+        }
+        ArrayObjectP array;
+        if (tk->token_type == TokenCode::IDENFR) {
+            bool is_array = has_type(tk + 1, TokenCode::LBRACK);
+            ObjectP current = check_ident_valid_decl(tk, is_array ? TypeCode::INT_ARRAY : TypeCode::INT,
+                                                     true, false, false, true);
+            array = cast<ArrayObject>(current);
+        } else {
+            ERROR_EXPECTED_GOT(IDENFR, tk);
+        }
+        while (has_type(tk, TokenCode::LBRACK)) {
+            consume(tk);
+            array->dims.push_back(cast<IntObject>(parse_expr<ConstExpr>(tk, NO_EMIT_IN_CONST_DEF))->value);
+            if (tk->token_type == TokenCode::RBRACK) {
+                consume(tk);
+            } else {
+                error(ErrorCode::MISSING_RBRACK, (tk - 1)->line);
+            }
+        }
+    }
+    if (tk->token_type == TokenCode::SEMICN) {
+        consume(tk);
+    } else {
+        error(ErrorCode::MISSING_SEMICN, (tk - 1)->line);
+    }
+}
+
 void Parser::parse_const_def(TokenIter &tk, int nest_level) {
     // ConstDef -> Ident { '[' ConstExp ']' } '=' ConstInitVal
     ObjectP current;
     ArrayObjectP array;
     bool is_array;
-    if ((*tk)->token_type == TokenCode::IDENFR) {
+    if (tk->token_type == TokenCode::IDENFR) {
         is_array = has_type(tk + 1, TokenCode::LBRACK);
         if (is_array) {
             current = check_ident_valid_decl(tk, TypeCode::INT_ARRAY, nest_level == 0, true);
@@ -127,16 +471,16 @@ void Parser::parse_const_def(TokenIter &tk, int nest_level) {
         ERROR_EXPECTED_GOT(IDENFR, tk);
     }
     while (has_type(tk, TokenCode::LBRACK)) {
-        elements.push_back(*tk++);
+        consume(tk);
         array->dims.push_back(cast<IntObject>(parse_expr<ConstExpr>(tk, NO_EMIT_IN_CONST_DEF))->value);
-        if ((*tk)->token_type == TokenCode::RBRACK) {
-            elements.push_back(*tk++);
+        if (tk->token_type == TokenCode::RBRACK) {
+            consume(tk);
         } else {
-            error(ErrorCode::MISSING_RBRACK, (*(tk - 1))->line);
+            error(ErrorCode::MISSING_RBRACK, (tk - 1)->line);
         }
     }
-    if ((*tk)->token_type == TokenCode::ASSIGN) {
-        elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::ASSIGN) {
+        consume(tk);
         ObjectP init_val = parse_init_val<ConstExpr, ConstInitVal>(tk, NO_EMIT_IN_CONST_DEF);
         if (is_array) {
             array->data = cast<ArrayObject>(init_val)->data;
@@ -148,37 +492,39 @@ void Parser::parse_const_def(TokenIter &tk, int nest_level) {
     } else {
         ERROR_EXPECTED_GOT(ASSIGN, tk);
     }
-    elements.push_back(make_shared<ConstDef>());
+    trace<ConstDef>();
 }
 
-void Parser::parse_var_decl(TokenIter &tk, int nest_level) {
+NodeId Parser::parse_var_decl(TokenIter &tk, int nest_level) {
     // VarDecl -> BType VarDef { ',' VarDef } ';'
-    if ((*tk)->token_type == TokenCode::INTTK) {
-        elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::INTTK) {
+        consume(tk);
     } else {
         ERROR_EXPECTED_GOT(INTTK, tk);
     }
+    NodeId result = ast.add(NodeKind::DECL), last = NO_NODE;
     while (tk < tokens.end()) {
-        parse_var_def(tk, nest_level);
-        if ((*tk)->token_type == TokenCode::COMMA) {
-            elements.push_back(*tk++);
-        } else if ((*tk)->token_type == TokenCode::SEMICN) {
-            elements.push_back(*tk++);
+        ast.append(result, last, parse_var_def(tk, nest_level));
+        if (tk->token_type == TokenCode::COMMA) {
+            consume(tk);
+        } else if (tk->token_type == TokenCode::SEMICN) {
+            consume(tk);
             break;
         } else {
-            error(ErrorCode::MISSING_SEMICN, (*(tk - 1))->line);
+            error(ErrorCode::MISSING_SEMICN, (tk - 1)->line);
             break;
         }
     }
-    elements.push_back(make_shared<VarDecl>());
+    trace<VarDecl>();
+    return result;
 }
 
-void Parser::parse_var_def(TokenIter &tk, int nest_level) {
+NodeId Parser::parse_var_def(TokenIter &tk, int nest_level) {
     // VarDef -> Ident { '[' ConstExp ']' } | Ident { '[' ConstExp ']' } '=' InitVal
     ObjectP current;
     ArrayObjectP array;
     bool is_array;
-    if ((*tk)->token_type == TokenCode::IDENFR) {
+    if (tk->token_type == TokenCode::IDENFR) {
         is_array = has_type(tk + 1, TokenCode::LBRACK);
         if (is_array) {
             current = check_ident_valid_decl(tk, TypeCode::INT_ARRAY, nest_level == 0);
@@ -189,33 +535,250 @@ void Parser::parse_var_def(TokenIter &tk, int nest_level) {
     } else {
         ERROR_EXPECTED_GOT(IDENFR, tk);
     }
+    NodeId result = ast.add(NodeKind::VAR_DEF, current->type, 0, current);
+    // a global with constant sizes and initializer starts in the data image and has no code to run
+    bool in_image = current->is_global && !checking;
+    vector<ObjectP> values;
     while (has_type(tk, TokenCode::LBRACK)) {
-        elements.push_back(*tk++);
+        consume(tk);
         array->dims.push_back(cast<IntObject>(parse_expr<ConstExpr>(tk, EMIT_IN_VAR_DEF))->value);
-        if ((*tk)->token_type == TokenCode::RBRACK) {
-            elements.push_back(*tk++);
-            if (array->dims.size() > 1) {
-                instructions.push_back(make_shared<BinaryOperation>(BinaryOpCode::BINARY_MUL));
-            }
+        if (tk->token_type == TokenCode::RBRACK) {
+            consume(tk);
         } else {
-            error(ErrorCode::MISSING_RBRACK, (*(tk - 1))->line);
+            error(ErrorCode::MISSING_RBRACK, (tk - 1)->line);
+        }
+        if (array->dims.size() > 1) {
+            reduce(NodeKind::BINARY, 2, TypeCode::INT, BinaryOpCode::BINARY_MUL);
         }
     }
     if (is_array) {
-        instructions.push_back(make_shared<BuildArray>());
-        instructions.push_back(make_shared<StoreName>(array));
+        NodeId size = pop_operand();
+        if (in_image && fold_code(size, values) && values.size() == 1 && cast<IntObject>(values[0])->value >= 0) {
+            auto n = cast<IntObject>(values[0])->value;
+            array->alloc(n);
+            for (long long i = 0; i < n; i++) {
+                array->data->push_back(make<IntObject>());  // zeroed for safety
+            }
+        } else {
+            in_image = false;
+            ast.adopt(result, size);
+        }
     }
-    if ((*tk)->token_type == TokenCode::ASSIGN) {
-        elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::ASSIGN) {
+        consume(tk);
+        auto begin = operands.size();
         parse_init_val<NormalExpr, InitVal>(tk, EMIT_IN_NORM_STMT);
-        if (is_array) {
-            instructions.push_back(make_shared<InitArray>(array));
-            // array is flattened for convenience,
-            // and need to be considered well when passed to functions
+        NodeId init_val = take_operands(NodeKind::INIT_VAL, operands.size() - begin, current->type);
+        values.clear();
+        if (in_image && fold_code(ast[init_val].first, values) && (is_array || values.size() == 1)) {
+            if (is_array) {
+                array->data = make<Array>(values);  // as `INIT_ARRAY` would
+            } else {
+                cast<IntObject>(current)->value = cast<IntObject>(values.back())->value;
+            }
+        } else {
+            ast.adopt(result, init_val);
+        }
+    }
+    trace<VarDef>();
+    return result;
+}
+
+bool Parser::fold_code(NodeId first, vector<ObjectP> &values) {
+    // evaluates the expressions from `first` on along its siblings if they only compute on constants,
+    // leaving their values in `values`
+    vector<NodeId> order, pending;
+    for (NodeId e = first; e != NO_NODE; e = ast[e].next) {
+        ast.postorder(e, order, pending);
+    }
+    for (NodeId i: order) {
+        auto &n = ast[i];
+        switch (n.kind) {
+            case NodeKind::CONSTANT:
+            case NodeKind::NAME: {
+                ObjectP o = n.object;
+                if (!o->is_const) {
+                    return false;
+                } else if (o->type == TypeCode::INT) {
+                    values.push_back(o);
+                } else if (o->type == TypeCode::INT_ARRAY && cast<ArrayObject>(o)->data != nullptr) {
+                    ArrayObjectP array = make<ArrayObject>(*cast<ArrayObject>(o));
+                    array->dereference_cnt = 0;  // as the vm sees it, the parser may still be subscripting it
+                    values.push_back(array);
+                } else {
+                    return false;
+                }
+                break;
+            }
+            case NodeKind::SUBSCRIPT: {
+                if (values.size() < 2 || values.back()->type != TypeCode::INT ||
+                    values[values.size() - 2]->type != TypeCode::INT_ARRAY) {
+                    return false;
+                }
+                long long index = cast<IntObject>(values.back())->value;
+                values.pop_back();
+                ArrayObjectP array = cast<ArrayObject>(values.back());
+                values.pop_back();
+                if ((size_t) array->dereference_cnt >= array->dims.size()) {
+                    return false;
+                }
+                long long stride = 1;
+                for (auto d = array->dims.begin() + array->dereference_cnt + 1; d < array->dims.end(); ++d) {
+                    stride *= *d;
+                }
+                if (index < 0 || index >= array->dims[array->dereference_cnt] ||
+                    array->base + (index + 1) * stride > (long long) array->data->size()) {
+                    return false;  // left for the vm to go out of bounds
+                }
+                values.push_back((*array)[index]);
+                break;
+            }
+            case NodeKind::UNARY: {
+                if (values.empty() || values.back()->type != TypeCode::INT) {
+                    return false;
+                }
+                auto value = cast<IntObject>(values.back())->value;
+                values.back() = make<IntObject>(util::unary_operation((UnaryOpCode) n.op, value));
+                break;
+            }
+            case NodeKind::BINARY: {
+                if (values.size() < 2 || values.back()->type != TypeCode::INT ||
+                    values[values.size() - 2]->type != TypeCode::INT) {
+                    return false;
+                }
+                auto op = (BinaryOpCode) n.op;
+                auto right = cast<IntObject>(values.back())->value;
+                values.pop_back();
+                auto left = cast<IntObject>(values.back())->value;
+                if ((op == BinaryOpCode::BINARY_DIV || op == BinaryOpCode::BINARY_MOD) && right == 0) {
+                    return false;  // fails when run, as it did
+                }
+                values.back() = make<IntObject>(util::binary_operation(op, left, right));
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    for (auto &v: values) {
+        if (v->type != TypeCode::INT) {
+            return false;
+        }
+        v = v->copy();  // must be copied
+    }
+    return true;
+}
+
+NodeId Parser::add_constant(int value) {
+    IntObjectP object = make<IntObject>(value);
+    object->is_const = true;
+    return ast.add(NodeKind::CONSTANT, TypeCode::INT, 0, object);
+}
+
+NodeId Parser::fold(NodeId node) {
+    // what replaces `node`, whose operands are folded already: the value if they are constants,
+    // or a simpler node if it changes nothing or has constants to combine, as the vm would compute it
+    if (node == NO_NODE || ast[node].first == NO_NODE) {
+        return node;
+    }
+    NodeKind kind = ast[node].kind;
+    int op = ast[node].op;
+    NodeId left = ast[node].first, right = ast[left].next;
+    int a, b;
+    bool left_constant = ast.constant(left, a);
+    bool right_constant = right != NO_NODE && ast.constant(right, b);
+    switch (kind) {
+        case NodeKind::UNARY:
+            if (left_constant) {
+                return add_constant(util::unary_operation((UnaryOpCode) op, a));
+            } else if (op == UnaryOpCode::UNARY_POSITIVE) {
+                return left;
+            }
+            return node;
+        case NodeKind::BINARY: {
+            bool additive = op == BinaryOpCode::BINARY_ADD || op == BinaryOpCode::BINARY_SUB;
+            if (left_constant && right_constant) {
+                if ((op != BinaryOpCode::BINARY_DIV && op != BinaryOpCode::BINARY_MOD) ||
+                    (b != 0 && (a != INT_MIN || b != -1))) {  // which fails when run
+                    return add_constant(util::binary_operation((BinaryOpCode) op, a, b));
+                }
+                return node;
+            }
+            if (left_constant && (op == BinaryOpCode::BINARY_ADD || op == BinaryOpCode::BINARY_MUL)) {
+                ast[node].first = right;  // the constant goes right, it has no effect to keep in order
+                ast[right].next = left;
+                ast[left].next = NO_NODE;
+                swap(left, right);
+                b = a;
+            } else if (!right_constant) {
+                return node;
+            }
+            if ((additive && b == 0) || ((op == BinaryOpCode::BINARY_MUL || op == BinaryOpCode::BINARY_DIV) && b == 1)) {
+                return detach(left);
+            }
+            int c;  // (x op' c) op b -> x op'' (c op b)
+            NodeId x = ast[left].first;
+            if (ast[left].kind != NodeKind::BINARY || !ast.constant(ast[x].next, c)) {
+                return node;
+            }
+            int inner = ast[left].op;
+            unsigned combined;  // wraps around as the vm does
+            if (additive && (inner == BinaryOpCode::BINARY_ADD || inner == BinaryOpCode::BINARY_SUB)) {
+                combined = (inner == BinaryOpCode::BINARY_ADD ? (unsigned) c : 0u - (unsigned) c) +
+                           (op == BinaryOpCode::BINARY_ADD ? (unsigned) b : 0u - (unsigned) b);
+                op = BinaryOpCode::BINARY_ADD;
+            } else if (op == BinaryOpCode::BINARY_MUL && inner == BinaryOpCode::BINARY_MUL) {
+                combined = (unsigned) c * (unsigned) b;
+            } else {
+                return node;
+            }
+            NodeId children[2] = {detach(x), add_constant((int) combined)};
+            NodeId result = ast.add(NodeKind::BINARY, TypeCode::INT, op);
+            ast.adopt(result, children, children + 2);
+            return fold(result);
+        }
+        case NodeKind::LOGICAL: {  // only in a Cond, where its operands are only tested
+            bool is_and = op == BinaryOpCode::BINARY_LOGICAL_AND;
+            if (left_constant) {  // decides, or leaves it to the other
+                return (a != 0) != is_and ? add_constant(!is_and) : right;
+            } else if (right_constant && (b != 0) == is_and) {
+                return detach(left);
+            }
+            return node;
         }
-        instructions.push_back(make_shared<StoreName>(current));
+        case NodeKind::SUBSCRIPT:
+            return right_constant ? fold_subscript(node) : node;
+        default:
+            return node;
     }
-    elements.push_back(make_shared<VarDef>());
+}
+
+NodeId Parser::fold_subscript(NodeId node) {
+    // the element of a constant array that `node` reads if all the indexes are constants in bounds
+    NodeId base = node;
+    size_t depth = 0;
+    for (; ast[base].kind == NodeKind::SUBSCRIPT; base = ast[base].first) {
+        depth++;
+    }
+    ArrayObjectP array = cast<ArrayObject>(ast[base].object);
+    if (ast[base].kind != NodeKind::NAME || array == nullptr || !array->is_const || array->data == nullptr ||
+        depth != array->dims.size()) {
+        return node;
+    }
+    long long index = 0, stride = 1;
+    for (NodeId s = node; s != base; s = ast[s].first) {  // from the last index
+        int i;
+        depth--;
+        if (!ast.constant(ast[ast[s].first].next, i) || i < 0 || i >= array->dims[depth]) {
+            return node;  // left for the vm to go out of bounds
+        }
+        index += i * stride;
+        stride *= array->dims[depth];
+    }
+    if (index >= (long long) array->data->size() || (*array->data)[index]->type != TypeCode::INT) {
+        return node;
+    }
+    return add_constant(cast<IntObject>((*array->data)[index])->value);
 }
 
 template<typename ExprT, typename ElementT>
@@ -223,10 +786,10 @@ ObjectP Parser::parse_init_val(TokenIter &tk, EmitMode emit_mode) {
     // InitVal -> Exp | '{' [ InitVal { ',' InitVal } ] '}'
     // ConstInitVal -> ConstExp | '{' [ ConstInitVal { ',' ConstInitVal } ] '}'
     ObjectP result;
-    if ((*tk)->token_type == TokenCode::LBRACE) {
-        elements.push_back(*tk++);
-        ArrayObjectP array = make_shared<ArrayObject>(true);
-        if ((*tk)->token_type != TokenCode::RBRACE) {
+    if (tk->token_type == TokenCode::LBRACE) {
+        consume(tk);
+        ArrayObjectP array = make<ArrayObject>(true);
+        if (tk->token_type != TokenCode::RBRACE) {
             while (tk < tokens.end()) {
                 ObjectP o = parse_init_val<ExprT, ElementT>(tk, emit_mode);
                 if (emit_mode == NO_EMIT_IN_CONST_DEF && o->type == TypeCode::INT_ARRAY) {
@@ -236,107 +799,138 @@ ObjectP Parser::parse_init_val(TokenIter &tk, EmitMode emit_mode) {
                 } else {
                     array->data->push_back(o);
                 }
-                if ((*tk)->token_type == TokenCode::COMMA) {
-                    elements.push_back(*tk++);
+                if (tk->token_type == TokenCode::COMMA) {
+                    consume(tk);
                 } else {
                     break;
                 }
             }
         }
         result = array;
-        if ((*tk)->token_type == TokenCode::RBRACE) {
-            elements.push_back(*tk++);
+        if (tk->token_type == TokenCode::RBRACE) {
+            consume(tk);
         } else {
             ERROR_EXPECTED_GOT(COMMA or RBRACE, tk);
         }
     } else {
         result = parse_expr<ExprT>(tk, emit_mode)->copy();  // must be copied
     }
-    elements.push_back(make_shared<ElementT>());
+    trace<ElementT>();
     return result;
 }
 
-void Parser::parse_func_def(TokenIter &tk) {
+NodeId Parser::parse_func_def(TokenIter &tk) {
     // FuncDef -> FuncType Ident '(' [FuncFParams] ')' Block
+    NodeId result = parse_func_body(tk, parse_func_signature(tk), false);
+    trace<FuncDef>();
+    return result;
+}
+
+FuncObjectP Parser::parse_func_signature(TokenIter &tk) {
+    // up to the Block, leaving the scope of the parameters open
     current_func_return_type = parse_func_type(tk);
     FuncObjectP current;
-    if ((*tk)->token_type == TokenCode::IDENFR) {
+    if (tk->token_type == TokenCode::IDENFR) {
         current = cast<FuncObject>(check_ident_valid_decl(tk, current_func_return_type, true, false, true));
-        current->code_offset = (long long) instructions.size();
+        item_func = current;
     } else {
         ERROR_EXPECTED_GOT(IDENFR, tk);
     }
-    if ((*tk)->token_type == TokenCode::LPARENT) {
-        elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::LPARENT) {
+        consume(tk);
     } else {
         ERROR_EXPECTED_GOT(LPARENT, tk);
     }
-    sym_table.emplace_back();
-    if ((*tk)->token_type == TokenCode::INTTK) {  // pre-fetch
+    sym_table.enter();
+    slot_cnt = 0;
+    locals.clear();
+    if (tk->token_type == TokenCode::INTTK) {  // pre-fetch
         parse_func_formal_params(tk, current);
     }
-    if ((*tk)->token_type == TokenCode::RPARENT) {
-        elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::RPARENT) {
+        consume(tk);
     } else {
-        error(ErrorCode::MISSING_RPAREN, (*(tk - 1))->line);
+        error(ErrorCode::MISSING_RPAREN, (tk - 1)->line);
     }
-    parse_block(tk, 1, true);
-    if (!has_return_at_end) {
-        if (current_func_return_type == TypeCode::VOID) {
-            instructions.push_back(make_shared<ReturnValue>());
-        } else {
-            error(ErrorCode::MISSING_RETURN, (*(tk - 1))->line);
-        }
-    }
-    has_return_at_end = false;
-    elements.push_back(make_shared<FuncDef>());
+    return current;
 }
 
-void Parser::parse_main_func_def(TokenIter &tk) {
+NodeId Parser::parse_main_func_def(TokenIter &tk) {
     // MainFuncDef -> 'int' 'main' '(' ')' Block
-    if ((*tk)->token_type == TokenCode::INTTK) {
-        current_func_return_type = TypeCode::INT;
-        elements.push_back(*tk++);
+    FuncObjectP main = parse_main_func_signature(tk);
+    slot_cnt = 0;
+    locals.clear();
+    NodeId result = parse_func_body(tk, main, true);
+    trace<MainFuncDef>();
+    return result;
+}
+
+FuncObjectP Parser::parse_main_func_signature(TokenIter &tk) {
+    if (tk->token_type == TokenCode::INTTK) {
+        consume(tk);
     } else {
         ERROR_EXPECTED_GOT(INTTK, tk);
     }
-    if ((*tk)->token_type == TokenCode::MAINTK) {
-        FuncObjectP main = cast<FuncObject>(*tk);
-        main->code_offset = (long long) instructions.size();
-        cast<CallFunction>(entry_inst)->set_func(main);
-        elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::MAINTK) {
+        FuncObjectP main = make<FuncObject>(TypeCode::INT);
+        main->ident_info = make<Identifier>(tk->line, SymbolPool::global().intern("main"));
+        item_func = main;
+        if (incremental) {
+            identifiers.push_back(main->ident_info);
+        }
+        consume(tk);
     } else {
         ERROR_EXPECTED_GOT(MAINTK, tk);
     }
-    if ((*tk)->token_type == TokenCode::LPARENT) {
-        elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::LPARENT) {
+        consume(tk);
     } else {
         ERROR_EXPECTED_GOT(LPARENT, tk);
     }
-    if ((*tk)->token_type == TokenCode::RPARENT) {
-        elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::RPARENT) {
+        consume(tk);
     } else {
-        error(ErrorCode::MISSING_RPAREN, (*(tk - 1))->line);
+        error(ErrorCode::MISSING_RPAREN, (tk - 1)->line);
     }
-    parse_block(tk, 1);
+    return item_func;
+}
+
+NodeId Parser::parse_func_body(TokenIter &tk, const FuncObjectP &func, bool is_main) {
+    // the Block of a FuncDef, in the scope of its parameters, or of the MainFuncDef
+    current_func_return_type = func->return_type;
+    NodeId body = parse_block(tk, 1, !is_main);
+    func->slot_cnt = slot_cnt;
+    if (!checking) {  // a checking worker's objects go with its arena, and nothing it parsed is run
+        func->locals.swap(locals);
+    }
+    locals.clear();
+    bool add_return = false;
     if (!has_return_at_end) {
-        error(ErrorCode::MISSING_RETURN, (*(tk - 1))->line);
+        if (func->return_type == TypeCode::VOID) {
+            add_return = true;
+        } else {
+            error(ErrorCode::MISSING_RETURN, (tk - 1)->line);
+        }
     }
-    elements.push_back(make_shared<MainFuncDef>());
+    has_return_at_end = false;
+    NodeId result = ast.add(is_main ? NodeKind::MAIN_FUNC_DEF : NodeKind::FUNC_DEF, TypeCode::FUNCTION, add_return,
+                            func);
+    ast.adopt(result, body);
+    return result;
 }
 
 TypeCode Parser::parse_func_type(TokenIter &tk) {
     // FuncType -> 'void' | 'int'
     TypeCode result;
-    if ((*tk)->token_type == TokenCode::INTTK) {
+    if (tk->token_type == TokenCode::INTTK) {
         result = TypeCode::INT;
-    } else if ((*tk)->token_type == TokenCode::VOIDTK) {
+    } else if (tk->token_type == TokenCode::VOIDTK) {
         result = TypeCode::VOID;
     } else {
         ERROR_EXPECTED_GOT(INTTK or VOIDTK, tk);
     }
-    elements.push_back(*tk++);
-    elements.push_back(make_shared<FuncType>());
+    consume(tk);
+    trace<FuncType>();
     return result;
 }
 
@@ -344,25 +938,25 @@ void Parser::parse_func_formal_params(TokenIter &tk, FuncObjectP &func) {
     // FuncFParams -> FuncFParam { ',' FuncFParam }
     while (tk < tokens.end()) {
         parse_func_formal_param(tk, func);
-        if ((*tk)->token_type == TokenCode::COMMA) {
-            elements.push_back(*tk++);
+        if (tk->token_type == TokenCode::COMMA) {
+            consume(tk);
         } else {
             break;
         }
     }
-    elements.push_back(make_shared<FuncFormalParams>());
+    trace<FuncFormalParams>();
 }
 
 void Parser::parse_func_formal_param(TokenIter &tk, FuncObjectP &func) {
     // FuncFParam -> BType Ident ['[' ']' { '[' ConstExp ']' }]
-    if ((*tk)->token_type == TokenCode::INTTK) {
-        elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::INTTK) {
+        consume(tk);
     } else {
         ERROR_EXPECTED_GOT(INTTK, tk);
     }
     ObjectP current;
     ArrayObjectP array;
-    if ((*tk)->token_type == TokenCode::IDENFR) {
+    if (tk->token_type == TokenCode::IDENFR) {
         if (has_type(tk + 1, TokenCode::LBRACK)) {
             current = check_ident_valid_decl(tk, TypeCode::INT_ARRAY);
             array = cast<ArrayObject>(current);
@@ -372,62 +966,65 @@ void Parser::parse_func_formal_param(TokenIter &tk, FuncObjectP &func) {
     } else {
         ERROR_EXPECTED_GOT(IDENFR, tk);
     }
-    if ((*tk)->token_type == TokenCode::LBRACK) {
-        elements.push_back(*tk++);
-        if ((*tk)->token_type == TokenCode::RBRACK) {
-            elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::LBRACK) {
+        consume(tk);
+        if (tk->token_type == TokenCode::RBRACK) {
+            consume(tk);
             array->dims.push_back(0);  // dummy dimension for int a[]
         } else {
-            error(ErrorCode::MISSING_RBRACK, (*(tk - 1))->line);
+            error(ErrorCode::MISSING_RBRACK, (tk - 1)->line);
         }
         while (has_type(tk, TokenCode::LBRACK)) {
-            elements.push_back(*tk++);
+            consume(tk);
             array->dims.push_back(cast<IntObject>(parse_expr<ConstExpr>(tk, NO_EMIT_IN_FPARAMS))->value);
-            if ((*tk)->token_type == TokenCode::RBRACK) {
-                elements.push_back(*tk++);
+            if (tk->token_type == TokenCode::RBRACK) {
+                consume(tk);
             } else {
-                error(ErrorCode::MISSING_RBRACK, (*(tk - 1))->line);
+                error(ErrorCode::MISSING_RBRACK, (tk - 1)->line);
             }
         }
     }
     func->params.push_back(current);
-    elements.push_back(make_shared<FuncFormalParam>());
+    trace<FuncFormalParam>();
 }
 
-void Parser::parse_block(TokenIter &tk, int nest_level, bool from_func_def) {
+NodeId Parser::parse_block(TokenIter &tk, int nest_level, bool from_func_def) {
     // Block -> '{' { BlockItem } '}'
-    if ((*tk)->token_type == TokenCode::LBRACE) {
-        elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::LBRACE) {
+        consume(tk);
     } else {
         ERROR_EXPECTED_GOT(LBRACE, tk);
     }
     if (!from_func_def) {
-        sym_table.emplace_back();
+        sym_table.enter();
     }
+    NodeId result = ast.add(NodeKind::BLOCK), last = NO_NODE;
     while (tk < tokens.end() && (starts_with_decl(tk) || starts_with_stmt(tk))) {  // pre-fetch
-        parse_block_item(tk, nest_level);
+        ast.append(result, last, parse_block_item(tk, nest_level));
     }
-    if ((*tk)->token_type == TokenCode::RBRACE) {
-        elements.push_back(*tk++);
+    if (tk->token_type == TokenCode::RBRACE) {
+        consume(tk);
     } else {
         ERROR_EXPECTED_GOT(RBRACE, tk);
     }
-    sym_table.pop_back();
-    elements.push_back(make_shared<Block>());
+    sym_table.leave();
+    trace<Block>();
+    return result;
 }
 
-void Parser::parse_block_item(TokenIter &tk, int nest_level) {
+NodeId Parser::parse_block_item(TokenIter &tk, int nest_level) {
+    tokens.release(tk);
     // BlockItem -> Decl | Stmt
     if (starts_with_decl(tk)) {
-        parse_decl(tk, nest_level);
+        return parse_decl(tk, nest_level);
     } else if (starts_with_stmt(tk)) {
-        parse_stmt(tk, nest_level);
+        return parse_stmt(tk, nest_level);
     } else {
         ERROR_EXPECTED_GOT(Decl or Stmt, tk);
     }
 }
 
-void Parser::parse_stmt(TokenIter &tk, int nest_level) {
+NodeId Parser::parse_stmt(TokenIter &tk, int nest_level) {
     // Stmt -> LVal '=' Exp ';'
     // | [Exp] ';'
     // | Block
@@ -438,260 +1035,247 @@ void Parser::parse_stmt(TokenIter &tk, int nest_level) {
     // | LVal = 'getint' '(' ')' ';'
     // | 'printf' '(' FormatString { "," Exp } ')' ';'
     has_return_at_end = false;
-    switch ((*tk)->token_type) {
+    NodeId result;
+    switch (tk->token_type) {
         case TokenCode::IDENFR: {
-            bool no_assign = true, is_indexed = has_type(tk + 1, TokenCode::LBRACK);
-            for (auto p = tk + 1; p < tokens.end() && (*p)->token_type != TokenCode::SEMICN; ++p) {
-                if ((*p)->token_type == TokenCode::ASSIGN) {
-                    no_assign = false;
-                    ObjectP lvalue = parse_lvalue(tk, EMIT_IN_NORM_STMT, true);  // pre-fetch
-                    if ((*tk)->token_type == TokenCode::ASSIGN) {
-                        elements.push_back(*tk++);
-                    } else {
-                        // error(MISSING_SEMICN, (*(tk - 1))->line);
-                        break;
+            // what follows an LVal tells an assignment from an expression, so the statement is read only once
+            if (has_type(tk + 1, TokenCode::LPARENT)) {  // a call
+                parse_expr<NormalExpr>(tk, EMIT_IN_NORM_STMT);  // pre-fetch
+                result = take_operands(NodeKind::EXPR_STMT, 1, TypeCode::VOID);
+            } else {
+                int line = tk->line;
+                ObjectP target = sym_table.find(tokens.symbol(*tk));
+                bool is_indexed = has_type(tk + 1, TokenCode::LBRACK);
+                ObjectP lvalue = parse_lvalue(tk, EMIT_IN_NORM_STMT);  // pre-fetch
+                if (tk->token_type == TokenCode::ASSIGN) {
+                    consume(tk);
+                    if (target != nullptr && target->is_const) {
+                        error(ErrorCode::CANNOT_MODIFY_CONST, line);
                     }
-                    if ((*tk)->token_type == TokenCode::GETINTTK) {
-                        elements.push_back(*tk++);
-                        if ((*tk)->token_type == TokenCode::LPARENT) {
-                            elements.push_back(*tk++);
+                    if (!is_indexed) {
+                        pop_operand();  // its value is not read
+                    }
+                    if (tk->token_type == TokenCode::GETINTTK) {
+                        consume(tk);
+                        if (tk->token_type == TokenCode::LPARENT) {
+                            consume(tk);
                         } else {
                             ERROR_EXPECTED_GOT(LPARENT, tk);
                         }
-                        if ((*tk)->token_type == TokenCode::RPARENT) {
-                            elements.push_back(*tk++);
-                            instructions.push_back(make_shared<GetInt>());
+                        if (tk->token_type == TokenCode::RPARENT) {
+                            consume(tk);
                         } else {
-                            error(ErrorCode::MISSING_RPAREN, (*(tk - 1))->line);
+                            error(ErrorCode::MISSING_RPAREN, (tk - 1)->line);
                         }
+                        reduce(NodeKind::GETINT, 0, TypeCode::INT);
                     } else {
                         parse_expr<NormalExpr>(tk, EMIT_IN_NORM_STMT);  // pre-fetch
                     }
-                    if (is_indexed) {
-                        instructions.push_back(make_shared<StoreSubscript>());
-                    } else {
-                        instructions.push_back(make_shared<StoreName>(lvalue));
-                    }
-                    break;
+                    result = take_operands(NodeKind::ASSIGN, is_indexed ? 2 : 1, TypeCode::VOID, 0, lvalue);
+                } else {
+                    parsed_lvalue = lvalue;  // the expression goes on from it
+                    parse_expr<NormalExpr>(tk, EMIT_IN_NORM_STMT);
+                    result = take_operands(NodeKind::EXPR_STMT, 1, TypeCode::VOID);
                 }
             }
-            if (no_assign) {
-                parse_expr<NormalExpr>(tk, EMIT_IN_NORM_STMT);  // pre-fetch
-                instructions.push_back(make_shared<PopTop>());
-            }
-            if ((*tk)->token_type == TokenCode::SEMICN) {
-                elements.push_back(*tk++);
+            if (tk->token_type == TokenCode::SEMICN) {
+                consume(tk);
             } else {
-                error(ErrorCode::MISSING_SEMICN, (*(tk - 1))->line);
+                error(ErrorCode::MISSING_SEMICN, (tk - 1)->line);
             }
             break;
         }
         case TokenCode::SEMICN:
-            elements.push_back(*tk++);
+            consume(tk);
+            result = ast.add(NodeKind::BLOCK);  // an empty one
             break;
         case TokenCode::LBRACE:
-            parse_block(tk, nest_level + 1);  // pre-fetch
+            result = parse_block(tk, nest_level + 1);  // pre-fetch
             break;
         case TokenCode::IFTK: {
-            elements.push_back(*tk++);
-            if ((*tk)->token_type == TokenCode::LPARENT) {
-                elements.push_back(*tk++);
+            consume(tk);
+            if (tk->token_type == TokenCode::LPARENT) {
+                consume(tk);
             } else {
                 ERROR_EXPECTED_GOT(LPARENT, tk);
             }
-            vector<JumpInstructionP> eval_jump_instructions;
-            vector<JumpInstructionP> control_jump_instructions;
-            parse_cond_expr(tk, EMIT_IN_COND_STMT, eval_jump_instructions, &control_jump_instructions);
-            if ((*tk)->token_type == TokenCode::RPARENT) {
-                elements.push_back(*tk++);
+            parse_cond_expr(tk, EMIT_IN_COND_STMT);
+            NodeId children[3] = {pop_operand()};
+            if (tk->token_type == TokenCode::RPARENT) {
+                consume(tk);
             } else {
-                error(ErrorCode::MISSING_RPAREN, (*(tk - 1))->line);
-            }
-            relocate_jump_instructions(eval_jump_instructions);
-            parse_stmt(tk, nest_level + 1);
-            if ((*tk)->token_type == TokenCode::ELSETK) {
-                elements.push_back(*tk++);
-                auto ja = make_shared<JumpAbsolute>();
-                instructions.push_back(ja);
-                relocate_jump_instructions(control_jump_instructions);
-                parse_stmt(tk, nest_level + 1);
-                ja->set_offset((long long) instructions.size());
+                error(ErrorCode::MISSING_RPAREN, (tk - 1)->line);
+            }
+            children[1] = parse_stmt(tk, nest_level + 1);
+            int cnt = 2;
+            if (tk->token_type == TokenCode::ELSETK) {
+                consume(tk);
+                children[cnt++] = parse_stmt(tk, nest_level + 1);
+            }
+            int value;
+            if (children[0] != NO_NODE && ast.constant(children[0], value)) {  // only the branch taken is kept
+                result = value != 0 ? children[1] : cnt > 2 ? children[2] : ast.add(NodeKind::BLOCK);
             } else {
-                relocate_jump_instructions(control_jump_instructions);
+                result = ast.add(NodeKind::IF);
+                ast.adopt(result, children, children + cnt);
             }
             break;
         }
         case TokenCode::WHILETK: {
-            loop_info.emplace_back((long long) instructions.size());
-            elements.push_back(*tk++);
-            if ((*tk)->token_type == TokenCode::LPARENT) {
-                elements.push_back(*tk++);
+            consume(tk);
+            if (tk->token_type == TokenCode::LPARENT) {
+                consume(tk);
             } else {
                 ERROR_EXPECTED_GOT(LPARENT, tk);
             }
-            auto offset = (long long) instructions.size();
-            vector<JumpInstructionP> eval_jump_instructions;
-            vector<JumpInstructionP> control_jump_instructions;
-            parse_cond_expr(tk, EMIT_IN_COND_STMT, eval_jump_instructions, &control_jump_instructions);
-            if ((*tk)->token_type == TokenCode::RPARENT) {
-                elements.push_back(*tk++);
-            } else {
-                error(ErrorCode::MISSING_RPAREN, (*(tk - 1))->line);
-            }
-            relocate_jump_instructions(eval_jump_instructions);
-            parse_stmt(tk, nest_level + 1);
-            instructions.push_back(make_shared<JumpAbsolute>(offset));
-            relocate_jump_instructions(control_jump_instructions);
-            relocate_jump_instructions(loop_info.back().break_instructions);
-            loop_info.pop_back();
-            break;
-        }
-        case TokenCode::BREAKTK:
-            if (loop_info.empty()) {
-                error(ErrorCode::BREAK_CONTINUE_NOT_IN_LOOP, (*tk)->line);
+            parse_cond_expr(tk, EMIT_IN_COND_STMT);
+            NodeId children[2] = {pop_operand()};
+            if (tk->token_type == TokenCode::RPARENT) {
+                consume(tk);
             } else {
-                auto ja = make_shared<JumpAbsolute>();
-                instructions.push_back(ja);
-                loop_info.back().break_instructions.push_back(ja);
+                error(ErrorCode::MISSING_RPAREN, (tk - 1)->line);
             }
-            elements.push_back(*tk++);
-            if ((*tk)->token_type == TokenCode::SEMICN) {
-                elements.push_back(*tk++);
+            loop_depth++;
+            children[1] = parse_stmt(tk, nest_level + 1);
+            loop_depth--;
+            int value;
+            if (children[0] != NO_NODE && ast.constant(children[0], value) && value == 0) {
+                result = ast.add(NodeKind::BLOCK);  // never runs
             } else {
-                error(ErrorCode::MISSING_SEMICN, (*(tk - 1))->line);
+                result = ast.add(NodeKind::WHILE);
+                ast.adopt(result, children, children + 2);
             }
             break;
+        }
+        case TokenCode::BREAKTK:
         case TokenCode::CONTINUETK:
-            if (loop_info.empty()) {
-                error(ErrorCode::BREAK_CONTINUE_NOT_IN_LOOP, (*tk)->line);
+            if (loop_depth == 0) {
+                error(ErrorCode::BREAK_CONTINUE_NOT_IN_LOOP, tk->line);
+                result = ast.add(NodeKind::BLOCK);
             } else {
-                instructions.push_back(make_shared<JumpAbsolute>(loop_info.back().start));
+                result = ast.add(tk->token_type == TokenCode::BREAKTK ? NodeKind::BREAK : NodeKind::CONTINUE);
             }
-            elements.push_back(*tk++);
-            if ((*tk)->token_type == TokenCode::SEMICN) {
-                elements.push_back(*tk++);
+            consume(tk);
+            if (tk->token_type == TokenCode::SEMICN) {
+                consume(tk);
             } else {
-                error(ErrorCode::MISSING_SEMICN, (*(tk - 1))->line);
+                error(ErrorCode::MISSING_SEMICN, (tk - 1)->line);
             }
             break;
-        case TokenCode::RETURNTK:
-            elements.push_back(*tk++);
+        case TokenCode::RETURNTK: {
+            consume(tk);
+            auto begin = operands.size();
             if (starts_with_expr(tk)) {
                 if (current_func_return_type == TypeCode::VOID) {
-                    error(ErrorCode::RETURN_TYPE_MISMATCH, (*(tk - 1))->line);
+                    error(ErrorCode::RETURN_TYPE_MISMATCH, (tk - 1)->line);
                 }
                 parse_expr<NormalExpr>(tk, EMIT_IN_NORM_STMT);
             }
-            if ((*tk)->token_type == TokenCode::SEMICN) {
-                elements.push_back(*tk++);
+            if (tk->token_type == TokenCode::SEMICN) {
+                consume(tk);
             } else {
-                error(ErrorCode::MISSING_SEMICN, (*(tk - 1))->line);
+                error(ErrorCode::MISSING_SEMICN, (tk - 1)->line);
             }
-            if (nest_level == 1 && (*tk)->token_type == TokenCode::RBRACE) {
+            if (nest_level == 1 && tk->token_type == TokenCode::RBRACE) {
                 has_return_at_end = true;
             }
-            instructions.push_back(make_shared<ReturnValue>());
+            result = take_operands(NodeKind::RETURN, operands.size() - begin, TypeCode::VOID);
             break;
+        }
         case TokenCode::PRINTFTK: {
-            TokenP p = *tk;
-            elements.push_back(*tk++);
-            if ((*tk)->token_type == TokenCode::LPARENT) {
-                elements.push_back(*tk++);
+            int printf_line = tk->line;
+            consume(tk);
+            if (tk->token_type == TokenCode::LPARENT) {
+                consume(tk);
             } else {
                 ERROR_EXPECTED_GOT(LPARENT, tk);
             }
             int fmt_char_cnt;
-            FormatStringP fmt_str = cast<FormatString>(*tk);
-            if ((*tk)->token_type == TokenCode::STRCON) {
-                fmt_char_cnt = fmt_str->fmt_char_cnt;
-                elements.push_back(*tk++);
+            FormatStringP fmt_str;
+            if (tk->token_type == TokenCode::STRCON) {
+                if (checking) {
+                    fmt_char_cnt = tokens.string_literal(*tk).fmt_char_cnt;
+                } else {
+                    fmt_str = make<FormatString>(tokens.string_literal(*tk));
+                    fmt_char_cnt = fmt_str->fmt_char_cnt;
+                }
+                consume(tk);
             } else {
                 ERROR_EXPECTED_GOT(STRCON, tk);
             }
             int cnt;
             for (cnt = 0; has_type(tk, TokenCode::COMMA); cnt++) {
-                elements.push_back(*tk++);
+                consume(tk);
                 parse_expr<NormalExpr>(tk, EMIT_IN_NORM_STMT);
             }
             if (cnt != fmt_char_cnt) {
-                error(ErrorCode::FORMAT_STRING_ARGUMENT_MISMATCH, p->line);
+                error(ErrorCode::FORMAT_STRING_ARGUMENT_MISMATCH, printf_line);
             }
-            if ((*tk)->token_type == TokenCode::RPARENT) {
-                elements.push_back(*tk++);
+            if (tk->token_type == TokenCode::RPARENT) {
+                consume(tk);
             } else {
-                error(ErrorCode::MISSING_RPAREN, (*(tk - 1))->line);
+                error(ErrorCode::MISSING_RPAREN, (tk - 1)->line);
             }
-            if ((*tk)->token_type == TokenCode::SEMICN) {
-                elements.push_back(*tk++);
+            if (tk->token_type == TokenCode::SEMICN) {
+                consume(tk);
             } else {
-                error(ErrorCode::MISSING_SEMICN, (*(tk - 1))->line);
+                error(ErrorCode::MISSING_SEMICN, (tk - 1)->line);
             }
-            instructions.push_back(make_shared<PrintF>(fmt_str));
+            result = take_operands(NodeKind::PRINTF, cnt, TypeCode::VOID, 0, fmt_str);
             break;
         }
         default:
             parse_expr<NormalExpr>(tk, EMIT_IN_NORM_STMT);  // pre-fetch
-            instructions.push_back(make_shared<PopTop>());
-            if ((*tk)->token_type == TokenCode::SEMICN) {
-                elements.push_back(*tk++);
+            result = take_operands(NodeKind::EXPR_STMT, 1, TypeCode::VOID);
+            if (tk->token_type == TokenCode::SEMICN) {
+                consume(tk);
             } else {
-                error(ErrorCode::MISSING_SEMICN, (*(tk - 1))->line);
+                error(ErrorCode::MISSING_SEMICN, (tk - 1)->line);
             }
     }
-    elements.push_back(make_shared<Statement>());
+    trace<Statement>();
+    return result;
 }
 
 template<typename T>
 ObjectP Parser::parse_expr(TokenIter &tk, EmitMode emit_mode) {
     // Exp -> AddExp
     // ConstExp -> AddExp
-    ObjectP result = parse_addsub_expr(tk, emit_mode, BinaryOpCode::NOTHING);
-    elements.push_back(make_shared<T>());
+    ObjectP result = parse_binary_expr(tk, emit_mode, ADDSUB_LEVEL);
+    trace<T>();
     return result;
 }
 
-ObjectP Parser::parse_cond_expr(TokenIter &tk, EmitMode emit_mode, vector<JumpInstructionP> &eval_jump_instructions,
-                                vector<JumpInstructionP> *control_jump_instructions) {
+ObjectP Parser::parse_cond_expr(TokenIter &tk, EmitMode emit_mode) {
     // Cond -> LOrExp
-    // the pointer argument is preserved for condition expression outside control flow
-    ObjectP result = parse_logical_or_expr(tk, emit_mode, BinaryOpCode::NOTHING, eval_jump_instructions,
-                                           control_jump_instructions);
-    elements.push_back(make_shared<ConditionExpr>());
+    ObjectP result = parse_binary_expr(tk, emit_mode, LOGICAL_OR_LEVEL);
+    trace<ConditionExpr>();
     return result;
 }
 
-ObjectP Parser::check_ident_valid_use(TokenIter &tk, bool is_called, bool is_assigned = false) {
-    IdentP current = cast<Identifier>(*tk);
-    elements.push_back(*tk++);
-    ObjectP result;
-    for (auto p = sym_table.rbegin(); p != sym_table.rend(); ++p) {
-        if (p->find(current->name) != p->end()) {
-            result = (*p)[current->name];
-            if (is_called && result->type != TypeCode::FUNCTION) {
-                cerr << "In source code line " << current->line << ", "
-                     << *current << " is not callable" << endl;
-            } else if (is_assigned && result->is_const) {
-                error(ErrorCode::CANNOT_MODIFY_CONST, current->line);
-            }
-            return result;
+ObjectP Parser::check_ident_valid_use(TokenIter &tk, bool is_called) {
+    Token current = *tk;
+    SymbolId name = tokens.symbol(current);
+    consume(tk);
+    ObjectP result = sym_table.find(name);
+    if (result != nullptr) {
+        if (is_called && result->type != TypeCode::FUNCTION) {
+            *message_out << "In source code line " << current.line << ", "
+                 << current << " is not callable" << endl;
         }
+        return result;
     }
-    error(ErrorCode::IDENT_UNDEFINED, current->line);
-    return make_shared<Object>();
+    error(ErrorCode::IDENT_UNDEFINED, current.line);
+    return make<Object>();
 }
 
-ObjectP Parser::parse_lvalue(TokenIter &tk, EmitMode emit_mode, bool is_assigned = false) {
+ObjectP Parser::parse_lvalue(TokenIter &tk, EmitMode emit_mode) {
     // LVal -> Ident { '[' Exp ']' }
     ObjectP result;
-    if ((*tk)->token_type == TokenCode::IDENFR) {
-        result = check_ident_valid_use(tk, false, is_assigned);
-        if ((emit_mode == EMIT_IN_VAR_DEF || emit_mode == EMIT_IN_NORM_STMT || emit_mode == EMIT_IN_COND_STMT) &&
-            (!is_assigned || has_type(tk, TokenCode::LBRACK))) {
-            if (result->is_const) {
-                instructions.push_back(make_shared<LoadFast>(result));
-            } else {
-                instructions.push_back(make_shared<LoadName>(result));
-            }
+    if (tk->token_type == TokenCode::IDENFR) {
+        result = check_ident_valid_use(tk, false);
+        if (emits(emit_mode)) {
+            reduce(NodeKind::NAME, 0, result->type, 0, result);
         }
     } else {
         ERROR_EXPECTED_GOT(IDENFR, tk);
@@ -699,21 +1283,30 @@ ObjectP Parser::parse_lvalue(TokenIter &tk, EmitMode emit_mode, bool is_assigned
     vector<long long> indexes;
     int cnt;
     for (cnt = 0; has_type(tk, TokenCode::LBRACK); cnt++) {
-        elements.push_back(*tk++);
+        consume(tk);
         ObjectP index = parse_expr<NormalExpr>(tk, emit_mode);
         if (index->type == TypeCode::INT) {
             indexes.push_back(cast<IntObject>(index)->value);
         }
-        if ((*tk)->token_type == TokenCode::RBRACK) {
-            elements.push_back(*tk++);
-            if (emit_mode == EMIT_IN_VAR_DEF || emit_mode == EMIT_IN_NORM_STMT || emit_mode == EMIT_IN_COND_STMT) {
-                instructions.push_back(make_shared<SubscriptArray>());
+        if (tk->token_type == TokenCode::RBRACK) {
+            consume(tk);
+            if (emits(emit_mode)) {
+                auto array = cast<ArrayObject>(result);
+                reduce(NodeKind::SUBSCRIPT, 2, array != nullptr && (size_t) cnt + 1 < array->dims.size() ?
+                                               TypeCode::INT_ARRAY : TypeCode::INT);
             }
         } else {
-            error(ErrorCode::MISSING_RBRACK, (*(tk - 1))->line);
+            error(ErrorCode::MISSING_RBRACK, (tk - 1)->line);
         }
     }
     ArrayObjectP array = cast<ArrayObject>(result);
+    if (array != nullptr && shares_globals && array->is_global) {
+        ArrayObjectP &view = global_array_views[array.get()];  // tells what is subscripted as the array would
+        if (view == nullptr) {
+            view = make<ArrayObject>(*array);
+        }
+        result = array = view;
+    }
     if (array != nullptr) {
         if (cnt > 0) {
             array->dereference_cnt = cnt;
@@ -729,108 +1322,87 @@ ObjectP Parser::parse_lvalue(TokenIter &tk, EmitMode emit_mode, bool is_assigned
             result = (*array->data)[index];
         }
     }
-    elements.push_back(make_shared<LValue>());
+    trace<LValue>();
     return result;
 }
 
 ObjectP Parser::parse_primary_expr(TokenIter &tk, EmitMode emit_mode) {
     // PrimaryExp -> '(' Exp ')' | LVal | Number
     ObjectP result;
-    switch ((*tk)->token_type) {
-        case TokenCode::LPARENT:
-            elements.push_back(*tk++);
-            result = parse_expr<NormalExpr>(tk, emit_mode);
-            if ((*tk)->token_type == TokenCode::RPARENT) {
-                elements.push_back(*tk++);
-            } else {
-                error(ErrorCode::MISSING_RPAREN, (*(tk - 1))->line);
-            }
-            break;
+    if (parsed_lvalue != nullptr) {
+        result.swap(parsed_lvalue);
+        trace<PrimaryExpr>();
+        return result;
+    }
+    switch (tk->token_type) {  // a parenthesized Exp is parsed by `parse_binary_expr`
         case TokenCode::IDENFR:
             result = parse_lvalue(tk, emit_mode);  // pre-fetch
             break;
         case TokenCode::INTCON:
             result = parse_number(tk);  // pre-fetch
-            if (emit_mode == EMIT_IN_VAR_DEF || emit_mode == EMIT_IN_NORM_STMT || emit_mode == EMIT_IN_COND_STMT) {
-                instructions.push_back(make_shared<LoadFast>(result));
+            if (emits(emit_mode)) {
+                reduce(NodeKind::CONSTANT, 0, TypeCode::INT, 0, result);
             }
             break;
         default:
             ERROR_EXPECTED_GOT(LPARENT or IDENFR or INTCON, tk);
     }
-    elements.push_back(make_shared<PrimaryExpr>());
+    trace<PrimaryExpr>();
     return result;
 }
 
 IntObjectP Parser::parse_number(TokenIter &tk) {
     // Number -> IntLiteral
-    IntObjectP result = cast<IntObject>(*tk);
-    elements.push_back(*tk++);
-    elements.push_back(make_shared<Number>());
+    IntObjectP result = make<IntObject>(tk->value);
+    result->is_const = true;
+    consume(tk);
+    trace<Number>();
     return result;
 }
 
-ObjectP Parser::parse_unary_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode = BinaryOpCode::NOTHING) {
-    // UnaryExp -> PrimaryExp | Ident '(' [FuncRParams] ')' | UnaryOp UnaryExp
+ObjectP Parser::parse_func_call(TokenIter &tk, EmitMode emit_mode) {
+    // UnaryExp -> Ident '(' [FuncRParams] ')'
     ObjectP result;
-    switch ((*tk)->token_type) {
-        case TokenCode::IDENFR:
-            if (has_type(tk + 1, TokenCode::LPARENT)) {  // is function call
-                int line = (*tk)->line;
-                FuncObjectP func = cast<FuncObject>(check_ident_valid_use(tk, true));
-                elements.push_back(*tk++);
-                if (starts_with_expr(tk)) {
-                    parse_func_real_params(tk, func, line);
-                } else if (func != nullptr && !func->params.empty()) {
-                    error(ErrorCode::PARAM_AMOUNT_MISMATCH, line);
-                }
-                if ((*tk)->token_type == TokenCode::RPARENT) {
-                    elements.push_back(*tk++);
-                } else {
-                    error(ErrorCode::MISSING_RPAREN, (*(tk - 1))->line);
-                }
-                if (func != nullptr) {
-                    instructions.push_back(make_shared<CallFunction>(func));
-                    switch (func->return_type) {
-                        case TypeCode::VOID:
-                            result = make_shared<Object>();
-                            break;
-                        case TypeCode::INT:
-                            result = make_shared<IntObject>();
-                            break;
-                        default:
-                            ERROR_LIMITED_SUPPORT_WITH_LINE(func->ident_info->line, VOID or INT function return type);
-                    }
-                } else {
-                    result = make_shared<Object>();
-                }
-            } else {  // is not function call
-                result = parse_primary_expr(tk, emit_mode);  // pre-fetch LVal
-            }
-            break;
-        case TokenCode::PLUS:
-        case TokenCode::MINU:
-        case TokenCode::NOT: {
-            UnaryOpCode opcode = parse_unary_op(tk);  // pre-fetch
-            result = parse_unary_expr(tk, emit_mode);
-            if (emit_mode == EMIT_IN_VAR_DEF || emit_mode == EMIT_IN_NORM_STMT || emit_mode == EMIT_IN_COND_STMT) {
-                instructions.push_back(make_shared<UnaryOperation>(opcode));
-            } else if (result->type == TypeCode::INT) {
-                result = make_shared<IntObject>(util::unary_operation(opcode, cast<IntObject>(result)->value));
-            }
-            break;
+    int line = tk->line;
+    auto begin = operands.size();
+    FuncObjectP func = cast<FuncObject>(check_ident_valid_use(tk, true));
+    consume(tk);
+    if (starts_with_expr(tk)) {
+        parse_func_real_params(tk, func, line);
+    } else if (func != nullptr && !func->params.empty()) {
+        error(ErrorCode::PARAM_AMOUNT_MISMATCH, line);
+    }
+    if (tk->token_type == TokenCode::RPARENT) {
+        consume(tk);
+    } else {
+        error(ErrorCode::MISSING_RPAREN, (tk - 1)->line);
+    }
+    if (func != nullptr) {
+        switch (func->return_type) {
+            case TypeCode::VOID:
+                result = make<Object>();
+                break;
+            case TypeCode::INT:
+                result = make<IntObject>();
+                break;
+            default:
+                ERROR_LIMITED_SUPPORT_WITH_LINE(func->ident_info->line, VOID or INT function return type);
         }
-        default:
-            result = parse_primary_expr(tk, emit_mode);  // pre-fetch
+    } else {
+        result = make<Object>();
+    }
+    if (emits(emit_mode)) {  // the arguments are evaluated even if the function is undefined
+        reduce(NodeKind::CALL, operands.size() - begin, result->type, 0, func);
+    } else {
+        operands.resize(begin);
     }
-    elements.push_back(make_shared<UnaryExpr>());
     return result;
 }
 
 UnaryOpCode Parser::parse_unary_op(TokenIter &tk) {
-    TokenCode type = (*tk)->token_type;
-    elements.push_back(*tk++);
-    elements.push_back(make_shared<UnaryOp>());
+    TokenCode type = tk->token_type;
+    consume(tk);
+    trace<UnaryOp>();
     switch (type) {
         case TokenCode::PLUS: return UnaryOpCode::UNARY_POSITIVE;
         case TokenCode::MINU: return UnaryOpCode::UNARY_NEGATIVE;
@@ -883,8 +1455,8 @@ void Parser::parse_func_real_params(TokenIter &tk, FuncObjectP &func, int func_l
                 first_error = false;
             }
         }
-        if ((*tk)->token_type == TokenCode::COMMA) {
-            elements.push_back(*tk++);
+        if (tk->token_type == TokenCode::COMMA) {
+            consume(tk);
         } else {
             cnt++;
             break;
@@ -893,125 +1465,95 @@ void Parser::parse_func_real_params(TokenIter &tk, FuncObjectP &func, int func_l
     if (func != nullptr && cnt < func->params.size()) {
         error(ErrorCode::PARAM_AMOUNT_MISMATCH, func_line);
     }
-    elements.push_back(make_shared<FuncRealParams>());
+    trace<FuncRealParams>();
 }
 
-template<typename T>
-ObjectP Parser::_parse_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op,
-                            ObjectP (Parser::*parse_first)(TokenIter &, EmitMode, BinaryOpCode),
-                            BinaryOpCode (*predicate)(TokenCode)) {
-    ObjectP result, tmp;
-    BinaryOpCode next_op = BinaryOpCode::NOTHING;
-    while (tk < tokens.end()) {
-        tmp = (this->*parse_first)(tk, emit_mode, last_op);
-        if (result == nullptr || result->type == TypeCode::INT && tmp->type != TypeCode::INT) {
-            result = tmp;
-        } else if ((emit_mode == NO_EMIT_IN_CONST_DEF || emit_mode == NO_EMIT_IN_FPARAMS || emit_mode == EMIT_IN_VAR_DEF) &&
-                   result->type == TypeCode::INT && tmp->type == TypeCode::INT) {
-            result = make_shared<IntObject>(
-                    util::binary_operation(last_op, cast<IntObject>(result)->value, cast<IntObject>(tmp)->value));
-        }
-        if ((emit_mode == EMIT_IN_VAR_DEF || emit_mode == EMIT_IN_NORM_STMT || emit_mode == EMIT_IN_COND_STMT) &&
-            next_op != BinaryOpCode::NOTHING && next_op == last_op) {
-            instructions.push_back(make_shared<BinaryOperation>(last_op));
-        }
-        next_op = predicate((*tk)->token_type);
-        if (next_op != BinaryOpCode::NOTHING) {
-            last_op = next_op;
-            elements.push_back(make_shared<T>());
-            elements.push_back(*tk++);
-        } else {
-            break;
-        }
-    }
-    elements.push_back(make_shared<T>());
-    return result;
-}
-
-ObjectP Parser::parse_muldiv_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op) {
-    // MulExp -> UnaryExp | MulExp ('*' | '/' | '%') UnaryExp
+ObjectP Parser::parse_binary_expr(TokenIter &tk, EmitMode emit_mode, int top_level) {
     // MulExp -> UnaryExp { ('*' | '/' | '%') UnaryExp }
-    return _parse_expr<MulDivExpr>(tk, emit_mode, last_op, &Parser::parse_unary_expr, determine_muldiv);
-}
-
-ObjectP Parser::parse_addsub_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op) {
-    // AddExp -> MulExp | AddExp ('+' | '-') MulExp
     // AddExp -> MulExp { ('+' | '-') MulExp }
-    return _parse_expr<AddSubExpr>(tk, emit_mode, last_op, &Parser::parse_muldiv_expr, determine_addsub);
-}
-
-ObjectP Parser::parse_rel_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op) {
-    // RelExp -> AddExp | RelExp ('<' | '>' | '<=' | '>=') AddExp
     // RelExp -> AddExp { ('<' | '>' | '<=' | '>=') AddExp }
-    return _parse_expr<RelationalExpr>(tk, emit_mode, last_op, &Parser::parse_addsub_expr, determine_relation);
-}
-
-ObjectP Parser::parse_eq_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op) {
-    // EqExp -> RelExp | EqExp ('==' | '!=') RelExp
     // EqExp -> RelExp { ('==' | '!=') RelExp }
-    return _parse_expr<EqualExpr>(tk, emit_mode, last_op, &Parser::parse_rel_expr, determine_equality);
-}
-
-ObjectP Parser::parse_logical_and_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op,
-                                       vector<JumpInstructionP> &eval_jump_instructions) {
-    // LAndExp -> EqExp | LAndExp '&&' EqExp
     // LAndExp -> EqExp { '&&' EqExp }
-    ObjectP result, tmp;
-    BinaryOpCode next_op;
-    while (tk < tokens.end()) {
-        tmp = parse_eq_expr(tk, emit_mode, last_op);
-        if (result == nullptr || result->type == TypeCode::INT && tmp->type != TypeCode::INT) {
-            result = tmp;
-        }
-        next_op = determine_and((*tk)->token_type);
-        if (next_op != BinaryOpCode::NOTHING) {
-            last_op = next_op;
-            auto bgz = make_shared<PopJumpIfFalse>();
-            instructions.push_back(bgz);
-            eval_jump_instructions.push_back(bgz);
-            elements.push_back(make_shared<LogicalAndExpr>());
-            elements.push_back(*tk++);
+    // LOrExp -> LAndExp { '||' LAndExp }
+    // UnaryExp -> UnaryOp UnaryExp | '(' Exp ')' | ...
+    // by precedence climbing: a binary operator waits on `operators` until one that binds as loose or looser
+    // comes, prefix operators and parentheses wait there for their operand, so nesting takes no native stack
+    bool emit = emits(emit_mode);
+    bool fold = emit_mode == NO_EMIT_IN_CONST_DEF || emit_mode == NO_EMIT_IN_FPARAMS || emit_mode == EMIT_IN_VAR_DEF;
+    auto base = operators.size();
+    int parens = 0;  // open in this expression
+    while (true) {
+        ObjectP value;
+        if (parsed_lvalue != nullptr) {
+            value = parse_primary_expr(tk, emit_mode);
+        } else if (tk->token_type == TokenCode::PLUS || tk->token_type == TokenCode::MINU ||
+                   tk->token_type == TokenCode::NOT) {
+            operators.push_back({PREFIX_LEVEL, parse_unary_op(tk), nullptr});
+            continue;
+        } else if (tk->token_type == TokenCode::LPARENT) {
+            consume(tk);
+            operators.push_back({PAREN_LEVEL, 0, nullptr});
+            parens++;
+            continue;
+        } else if (tk->token_type == TokenCode::IDENFR && has_type(tk + 1, TokenCode::LPARENT)) {
+            value = parse_func_call(tk, emit_mode);
         } else {
-            break;
+            value = parse_primary_expr(tk, emit_mode);  // pre-fetch
         }
-    }
-    elements.push_back(make_shared<LogicalAndExpr>());
-    return result;
-}
+        trace<UnaryExpr>();
 
-ObjectP Parser::parse_logical_or_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op,
-                                      vector<JumpInstructionP> &eval_jump_instructions,
-                                      vector<JumpInstructionP> *control_jump_instructions) {
-    // LOrExp -> LAndExp | LOrExp '||' LAndExp
-    // LOrExp -> LAndExp { '||' LAndExp }
-    ObjectP result, tmp;
-    BinaryOpCode next_op;
-    while (tk < tokens.end()) {
-        vector<JumpInstructionP> and_eval_jump_instructions;
-        tmp = parse_logical_and_expr(tk, emit_mode, last_op, and_eval_jump_instructions);
-        if (result == nullptr || result->type == TypeCode::INT && tmp->type != TypeCode::INT) {
-            result = tmp;
-        }
-        next_op = determine_or((*tk)->token_type);
-        if (next_op != BinaryOpCode::NOTHING) {
-            last_op = next_op;
-            auto bgz = make_shared<PopJumpIfTrue>();
-            instructions.push_back(bgz);
-            eval_jump_instructions.push_back(bgz);
-            relocate_jump_instructions(and_eval_jump_instructions);
-            elements.push_back(make_shared<LogicalOrExpr>());
-            elements.push_back(*tk++);
-        } else {
-            if (control_jump_instructions != nullptr) {
-                auto bez = make_shared<PopJumpIfFalse>();
-                instructions.push_back(bez);
-                control_jump_instructions->push_back(bez);
-                control_jump_instructions->insert(control_jump_instructions->end(),
-                                                  and_eval_jump_instructions.begin(), and_eval_jump_instructions.end());
+        BinaryOpCode opcode;
+        int level;
+        while (true) {  // the operand is complete, until a binary operator of the open expression follows it
+            for (; operators.size() > base && operators.back().level == PREFIX_LEVEL; operators.pop_back()) {
+                auto unary_opcode = (UnaryOpCode) operators.back().opcode;
+                if (emit) {
+                    reduce(NodeKind::UNARY, 1, TypeCode::INT, unary_opcode);
+                } else if (value->type == TypeCode::INT) {
+                    value = make<IntObject>(util::unary_operation(unary_opcode, cast<IntObject>(value)->value));
+                }
+                trace<UnaryExpr>();
             }
-            break;
+            int top = parens > 0 ? ADDSUB_LEVEL : top_level;
+            level = binary_level(tk->token_type, opcode);
+            int bound = level >= top ? level : top;  // operands of this level or tighter are complete
+            for (int l = MULDIV_LEVEL; l >= bound; l--) {
+                trace_level(l);
+            }
+            for (; operators.size() > base && operators.back().level >= bound; operators.pop_back()) {
+                auto &o = operators.back();
+                if (o.left->type == TypeCode::INT && value->type != TypeCode::INT) {
+                    // the other operand is what is checked against
+                } else if (o.level >= EQUALITY_LEVEL && fold && o.left->type == TypeCode::INT &&
+                           value->type == TypeCode::INT) {
+                    value = make<IntObject>(util::binary_operation(
+                            (BinaryOpCode) o.opcode, cast<IntObject>(o.left)->value, cast<IntObject>(value)->value));
+                } else {
+                    value = o.left;
+                }
+                if (emit) {
+                    reduce(o.level >= EQUALITY_LEVEL ? NodeKind::BINARY : NodeKind::LOGICAL, 2, TypeCode::INT,
+                           o.opcode);
+                }
+            }
+            if (level >= top) {
+                break;
+            }
+            if (parens == 0) {
+                return value;
+            }
+            trace<NormalExpr>();
+            if (tk->token_type == TokenCode::RPARENT) {
+                consume(tk);
+            } else {
+                error(ErrorCode::MISSING_RPAREN, (tk - 1)->line);
+            }
+            operators.pop_back();
+            parens--;
+            trace<PrimaryExpr>();
+            trace<UnaryExpr>();
         }
+        consume(tk);
+        operators.push_back({level, opcode, value});
     }
-    elements.push_back(make_shared<LogicalOrExpr>());
-    return result;
 }
@@ -5,20 +5,20 @@
 #ifndef CODE_PARSER_H
 #define CODE_PARSER_H
 
+#include <atomic>
+#include "arena.h"
 #include "token.h"
-#include "instruction.h"
-
-using TokenIter = vector<TokenP>::iterator;
-using HashMap = unordered_map<string, ObjectP>;
-
-struct LoopInfo {
-    long long start;
-    vector<JumpInstructionP> break_instructions;
-
-    explicit LoopInfo(long long start) : start(start) {}
+#include "codegen.h"
+#include "symbol_table.h"
+
+enum class ItemKind {  // a top-level item of a CompUnit, in the order they must appear
+    DECL,
+    FUNC,
+    MAIN,
+    TAIL  // whatever follows, lexed but not parsed
 };
 
-enum EmitMode {
+enum EmitMode {  // whether an expression gets nodes, and so code, and whether it is folded
     NO_EMIT_IN_CONST_DEF,
     NO_EMIT_IN_FPARAMS,
     EMIT_IN_VAR_DEF,
@@ -26,32 +26,163 @@ enum EmitMode {
     EMIT_IN_COND_STMT
 };
 
-class Parser {
+inline bool emits(EmitMode mode) {
+    return mode == EMIT_IN_VAR_DEF || mode == EMIT_IN_NORM_STMT || mode == EMIT_IN_COND_STMT;
+}
+
+enum ExprLevel {  // of the binary operators from the loosest, the others only wait on the operator stack
+    PAREN_LEVEL = -2,
+    PREFIX_LEVEL,
+    LOGICAL_OR_LEVEL,
+    LOGICAL_AND_LEVEL,
+    EQUALITY_LEVEL,
+    RELATION_LEVEL,
+    ADDSUB_LEVEL,
+    MULDIV_LEVEL
+};
+
+enum class CompileMode {  // when the function bodies are compiled
+    EAGER,  // as they are parsed
+    LAZY,  // each when its function is first called, the errors of the others are never found
+    LAZY_CHECKED,  // the same, but all are parsed for errors first
+    CHECK_ONLY  // none, only the errors are found, with no code, nodes or data image made
+};
+
+struct FuncJob {  // a function whose body is compiled on its own, see `Parser::parse_signatures`
+    FuncObjectP func;
+    TokenIter body;  // at its Block
+    int scope_end;  // of the global bindings it sees, those of the functions after it are hidden
+    int param_slots;
+    bool is_main;
+    int worker = -1;  // whose `instructions` its code went to, between `begin` and `end` with jumps absolute there
+    long long begin = 0, end = 0;
+    string messages;  // for `cerr`, where they go in the order of the jobs
+
+    FuncJob(FuncObjectP func, TokenIter body, int scope_end, int param_slots, bool is_main) :
+            func(move(func)), body(body), scope_end(scope_end), param_slots(param_slots), is_main(is_main) {}
+};
+
+struct PendingOperator {
+    int level;  // ExprLevel
+    int opcode;  // BinaryOpCode, or UnaryOpCode of a prefix
+    ObjectP left;  // of a binary operator
+};
+
+class Parser : public CodeLoader {
+    unique_ptr<Arena> arena;  // first to be made and last to go, everything the parser makes lives in it if set
+    vector<unique_ptr<Arena>> worker_arenas;  // of the parsers that compiled function bodies in parallel
     Error &error;
-    vector<TokenP> &tokens;
+    TokenStream &tokens;
     vector<ArrayObjectP> arrays;
-    InstructionP entry_inst;
-
-    vector<LoopInfo> loop_info;
+    bool incremental = false;
+    bool checking = false;  // by `CompileMode::CHECK_ONLY`
+    bool shares_globals = false;  // the global objects with parsers on other threads, so it must not change them
+    unordered_map<const Object *, ArrayObjectP> global_array_views;  // subscripted instead if `shares_globals`
+    ostream *trace_out = nullptr;  // the syntax trace goes here if set
+    ostream *message_out = &cerr;  // of what is reported without being an `Error`
+    vector<FuncJob> lazy_jobs;  // of the functions not compiled yet if compiling lazily
+    unordered_map<const FuncObject *, size_t> lazy_job_index;
+    bool lazy_checked = false;  // all the bodies have been parsed for errors
+
+    int loop_depth = 0;
     TypeCode current_func_return_type = TypeCode::INT;
     bool has_return_at_end = false;
-public:
-    vector<ElementP> elements;
-    vector<HashMap> sym_table;
-    vector<InstructionP> instructions;
+    int slot_cnt = 0;  // frame slots taken so far in the function being parsed
+    vector<ObjectP> locals;  // by slot, of the function being parsed
+    ObjectP parsed_lvalue;  // read by `parse_stmt` ahead of the expression it starts
+    vector<PendingOperator> operators;  // shared by nested expressions, each uses the part above where it began
+    vector<NodeId> operands;  // nodes of the expressions being parsed, in the order their code runs
+
+    template<typename T, typename... Args>
+    inline shared_ptr<T> make(Args &&...args) {
+        return arena != nullptr ? arena->make<T>(forward<Args>(args)...) : make_shared<T>(forward<Args>(args)...);
+    }
 
-    explicit Parser(vector<TokenP> &tokens, Error &error);
+    NodeId take_operands(NodeKind kind, size_t arity, TypeCode type, int op = 0, const ObjectP &object = nullptr) {
+        // a node with the last `arity` operands as its children
+        NodeId node = ast.add(kind, type, op, object);
+        ast.adopt(node, operands.end() - (long) arity, operands.end());
+        operands.resize(operands.size() - arity);
+        return node;
+    }
+
+    inline void reduce(NodeKind kind, size_t arity, TypeCode type, int op = 0, const ObjectP &object = nullptr) {
+        operands.push_back(fold(take_operands(kind, arity, type, op, object)));  // in their place
+    }
+
+    inline NodeId detach(NodeId node) {  // from its siblings, to take the place of its parent
+        ast[node].next = NO_NODE;
+        return node;
+    }
 
-    friend ostream &operator<<(ostream &out, const Parser &self) {
-        for (const auto &element: self.elements) {
-            out << *element << endl;
+    NodeId add_constant(int value);
+
+    NodeId fold(NodeId node);
+
+    NodeId fold_subscript(NodeId node);
+
+    inline NodeId pop_operand() {
+        NodeId node = operands.back();
+        operands.pop_back();
+        return node;
+    }
+
+    // parses function bodies only, see `parse_func_bodies`
+    Parser(TokenStream &tokens, Error &error, const SymbolTable &globals, bool checking);
+
+    void parse_signatures(TokenIter &tk, vector<FuncJob> &jobs);
+
+    void parse_comp_unit_parallel(TokenIter &tk, int threads);
+
+    void parse_comp_unit_lazy(TokenIter &tk, int threads, bool check);
+
+    void check_comp_unit_parallel(TokenIter &tk, int threads);
+
+    int parse_jobs_parallel(vector<FuncJob> &jobs, int threads, vector<vector<InstructionP>> *code);
+
+    void parse_func_bodies(vector<FuncJob> &jobs, atomic<size_t> &next, int worker, bool generate);
+
+    NodeId parse_func_job(const FuncJob &job);
+
+    TokenIter skip_block(TokenIter tk);
+
+public:
+    static bool use_arena;  // by a whole-program parser, an item-by-item one keeps items apart to free them one by one
+    SymbolTable sym_table;
+    Ast ast;  // of the CompUnit, or of the last item when parsing item by item
+    vector<InstructionP> instructions;  // generated from `ast`, with it and `data_image` must not outlive the parser
+                                        // if it has an arena
+    vector<ObjectP> data_image;  // global variables by `Object::slot`, holding the values they start with
+
+    // only filled when parsing item by item
+    FuncObjectP item_func;  // of a FUNC or MAIN
+    vector<pair<SymbolId, ObjectP>> global_decls;  // added to the global scope
+    vector<IdentP> identifiers;  // all declared
+    bool in_module = false;  // `extern` declarations are allowed, see `Module`
+
+    // `trace_out` gets every token consumed and grammar element recognized, one per line, as parsing goes.
+    // Without it, more than one thread compiles function bodies in parallel once all tokens are lexed,
+    // the code and the errors are the same, and the bodies can be compiled lazily by `mode`,
+    // in which case the parser must be kept for `load` while the code runs.
+    explicit Parser(TokenStream &tokens, Error &error, ostream *trace_out = nullptr, int threads = 1,
+                    CompileMode mode = CompileMode::EAGER);
+
+    // parses nothing until `parse_item` is called, with the global scope starting as `globals`
+    Parser(TokenStream &tokens, Error &error, HashMap globals);
+
+    bool load(const FuncObjectP &func) override;
+
+    inline void consume(TokenIter &tk) {
+        if (trace_out != nullptr) {
+            *trace_out << *tk << '\n';
         }
-        return out;
+        ++tk;
     }
 
-    inline void relocate_jump_instructions(vector<JumpInstructionP> &is) const {
-        for (auto &i: is) {
-            i->set_offset((long long) instructions.size());
+    template<typename T>
+    inline void trace() {
+        if (trace_out != nullptr) {
+            *trace_out << T::name() << '\n';
         }
     }
 
@@ -60,26 +191,32 @@ public:
             cerr << "unexpected EOF while parsing" << endl;
             exit(-1);
         } else {
-            return (*tk)->token_type == type;
+            return tk->token_type == type;
         }
     }
 
-    static inline bool starts_with_decl(const TokenIter &tk) {
-        auto next = (*tk)->token_type;
-        return next == TokenCode::CONSTTK ||
-               (next == TokenCode::INTTK && (*(tk + 2))->token_type != TokenCode::LPARENT);
+    inline bool starts_with_extern(const TokenIter &tk) const {
+        // `extern` is only reserved in a module, elsewhere it is lexed and used as an identifier like any other
+        return in_module && tk->token_type == TokenCode::IDENFR &&
+               SymbolPool::global().name(tokens.symbol(*tk)) == "extern";
+    }
+
+    inline bool starts_with_decl(const TokenIter &tk) const {
+        auto next = tk->token_type;
+        return next == TokenCode::CONSTTK || starts_with_extern(tk) ||
+               (next == TokenCode::INTTK && (tk + 2)->token_type != TokenCode::LPARENT);
     }
 
     static inline bool starts_with_func_def(const TokenIter &tk) {
-        auto next = (*tk)->token_type;
+        auto next = tk->token_type;
         return next == TokenCode::VOIDTK ||
                (next == TokenCode::INTTK &&
-                (*(tk + 1))->token_type != TokenCode::MAINTK &&
-                (*(tk + 2))->token_type == TokenCode::LPARENT);
+                (tk + 1)->token_type != TokenCode::MAINTK &&
+                (tk + 2)->token_type == TokenCode::LPARENT);
     }
 
     static inline bool starts_with_expr(const TokenIter &tk) {
-        switch ((*tk)->token_type) {
+        switch (tk->token_type) {
             case TokenCode::LPARENT:
             case TokenCode::IDENFR:
             case TokenCode::INTCON:
@@ -93,7 +230,7 @@ public:
     }
 
     static inline bool starts_with_stmt(const TokenIter &tk) {
-        switch ((*tk)->token_type) {
+        switch (tk->token_type) {
             case TokenCode::LBRACE:
             case TokenCode::SEMICN:
             case TokenCode::IFTK:
@@ -108,91 +245,110 @@ public:
         }
     }
 
-    static BinaryOpCode determine_addsub(TokenCode type) {
-        switch (type) {
-            case TokenCode::PLUS:
-                return BinaryOpCode::BINARY_ADD;
-            case TokenCode::MINU:
-                return BinaryOpCode::BINARY_SUB;
-            default:
-                return BinaryOpCode::NOTHING;
-        }
-    }
-
-    static BinaryOpCode determine_muldiv(TokenCode type) {
+    static int binary_level(TokenCode type, BinaryOpCode &opcode) {  // -1 if `type` is no binary operator
         switch (type) {
             case TokenCode::MULT:
-                return BinaryOpCode::BINARY_MUL;
+                opcode = BinaryOpCode::BINARY_MUL;
+                return MULDIV_LEVEL;
             case TokenCode::DIV:
-                return BinaryOpCode::BINARY_DIV;
+                opcode = BinaryOpCode::BINARY_DIV;
+                return MULDIV_LEVEL;
             case TokenCode::MOD:
-                return BinaryOpCode::BINARY_MOD;
-            default:
-                return BinaryOpCode::NOTHING;
-        }
-    }
-
-    static BinaryOpCode determine_relation(TokenCode type) {
-        switch (type) {
+                opcode = BinaryOpCode::BINARY_MOD;
+                return MULDIV_LEVEL;
+            case TokenCode::PLUS:
+                opcode = BinaryOpCode::BINARY_ADD;
+                return ADDSUB_LEVEL;
+            case TokenCode::MINU:
+                opcode = BinaryOpCode::BINARY_SUB;
+                return ADDSUB_LEVEL;
             case TokenCode::LSS:
-                return BinaryOpCode::BINARY_LT;
+                opcode = BinaryOpCode::BINARY_LT;
+                return RELATION_LEVEL;
             case TokenCode::LEQ:
-                return BinaryOpCode::BINARY_LE;
+                opcode = BinaryOpCode::BINARY_LE;
+                return RELATION_LEVEL;
             case TokenCode::GRE:
-                return BinaryOpCode::BINARY_GT;
+                opcode = BinaryOpCode::BINARY_GT;
+                return RELATION_LEVEL;
             case TokenCode::GEQ:
-                return BinaryOpCode::BINARY_GE;
-            default:
-                return BinaryOpCode::NOTHING;
-        }
-    }
-
-    static BinaryOpCode determine_equality(TokenCode type) {
-        switch (type) {
+                opcode = BinaryOpCode::BINARY_GE;
+                return RELATION_LEVEL;
             case TokenCode::EQL:
-                return BinaryOpCode::BINARY_EQ;
+                opcode = BinaryOpCode::BINARY_EQ;
+                return EQUALITY_LEVEL;
             case TokenCode::NEQ:
-                return BinaryOpCode::BINARY_NE;
+                opcode = BinaryOpCode::BINARY_NE;
+                return EQUALITY_LEVEL;
+            case TokenCode::AND:
+                opcode = BinaryOpCode::BINARY_LOGICAL_AND;
+                return LOGICAL_AND_LEVEL;
+            case TokenCode::OR:
+                opcode = BinaryOpCode::BINARY_LOGICAL_OR;
+                return LOGICAL_OR_LEVEL;
             default:
-                return BinaryOpCode::NOTHING;
+                opcode = BinaryOpCode::NOTHING;
+                return -1;
         }
     }
 
-    static BinaryOpCode determine_or(TokenCode type) {
-        return type == TokenCode::OR ? BinaryOpCode::BINARY_LOGICAL_OR : BinaryOpCode::NOTHING;
-    }
-
-    static BinaryOpCode determine_and(TokenCode type) {
-        return type == TokenCode::AND ? BinaryOpCode::BINARY_LOGICAL_AND : BinaryOpCode::NOTHING;
+    void trace_level(int level) {  // the element that an operand of `level` ends
+        switch (level) {
+            case LOGICAL_OR_LEVEL:
+                trace<LogicalOrExpr>();
+                break;
+            case LOGICAL_AND_LEVEL:
+                trace<LogicalAndExpr>();
+                break;
+            case EQUALITY_LEVEL:
+                trace<EqualExpr>();
+                break;
+            case RELATION_LEVEL:
+                trace<RelationalExpr>();
+                break;
+            case ADDSUB_LEVEL:
+                trace<AddSubExpr>();
+                break;
+            default:
+                trace<MulDivExpr>();
+        }
     }
 
-    template<typename T>
-    ObjectP _parse_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op,
-                        ObjectP (Parser::*parse_first)(TokenIter &, EmitMode, BinaryOpCode),
-                        BinaryOpCode (*predicate)(TokenCode));
-
     void parse_comp_unit(TokenIter &tk);
 
-    ObjectP check_ident_valid_use(TokenIter &tk, bool is_called, bool is_assigned);
+    ItemKind parse_item(TokenIter &tk, ItemKind last);
 
-    ObjectP check_ident_valid_decl(TokenIter &tk, TypeCode type, bool is_global, bool is_const, bool is_func);
+    ObjectP check_ident_valid_use(TokenIter &tk, bool is_called);
 
-    void parse_decl(TokenIter &tk, int nest_level);
+    ObjectP check_ident_valid_decl(TokenIter &tk, TypeCode type, bool is_global, bool is_const, bool is_func,
+                                   bool is_extern);
+
+    NodeId parse_decl(TokenIter &tk, int nest_level);
 
     void parse_const_decl(TokenIter &tk, int nest_level);
 
+    void parse_extern_decl(TokenIter &tk, int nest_level);
+
     void parse_const_def(TokenIter &tk, int nest_level);
 
-    void parse_var_decl(TokenIter &tk, int nest_level);
+    NodeId parse_var_decl(TokenIter &tk, int nest_level);
 
-    void parse_var_def(TokenIter &tk, int nest_level);
+    NodeId parse_var_def(TokenIter &tk, int nest_level);
+
+    bool fold_code(NodeId first, vector<ObjectP> &values);
 
     template<typename ExprT, typename ElementT>
     ObjectP parse_init_val(TokenIter &tk, EmitMode emit_mode);
 
-    void parse_func_def(TokenIter &tk);
+    NodeId parse_func_def(TokenIter &tk);
+
+    FuncObjectP parse_func_signature(TokenIter &tk);
+
+    NodeId parse_main_func_def(TokenIter &tk);
 
-    void parse_main_func_def(TokenIter &tk);
+    FuncObjectP parse_main_func_signature(TokenIter &tk);
+
+    NodeId parse_func_body(TokenIter &tk, const FuncObjectP &func, bool is_main);
 
     TypeCode parse_func_type(TokenIter &tk);
 
@@ -200,19 +356,18 @@ public:
 
     void parse_func_formal_param(TokenIter &tk, FuncObjectP &func);
 
-    void parse_block(TokenIter &tk, int nest_level, bool from_func_def = false);
+    NodeId parse_block(TokenIter &tk, int nest_level, bool from_func_def = false);
 
-    void parse_block_item(TokenIter &tk, int nest_level);
+    NodeId parse_block_item(TokenIter &tk, int nest_level);
 
-    void parse_stmt(TokenIter &tk, int nest_level);
+    NodeId parse_stmt(TokenIter &tk, int nest_level);
 
     template<typename T>
     ObjectP parse_expr(TokenIter &tk, EmitMode emit_mode);
 
-    ObjectP parse_cond_expr(TokenIter &tk, EmitMode emit_mode, vector<JumpInstructionP> &eval_jump_instructions,
-                            vector<JumpInstructionP> *control_jump_instructions);
+    ObjectP parse_cond_expr(TokenIter &tk, EmitMode emit_mode);
 
-    ObjectP parse_lvalue(TokenIter &tk, EmitMode emit_mode, bool is_assigned);
+    ObjectP parse_lvalue(TokenIter &tk, EmitMode emit_mode);
 
     ObjectP parse_primary_expr(TokenIter &tk, EmitMode emit_mode);
 
@@ -220,24 +375,11 @@ public:
 
     UnaryOpCode parse_unary_op(TokenIter &tk);
 
-    ObjectP parse_unary_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode dummy);
+    ObjectP parse_func_call(TokenIter &tk, EmitMode emit_mode);
 
     void parse_func_real_params(TokenIter &tk, FuncObjectP &func, int func_line);
 
-    ObjectP parse_muldiv_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op);
-
-    ObjectP parse_addsub_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op);
-
-    ObjectP parse_rel_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op);
-
-    ObjectP parse_eq_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op);
-
-    ObjectP parse_logical_and_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op,
-                                   vector<JumpInstructionP> &eval_jump_instructions);
-
-    ObjectP parse_logical_or_expr(TokenIter &tk, EmitMode emit_mode, BinaryOpCode last_op,
-                                  vector<JumpInstructionP> &eval_jump_instructions,
-                                  vector<JumpInstructionP> *control_jump_instructions);
+    ObjectP parse_binary_expr(TokenIter &tk, EmitMode emit_mode, int top_level);
 };
 
 
@@ -0,0 +1,173 @@
+//
+// Created by Kevin Tan on 2022/3/27.
+//
+
+#include "peephole.h"
+
+bool PeepholeOptimizer::enabled = true;
+
+static inline bool is_jump(const InstructionP &i) {
+    return i->opcode == JUMP_ABSOLUTE || i->opcode == POP_JUMP_IF_FALSE || i->opcode == POP_JUMP_IF_TRUE;
+}
+
+static inline long long target(const InstructionP &i) {
+    return static_pointer_cast<JumpInstruction>(i)->get_offset();
+}
+
+static bool reloads(const InstructionP &store, const InstructionP &load) {
+    // whether `load` pushes what `store` has just stored
+    if (store->opcode == STORE_NAME && load->opcode == LOAD_NAME) {
+        auto s = static_pointer_cast<StoreName>(store);
+        return !s->keep && s->object == static_pointer_cast<LoadName>(load)->object;
+    }
+    if (store->opcode == STORE_LOCAL && load->opcode == LOAD_LOCAL) {
+        auto s = static_pointer_cast<StoreLocal>(store);
+        return !s->keep && s->object == static_pointer_cast<LoadLocal>(load)->object;
+    }
+    return false;
+}
+
+void PeepholeOptimizer::run() {
+    if (begin >= end || !jumps_within()) {
+        return;
+    }
+    bool changed = true;
+    while (changed) {  // dropping a jump or what it skipped may make more to drop
+        changed = thread_jumps();
+        changed = compact() || changed;
+    }
+}
+
+bool PeepholeOptimizer::jumps_within() const {
+    // all the more in code with errors, which is left as it is
+    for (long long i = begin; i < end; i++) {
+        if (is_jump(instructions[i]) && (target(instructions[i]) < begin || target(instructions[i]) > end)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PeepholeOptimizer::thread_jumps() {
+    bool changed = false;
+    for (long long i = begin; i < end; i++) {
+        if (!is_jump(instructions[i])) {
+            continue;
+        }
+        long long t = target(instructions[i]), hops = 0;
+        for (; t < end && instructions[t]->opcode == JUMP_ABSOLUTE && hops <= end - begin; hops++) {
+            t = target(instructions[t]);
+        }
+        if (hops <= end - begin && t != target(instructions[i])) {  // not into a loop of jumps, `while (1);`
+            static_pointer_cast<JumpInstruction>(instructions[i])->set_offset(t);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void PeepholeOptimizer::mark_reachable() {
+    // from the start of the function, falling through all but what leaves it or jumps away
+    kept.assign((size_t) (end - begin), false);
+    targeted.assign((size_t) (end - begin + 1), false);
+    vector<long long> starts{begin};
+    while (!starts.empty()) {
+        long long i = starts.back();
+        starts.pop_back();
+        for (; i < end && !kept[i - begin]; i++) {
+            kept[i - begin] = true;
+            auto opcode = instructions[i]->opcode;
+            if (is_jump(instructions[i])) {
+                targeted[target(instructions[i]) - begin] = true;
+                starts.push_back(target(instructions[i]));
+            }
+            if (opcode == JUMP_ABSOLUTE || opcode == RETURN_VALUE || opcode == EXIT_INTERP) {
+                break;
+            }
+        }
+    }
+}
+
+bool PeepholeOptimizer::compact() {
+    mark_reachable();
+    bool dropped = false;
+    for (long long i = begin; i < end; i++) {
+        if (!kept[i - begin]) {
+            dropped = true;
+            continue;
+        }
+        auto &in = instructions[i];
+        bool useless;
+        switch (in->opcode) {
+            case NOP:
+                useless = true;
+                break;
+            case UNARY_OP:
+                useless = static_pointer_cast<UnaryOperation>(in)->unary_opcode == UNARY_POSITIVE;
+                break;
+            case JUMP_ABSOLUTE:
+                useless = target(in) == i + 1;
+                break;
+            case POP_JUMP_IF_FALSE:
+            case POP_JUMP_IF_TRUE:
+                // over a JUMP_ABSOLUTE not jumped to, as `if (...) break;` makes, it branches there the other way
+                if (target(in) == i + 2 && instructions[i + 1]->opcode == JUMP_ABSOLUTE && !targeted[i + 1 - begin] &&
+                    target(instructions[i + 1]) != i + 1) {
+                    long long to = target(instructions[i + 1]);
+                    if (in->opcode == POP_JUMP_IF_FALSE) {
+                        in = make_shared<PopJumpIfTrue>(to);
+                    } else {
+                        in = make_shared<PopJumpIfFalse>(to);
+                    }
+                    kept[i + 1 - begin] = false;
+                    dropped = true;
+                }
+                useless = false;
+                break;
+            case STORE_NAME:
+            case STORE_LOCAL:
+                // the load goes unless it is jumped to, when the value is not on the stack
+                if (i + 1 < end && !targeted[i + 1 - begin] && reloads(in, instructions[i + 1])) {
+                    if (in->opcode == STORE_NAME) {
+                        static_pointer_cast<StoreName>(in)->keep = true;
+                    } else {
+                        static_pointer_cast<StoreLocal>(in)->keep = true;
+                    }
+                    kept[i + 1 - begin] = false;
+                    dropped = true;
+                }
+                useless = false;
+                break;
+            default:
+                useless = false;
+        }
+        if (useless) {  // what jumps to it goes on to what follows
+            kept[i - begin] = false;
+            dropped = true;
+        }
+    }
+    if (!dropped) {
+        return false;
+    }
+
+    vector<long long> moved_to((size_t) (end - begin + 1));  // a dropped offset moves to what is kept after it
+    long long to = begin;
+    for (long long i = begin; i < end; i++) {
+        moved_to[i - begin] = to;
+        if (kept[i - begin]) {
+            if (to != i) {
+                instructions[to] = move(instructions[i]);
+            }
+            to++;
+        }
+    }
+    moved_to[end - begin] = to;
+    for (long long i = begin; i < to; i++) {
+        if (is_jump(instructions[i])) {
+            static_pointer_cast<JumpInstruction>(instructions[i])->set_offset(moved_to[target(instructions[i]) - begin]);
+        }
+    }
+    instructions.resize((size_t) to);
+    end = to;
+    return true;
+}
@@ -0,0 +1,39 @@
+//
+// Created by Kevin Tan on 2022/3/27.
+//
+
+#ifndef CODE_PEEPHOLE_H
+#define CODE_PEEPHOLE_H
+
+#include "instruction.h"
+
+// Cleans up the code of a function just generated at the end of `instructions`, where its jumps are absolute:
+//   a jump to a JUMP_ABSOLUTE goes where that one does, and a JUMP_ABSOLUTE to the next instruction is dropped
+//   a conditional jump over a JUMP_ABSOLUTE becomes the opposite one to where that one goes
+//   what cannot be reached from the start of the function is dropped
+//   STORE_NAME x; LOAD_NAME x (and STORE_LOCAL x; LOAD_LOCAL x) becomes a store that keeps the value on the stack
+//   UNARY_OP + and NOP are dropped
+// The code only shrinks, and still starts at `begin`, where `FuncObject::code_offset` has it.
+class PeepholeOptimizer {
+    vector<InstructionP> &instructions;
+    long long begin, end;
+    vector<bool> kept, targeted;  // by offset from `begin`
+
+    bool jumps_within() const;
+
+    bool thread_jumps();
+
+    void mark_reachable();
+
+    bool compact();
+
+public:
+    static bool enabled;  // off to compare with the code as generated
+
+    PeepholeOptimizer(vector<InstructionP> &instructions, long long begin) :
+            instructions(instructions), begin(begin), end((long long) instructions.size()) {}
+
+    void run();
+};
+
+#endif //CODE_PEEPHOLE_H
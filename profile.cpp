@@ -0,0 +1,54 @@
+//
+// Created by Kevin Tan on 2022/3/28.
+//
+
+#include <algorithm>
+#include "profile.h"
+
+void OpcodeProfile::add(const Bytecode &bytecode, const vector<long long> &dispatched) {
+    auto &code = bytecode.code;
+    for (size_t i = 0; i < code.size() && i < dispatched.size(); i++) {
+        dispatches += dispatched[i];
+        if (dispatched[i] == 0) {
+            continue;
+        }
+        OpcodeGram gram;
+        for (size_t j = i; j < code.size() && gram.size() < MAX_LENGTH; j++) {
+            if (code[j].opcode > NOP || !Bytecode::can_fuse((OpCode) code[j].opcode, true)) {
+                break;
+            }
+            gram.push_back((OpCode) code[j].opcode);
+            if (gram.size() > 1) {
+                counts[gram] += dispatched[i];
+            }
+            if (!Bytecode::can_fuse((OpCode) code[j].opcode, false)) {
+                break;  // it jumps, so what follows does not always run after it
+            }
+        }
+    }
+}
+
+vector<pair<OpcodeGram, long long>> OpcodeProfile::top(size_t length, size_t cnt) const {
+    vector<pair<OpcodeGram, long long>> result;
+    for (auto &c: counts) {
+        if (c.first.size() == length) {
+            result.push_back(c);
+        }
+    }
+    sort(result.begin(), result.end(), [](const pair<OpcodeGram, long long> &a, const pair<OpcodeGram, long long> &b) {
+        return a.second > b.second;
+    });
+    if (result.size() > cnt) {
+        result.resize(cnt);
+    }
+    return result;
+}
+
+string OpcodeProfile::name(const OpcodeGram &gram) {
+    string result;
+    for (OpCode opcode: gram) {
+        result += result.empty() ? "" : ", ";
+        result += Disassembler::mnemonic(opcode);
+    }
+    return result;
+}
@@ -0,0 +1,30 @@
+//
+// Created by Kevin Tan on 2022/3/28.
+//
+
+#ifndef CODE_PROFILE_H
+#define CODE_PROFILE_H
+
+#include <map>
+#include "bytecode.h"
+
+using OpcodeGram = vector<OpCode>;
+
+// How often each sequence of instructions a superinstruction could run was run, mined from runs of code
+// assembled without superinstructions. A sequence that only jumps at its end runs whenever its first
+// instruction does, so the dispatches counted at each offset give them all without tracing the runs.
+class OpcodeProfile {
+public:
+    static constexpr size_t MAX_LENGTH = 4;
+
+    map<OpcodeGram, long long> counts;
+    long long dispatches = 0;  // in all the runs
+
+    void add(const Bytecode &bytecode, const vector<long long> &dispatched);  // as `StackMachine::run` counted
+
+    vector<pair<OpcodeGram, long long>> top(size_t length, size_t cnt) const;  // the most run first
+
+    static string name(const OpcodeGram &gram);  // as a superinstruction would be written
+};
+
+#endif //CODE_PROFILE_H
@@ -0,0 +1,257 @@
+//
+// Created by Kevin Tan on 2022/3/13.
+//
+
+#include <cstdint>
+#include "scan.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86_FP) && _M_IX86_FP >= 2
+#define SCAN_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+    enum ScanKind {
+        WHITESPACE,
+        LINE,
+        COMMENT,
+        FORMAT
+    };
+
+    // newlines can only be passed over by these, the others stop at them
+    constexpr bool counts_lines(ScanKind kind) { return kind == WHITESPACE || kind == COMMENT; }
+
+    template<ScanKind kind>
+    inline bool stops_at(char c) {
+        switch (kind) {
+            case WHITESPACE:
+                return !(c == ' ' || ('\t' <= c && c <= '\r'));
+            case LINE:
+                return c == '\n' || c == '\0';
+            case COMMENT:
+                return c == '*' || c == '\0';
+            case FORMAT:
+                return !(c == ' ' || c == '!' || ('(' <= c && c <= '~' && c != '\\'));
+        }
+        return true;
+    }
+
+    template<ScanKind kind>
+    const char *scan_scalar(const char *p, int &line) {
+        for (; !stops_at<kind>(*p); p++) {
+            if (counts_lines(kind) && *p == '\n') {
+                line++;
+            }
+        }
+        return p;
+    }
+
+#ifdef SCAN_X86
+    inline unsigned count_trailing_zeros(unsigned mask) {  // mask != 0
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return (unsigned) __builtin_ctz(mask);
+#endif
+    }
+
+    inline int popcount(unsigned mask) {
+#ifdef _MSC_VER
+        mask = mask - ((mask >> 1) & 0x55555555);
+        mask = (mask & 0x33333333) + ((mask >> 2) & 0x33333333);
+        return (int) ((((mask + (mask >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+#else
+        return __builtin_popcount(mask);
+#endif
+    }
+
+    // Scans the unaligned head one character at a time and returns true if it stopped there.
+    template<ScanKind kind, uintptr_t alignment>
+    inline bool scan_head(const char *&p, int &line) {
+        for (; ((uintptr_t) p & (alignment - 1)) != 0; p++) {
+            if (stops_at<kind>(*p)) {
+                return true;
+            } else if (counts_lines(kind) && *p == '\n') {
+                line++;
+            }
+        }
+        return false;
+    }
+
+    template<ScanKind kind>
+    inline __m128i stop_mask_sse2(__m128i x) {
+        switch (kind) {
+            case WHITESPACE: {  // ' ' or '\t' .. '\r'
+                __m128i offset = _mm_sub_epi8(x, _mm_set1_epi8('\t'));
+                __m128i is_space = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                                                _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(4)), offset));
+                return _mm_xor_si128(is_space, _mm_set1_epi8(-1));
+            }
+            case LINE:
+                return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(x, _mm_setzero_si128()));
+            case COMMENT:
+                return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('*')), _mm_cmpeq_epi8(x, _mm_setzero_si128()));
+            case FORMAT: {  // ' ', '!' or '(' .. '~' except '\\', non-ASCII bytes are negative
+                __m128i in_range = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('(' - 1)),
+                                                 _mm_cmplt_epi8(x, _mm_set1_epi8('~' + 1)));
+                __m128i allowed = _mm_or_si128(_mm_andnot_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\\')), in_range),
+                                               _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                                                            _mm_cmpeq_epi8(x, _mm_set1_epi8('!'))));
+                return _mm_xor_si128(allowed, _mm_set1_epi8(-1));
+            }
+        }
+        return _mm_set1_epi8(-1);
+    }
+
+    template<ScanKind kind>
+    const char *scan_sse2(const char *p, int &line) {
+        if (scan_head<kind, 16>(p, line)) {
+            return p;
+        }
+        for (;; p += 16) {
+            __m128i x = _mm_load_si128((const __m128i *) p);
+            auto stop = (unsigned) _mm_movemask_epi8(stop_mask_sse2<kind>(x));
+            unsigned newlines = 0;
+            if (counts_lines(kind)) {
+                newlines = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')));
+            }
+            if (stop != 0) {
+                unsigned index = count_trailing_zeros(stop);
+                line += popcount(newlines & ((1u << index) - 1));
+                return p + index;
+            }
+            line += popcount(newlines);
+        }
+    }
+
+    template<ScanKind kind>
+    TARGET_AVX2 inline __m256i stop_mask_avx2(__m256i x) {
+        switch (kind) {
+            case WHITESPACE: {
+                __m256i offset = _mm256_sub_epi8(x, _mm256_set1_epi8('\t'));
+                __m256i is_space = _mm256_or_si256(
+                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                        _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(4)), offset));
+                return _mm256_xor_si256(is_space, _mm256_set1_epi8(-1));
+            }
+            case LINE:
+                return _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')),
+                                       _mm256_cmpeq_epi8(x, _mm256_setzero_si256()));
+            case COMMENT:
+                return _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('*')),
+                                       _mm256_cmpeq_epi8(x, _mm256_setzero_si256()));
+            case FORMAT: {
+                __m256i in_range = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('(' - 1)),
+                                                    _mm256_cmpgt_epi8(_mm256_set1_epi8('~' + 1), x));
+                __m256i allowed = _mm256_or_si256(
+                        _mm256_andnot_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\')), in_range),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('!'))));
+                return _mm256_xor_si256(allowed, _mm256_set1_epi8(-1));
+            }
+        }
+        return _mm256_set1_epi8(-1);
+    }
+
+    template<ScanKind kind>
+    TARGET_AVX2 const char *scan_avx2(const char *p, int &line) {
+        if (scan_head<kind, 32>(p, line)) {
+            return p;
+        }
+        for (;; p += 32) {
+            __m256i x = _mm256_load_si256((const __m256i *) p);
+            auto stop = (unsigned) _mm256_movemask_epi8(stop_mask_avx2<kind>(x));
+            unsigned newlines = 0;
+            if (counts_lines(kind)) {
+                newlines = (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')));
+            }
+            if (stop != 0) {
+                unsigned index = count_trailing_zeros(stop);
+                line += popcount(newlines & ((1u << index) - 1));  // index < 32
+                return p + index;
+            }
+            line += popcount(newlines);
+        }
+    }
+
+    bool cpu_has_avx2() {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;  // OSXSAVE, then XMM and YMM state
+        __cpuid(info, 0);
+        if (!os_saves_ymm || info[0] < 7) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+
+    using Scanner = const char *(*)(const char *, int &);
+
+    struct Kernels {
+        const char *isa;
+        Scanner whitespace, line, comment, format;
+    };
+
+    const Kernels SCALAR_KERNELS = {"scalar", scan_scalar<WHITESPACE>, scan_scalar<LINE>,
+                                    scan_scalar<COMMENT>, scan_scalar<FORMAT>};
+#ifdef SCAN_X86
+    const Kernels SSE2_KERNELS = {"sse2", scan_sse2<WHITESPACE>, scan_sse2<LINE>,
+                                  scan_sse2<COMMENT>, scan_sse2<FORMAT>};
+    const Kernels AVX2_KERNELS = {"avx2", scan_avx2<WHITESPACE>, scan_avx2<LINE>,
+                                  scan_avx2<COMMENT>, scan_avx2<FORMAT>};
+
+    Kernels kernels = cpu_has_avx2() ? AVX2_KERNELS : SSE2_KERNELS;
+#else
+    Kernels kernels = SCALAR_KERNELS;
+#endif
+}
+
+namespace scan {
+    const char *skip_whitespace(const char *p, int &line) { return kernels.whitespace(p, line); }
+
+    const char *skip_line(const char *p) {
+        int unused = 0;
+        return kernels.line(p, unused);
+    }
+
+    const char *skip_comment(const char *p, int &line) { return kernels.comment(p, line); }
+
+    const char *skip_format_chars(const char *p) {
+        int unused = 0;
+        return kernels.format(p, unused);
+    }
+
+    const char *isa() { return kernels.isa; }
+
+    bool use_isa(const std::string &name) {
+        if (name == SCALAR_KERNELS.isa) {
+            kernels = SCALAR_KERNELS;
+            return true;
+        }
+#ifdef SCAN_X86
+        if (name == SSE2_KERNELS.isa) {
+            kernels = SSE2_KERNELS;
+            return true;
+        } else if (name == AVX2_KERNELS.isa && cpu_has_avx2()) {
+            kernels = AVX2_KERNELS;
+            return true;
+        }
+#endif
+        return false;
+    }
+}
@@ -0,0 +1,32 @@
+//
+// Created by Kevin Tan on 2022/3/13.
+//
+
+#ifndef CODE_SCAN_H
+#define CODE_SCAN_H
+
+#include <string>
+
+// Bulk scanners for the tokenizer's hot loops, vectorized with SSE2 or AVX2 when the CPU has them.
+// Each one returns the first character at or after `p` that it stops at, never going past the terminating '\0',
+// and the ones that may cross newlines add them to `line`.
+// The vector loops read whole aligned blocks, so the block holding the terminating '\0' may reach up to
+// `PADDING - 1` bytes past it: a buffer handed to them must have room for `PADDING` bytes from the '\0' on.
+namespace scan {
+    constexpr long long PADDING = 32;
+
+    const char *skip_whitespace(const char *p, int &line);  // stops at the first non-whitespace character
+
+    const char *skip_line(const char *p);  // stops at '\n'
+
+    const char *skip_comment(const char *p, int &line);  // stops at '*'
+
+    // stops at the first character that is not allowed as-is in a format string, including '"', '%' and '\\'
+    const char *skip_format_chars(const char *p);
+
+    const char *isa();  // "avx2", "sse2" or "scalar"
+
+    bool use_isa(const std::string &name);  // returns false if the CPU does not support it
+}
+
+#endif //CODE_SCAN_H
@@ -0,0 +1,322 @@
+//
+// Created by Kevin Tan on 2022/3/18.
+//
+
+#include <algorithm>
+#include "session.h"
+
+static bool same_signature(const SessionItem &a, const SessionItem &b) {
+    // whether other items see the same of them, only functions can be swapped without recompiling those
+    if (a.kind != b.kind || a.kind == ItemKind::DECL || a.declared.size() != b.declared.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.declared.size(); i++) {
+        if (a.declared[i].first != b.declared[i].first) {
+            return false;
+        }
+    }
+    if (a.kind != ItemKind::FUNC) {
+        return true;
+    }
+    auto &f = a.func, &g = b.func;
+    if (f->return_type != g->return_type || f->params.size() != g->params.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < f->params.size(); i++) {
+        auto &p = f->params[i], &q = g->params[i];
+        if (p->type != q->type ||
+            (p->type == TypeCode::INT_ARRAY && cast<ArrayObject>(p)->dims != cast<ArrayObject>(q)->dims)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void adopt(const FuncObjectP &func, SessionItem &item, SymbolTable &globals) {
+    // gives the recompiled `item` the `FuncObject` other items call
+    auto &fresh = item.func;
+    func->params = fresh->params;
+    func->slot_cnt = fresh->slot_cnt;
+    func->locals = fresh->locals;
+    func->ident_info = fresh->ident_info;
+    for (auto &i: item.code) {
+        if (i->opcode == CALL_FUNCTION && cast<CallFunction>(i)->get_func() == fresh) {  // recursion
+            cast<CallFunction>(i)->set_func(func);
+        }
+    }
+    for (auto &d: item.declared) {
+        if (d.second == fresh) {
+            d.second = func;
+            globals.rebind(d.first, func);
+        }
+    }
+    fresh = func;
+}
+
+bool Session::pull(TokenStream &tokens) {
+    // lexes up to the next old item start, where the tokens may line up with the old ones again
+    const char *data = text->c_str();
+    for (long long size = tokens.size(); tokens.size() == size;) {
+        if (*chunk.stop == '\0') {
+            return false;
+        }
+        while (next_boundary < items.size() && data + items[next_boundary].begin + shift <= chunk.stop) {
+            next_boundary++;
+        }
+        chunk.begin = chunk.stop;
+        chunk.end = next_boundary < items.size() ? data + items[next_boundary].begin + shift : data + text->size();
+        Tokenizer::lex(chunk, tokens, SymbolPool::global());
+    }
+    return true;
+}
+
+HashMap Session::scope(size_t end) const {
+    HashMap result;
+    size_t cnt = 0;
+    for (size_t i = 0; i < end; i++) {
+        cnt += items[i].declared.size();
+    }
+    result.reserve(cnt);
+    for (size_t i = 0; i < end; i++) {
+        for (auto &d: items[i].declared) {
+            result.emplace(d.first, d.second);  // a redefinition is not declared
+        }
+    }
+    return result;
+}
+
+vector<ObjectP> Session::globals() const {
+    vector<ObjectP> result;
+    for (auto &item: items) {
+        for (auto &d: item.declared) {
+            ObjectP o = d.second;
+            if (o->slot < 0) {
+                continue;
+            }
+            if ((size_t) o->slot >= result.size()) {
+                result.resize((size_t) o->slot + 1);
+            }
+            result[o->slot] = o->type == TypeCode::INT_ARRAY ? cast<ArrayObject>(o)->clone() : o->copy();
+        }
+    }
+    return result;
+}
+
+bool Session::compile(const string &source) {
+    reparsed = 0;
+    relexed = 0;
+    auto old_text = text;
+    if (old_text != nullptr && old_text->size() == source.size() &&
+        memcmp(old_text->c_str(), source.c_str(), source.size()) == 0) {
+        return false;
+    }
+    text = make_shared<const string>(padded(source));
+    const char *data = text->c_str();
+    auto new_size = (long long) text->size();
+
+    // the edit is what lies between the common prefix and suffix of the two versions
+    long long old_size = 0, prefix = 0, suffix = 0;
+    int line_shift = 0;
+    if (old_text != nullptr) {
+        old_size = (long long) old_text->size();
+        long long limit = min(old_size, new_size);
+        const char *old_data = old_text->c_str();
+        for (; prefix + DIFF_BLOCK <= limit && memcmp(old_data + prefix, data + prefix, DIFF_BLOCK) == 0;
+               prefix += DIFF_BLOCK);
+        for (; prefix < limit && old_data[prefix] == data[prefix]; prefix++);
+        const char *old_end = old_data + old_size, *new_end = data + new_size;
+        for (; suffix + DIFF_BLOCK <= limit - prefix &&
+               memcmp(old_end - suffix - DIFF_BLOCK, new_end - suffix - DIFF_BLOCK, DIFF_BLOCK) == 0;
+               suffix += DIFF_BLOCK);
+        for (; suffix < limit - prefix && old_end[-suffix - 1] == new_end[-suffix - 1]; suffix++);
+        line_shift = (int) (count(data + prefix, data + new_size - suffix, '\n') -
+                            count(old_data + prefix, old_end - suffix, '\n'));
+    }
+    shift = new_size - old_size;
+
+    // the first item to re-lex holds the character before the edit, which a new token may continue
+    size_t first = 0;
+    if (!items.empty()) {
+        first = upper_bound(items.begin(), items.end(), max(prefix - 1, 0LL),
+                            [](long long offset, const SessionItem &item) { return offset < item.begin; }) -
+                items.begin() - 1;
+    }
+    long long begin = first < items.size() ? items[first].begin : 0, damage_end = old_size - suffix;
+    next_boundary = lower_bound(items.begin() + (long) min(first + 1, items.size()), items.end(), damage_end,
+                                [](const SessionItem &item, long long offset) { return item.begin < offset; }) -
+                    items.begin();
+    int begin_line = first < items.size() ? items[first].line : 1;
+    chunk.stop = data + begin;
+    chunk.line = begin_line;
+    chunk.token_starts = &token_starts;
+    chunk.error_lines.clear();
+    chunk.error_tokens.clear();
+    token_starts.clear();
+
+    TokenStream tokens;
+    tokens.source = this;
+    Error item_error;
+    Parser parser(tokens, item_error, scope(first));
+    vector<SessionItem> fresh;
+    size_t reused = items.size();  // old items from here on are kept
+    bool recompile_rest = false;
+    ItemKind last = first == 0 ? ItemKind::DECL : items[first - 1].kind;
+    size_t error_index = 0;
+    for (auto tk = tokens.begin(); tk < tokens.end();) {
+        SessionItem item;
+        item.text = text;
+        if (fresh.empty()) {
+            item.begin = begin;
+            item.line = begin_line;
+        } else {
+            item.begin = token_starts[tk.position()] - data;
+            item.line = tk->line;
+        }
+        item.kind = last = parser.parse_item(tk, last);
+        if (item.kind == ItemKind::TAIL) {
+            tokens.skip_rest();
+        }
+        item.code.swap(parser.instructions);
+        item.func = parser.item_func;
+        item.declared.swap(parser.global_decls);
+        item.identifiers.swap(parser.identifiers);
+        for (auto &i: item.code) {
+            if (i->opcode == JUMP_ABSOLUTE || i->opcode == POP_JUMP_IF_FALSE || i->opcode == POP_JUMP_IF_TRUE) {
+                item.jumps.push_back(cast<JumpInstruction>(i));
+            }
+        }
+        for (; !item_error.errors.empty(); item_error.errors.pop()) {
+            item.errors.push_back(item_error.errors.top());
+        }
+        long long end = item.kind == ItemKind::TAIL ? LLONG_MAX : tk.position();
+        for (; error_index < chunk.error_tokens.size() && chunk.error_tokens[error_index] < end; error_index++) {
+            item.errors.emplace_back(chunk.error_lines[error_index], 'a' + (char) ErrorCode::ILLEGAL_CHAR);
+        }
+
+        size_t old = first + fresh.size();  // the old item this one takes the place of, if any
+        if (!recompile_rest && (old >= items.size() || !same_signature(item, items[old]))) {
+            recompile_rest = true;
+        }
+        if (!recompile_rest && item.kind == ItemKind::FUNC) {
+            adopt(items[old].func, item, parser.sym_table);
+        }
+        fresh.push_back(move(item));
+        if (last == ItemKind::TAIL) {
+            break;  // the rest was lexed for its errors and its tokens dropped, `tk` is not moved past them
+        }
+        if (!recompile_rest && last == ItemKind::FUNC && old + 1 < items.size() &&
+            items[old + 1].begin >= damage_end && tk.position() == tokens.size() &&
+            chunk.stop == data + items[old + 1].begin + shift) {
+            reused = old + 1;  // lined up again
+            break;
+        }
+    }
+    relexed = chunk.stop - (data + begin);
+    reparsed = fresh.size();
+
+    for (size_t i = reused; i < items.size(); i++) {
+        auto &item = items[i];
+        item.begin += shift;
+        item.line += line_shift;
+        if (line_shift != 0) {
+            for (auto &ident: item.identifiers) {
+                ident->line += line_shift;
+            }
+            for (auto &e: item.errors) {
+                e.first += line_shift;
+            }
+        }
+    }
+    if (recompile_rest || fresh.size() != reused - first) {
+        items.erase(items.begin() + (long) first, items.end());
+        move(fresh.begin(), fresh.end(), back_inserter(items));
+        link();
+    } else {
+        splice(first, fresh);
+    }
+    error = Error();
+    for (auto &item: items) {
+        for (auto &e: item.errors) {
+            error.errors.push(e);
+        }
+    }
+    return true;
+}
+
+void Session::move_code(SessionItem &item, long long base) {
+    if (item.base != base) {
+        for (auto &j: item.jumps) {
+            if (j->get_offset() >= 0) {
+                j->set_offset(j->get_offset() + base - item.base);
+            }
+        }
+        item.base = base;
+    }
+    if (item.func != nullptr) {
+        item.func->code_offset = base;
+    }
+}
+
+void Session::link() {
+    // lays the items out like `Parser::parse_comp_unit` does
+    instructions.clear();
+    if (items.empty()) {
+        return;
+    }
+    auto place = [this](SessionItem &item) {
+        move_code(item, (long long) instructions.size());
+        instructions.insert(instructions.end(), item.code.begin(), item.code.end());
+    };
+    entry = make_shared<CallFunction>();
+    for (auto &item: items) {
+        if (item.kind == ItemKind::DECL) {
+            place(item);
+        } else if (item.kind == ItemKind::MAIN) {
+            entry->set_func(item.func);
+        }
+    }
+    instructions.push_back(entry);
+    instructions.push_back(make_shared<Exit>());
+    for (auto &item: items) {
+        if (item.kind == ItemKind::FUNC || item.kind == ItemKind::MAIN) {
+            place(item);
+        }
+    }
+}
+
+void Session::splice(size_t first, vector<SessionItem> &fresh) {
+    // swaps in the code of `fresh`, which replace as many items of the same kinds, and moves the code after it
+    long long begin = -1, old_size = 0;
+    vector<InstructionP> code;
+    for (size_t i = 0; i < fresh.size(); i++) {
+        auto &old = items[first + i], &item = fresh[i];
+        if (old.kind == ItemKind::FUNC || old.kind == ItemKind::MAIN) {
+            if (begin < 0) {
+                begin = old.base;
+            }
+            old_size += (long long) old.code.size();
+            move_code(item, begin + (long long) code.size());
+            code.insert(code.end(), item.code.begin(), item.code.end());
+        }
+        if (item.kind == ItemKind::MAIN) {
+            entry->set_func(item.func);
+        }
+        old = move(item);
+    }
+    if (begin < 0) {
+        return;
+    }
+    auto at = instructions.begin() + begin;
+    if ((long long) code.size() == old_size) {
+        copy(code.begin(), code.end(), at);
+        return;
+    }
+    at = instructions.erase(at, at + old_size);
+    instructions.insert(at, code.begin(), code.end());
+    long long moved = (long long) code.size() - old_size;
+    for (size_t i = first + fresh.size(); i < items.size(); i++) {
+        if (items[i].kind == ItemKind::FUNC || items[i].kind == ItemKind::MAIN) {
+            move_code(items[i], items[i].base + moved);
+        }
+    }
+}
@@ -0,0 +1,64 @@
+//
+// Created by Kevin Tan on 2022/3/18.
+//
+
+#ifndef CODE_SESSION_H
+#define CODE_SESSION_H
+
+#include "tokenizer.h"
+#include "parser.h"
+
+struct SessionItem {  // a top-level item, compiled on its own
+    ItemKind kind = ItemKind::TAIL;
+    long long begin = 0;  // where its first token starts, the first item starts at 0 so that items cover the source
+    int line = 1;  // at `begin`
+    shared_ptr<const string> text;  // the source it was lexed from, its format strings refer to it
+    vector<InstructionP> code;  // jumps in it are absolute as if it started at `base`
+    long long base = 0;
+    vector<JumpInstructionP> jumps;
+    FuncObjectP func;  // of a FUNC or MAIN
+    vector<pair<SymbolId, ObjectP>> declared;  // into the global scope
+    vector<IdentP> identifiers;  // moved with the item when lines are added or removed before it
+    vector<Pair> errors;
+};
+
+// Keeps a compiled source for an edit-compile-run loop. After an edit, the source is re-lexed from the item
+// the edit starts in until its tokens line up with the old ones again, only the items in between are parsed,
+// and their code is linked with that of the others.
+// A function whose signature stays the same keeps its `FuncObject`, so calls from other items still hold;
+// when a declaration or a signature changes, every item after it is compiled again.
+class Session : public TokenSource {
+    static constexpr long long DIFF_BLOCK = 1 << 12;
+
+    shared_ptr<const string> text;
+    vector<SessionItem> items;
+    shared_ptr<CallFunction> entry;  // calls main
+
+    // lexing state of `compile`
+    Chunk chunk;
+    vector<const char *> token_starts;
+    size_t next_boundary = 0;  // the next old item whose start the new tokens may line up at
+    long long shift = 0;  // from old to new offsets after the edit
+
+    bool pull(TokenStream &tokens) override;
+
+    HashMap scope(size_t end) const;  // what the items before `end` declare
+
+    static void move_code(SessionItem &item, long long base);
+
+    void link();
+
+    void splice(size_t first, vector<SessionItem> &fresh);
+
+public:
+    vector<InstructionP> instructions;
+    Error error;
+    size_t reparsed = 0;  // items parsed by the last `compile`
+    long long relexed = 0;  // bytes lexed by the last `compile`
+
+    bool compile(const string &source);  // the first call compiles everything, returns false if nothing changed
+
+    vector<ObjectP> globals() const;  // a fresh data segment for each run of `instructions`
+};
+
+#endif //CODE_SESSION_H
@@ -0,0 +1,106 @@
+//
+// Created by Kevin Tan on 2022/3/12.
+//
+
+#include "source.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+SourceFile::SourceFile(const string &filename, bool use_mmap) {
+    if (!use_mmap || !map(filename)) {
+        read(filename);
+    }
+}
+
+SourceFile::~SourceFile() {
+    if (!mapped) {
+        delete[] buffer;
+    } else {
+#ifdef _WIN32
+        UnmapViewOfFile(buffer);
+#else
+        munmap((void *) buffer, (size_t) size + 1);
+#endif
+    }
+}
+
+string padded(const string &text) {
+    string result;
+    result.reserve(text.size() + scan::PADDING);
+    result.append(text).append(scan::PADDING, '\0');
+    result.resize(text.size());  // shrinking keeps the buffer, and with it the zeros
+    return result;
+}
+
+void SourceFile::read(const string &filename) {
+    ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        perror(("Failed to open source code file " + filename).c_str());
+        exit(EXIT_FAILURE);
+    }
+    file.seekg(0, ifstream::end);
+    size = file.tellg();
+    file.seekg(ifstream::beg);
+
+    char *data = new char[size + scan::PADDING];
+    memset(data + size, 0, scan::PADDING);
+    file.read(data, size);
+    buffer = data;
+}
+
+bool SourceFile::map(const string &filename) {
+    // The tokenizer relies on a terminating '\0'. The kernel zero-fills the tail of the last page,
+    // so a mapping is only used when the file does not end exactly on a page boundary.
+    // The aligned block holding the '\0' then lies in that page too, so it serves as the padding.
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart % info.dwPageSize == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr) {
+        return false;
+    }
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);  // the view keeps the mapping alive
+    if (view == nullptr) {
+        return false;
+    }
+    size = file_size.QuadPart;
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size % sysconf(_SC_PAGESIZE) == 0) {
+        close(fd);
+        return false;
+    }
+    void *view = mmap(nullptr, (size_t) st.st_size + 1, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // the mapping keeps the file alive
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    size = st.st_size;
+#endif
+    buffer = (const char *) view;
+    mapped = true;
+    return true;
+}
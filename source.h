@@ -0,0 +1,84 @@
+//
+// Created by Kevin Tan on 2022/3/12.
+//
+
+#ifndef CODE_SOURCE_H
+#define CODE_SOURCE_H
+
+#include <cstring>
+#include <functional>
+#include "element.h"
+#include "scan.h"
+
+// A non-owning view of characters in a `SourceFile` (or any buffer that outlives it).
+struct StringRef {
+    const char *data = nullptr;
+    long long length = 0;
+
+    StringRef() = default;
+
+    StringRef(const char *data, long long length) : data(data), length(length) {}
+
+    StringRef(const char *literal) : data(literal), length((long long) strlen(literal)) {}  // NOLINT
+
+    inline string str() const { return {data, (size_t) length}; }
+
+    inline char operator[](long long i) const { return data[i]; }
+
+    inline bool operator==(const StringRef &other) const {
+        return length == other.length && memcmp(data, other.data, length) == 0;
+    }
+
+    inline bool operator!=(const StringRef &other) const { return !(*this == other); }
+
+    friend ostream &operator<<(ostream &out, const StringRef &self) {
+        out.write(self.data, self.length);
+        return out;
+    }
+};
+
+namespace std {
+    template<>
+    struct hash<StringRef> {
+        size_t operator()(const StringRef &s) const {  // FNV-1a
+            size_t h = 14695981039346656037ULL;
+            for (long long i = 0; i < s.length; i++) {
+                h = (h ^ (unsigned char) s.data[i]) * 1099511628211ULL;
+            }
+            return h;
+        }
+    };
+}
+
+// Copies `text` into a string with `scan::PADDING` zero bytes reserved past its end, which the tokenizer may read.
+// They are spare capacity, so the size is that of `text`, and a copy of the result is not padded: move it instead.
+string padded(const string &text);
+
+// The whole text of a source file, NUL-terminated and padded for the tokenizer. Tokens keep `StringRef`s into it, so it must outlive them.
+// When mapped, the file is not copied into memory at all.
+class SourceFile {
+    const char *buffer = nullptr;
+    long long size = 0;
+    bool mapped = false;
+
+    bool map(const string &filename);
+
+    void read(const string &filename);
+
+public:
+    explicit SourceFile(const string &filename, bool use_mmap = false);
+
+    SourceFile(const SourceFile &) = delete;
+
+    SourceFile &operator=(const SourceFile &) = delete;
+
+    ~SourceFile();
+
+    inline const char *data() const { return buffer; }
+
+    inline long long length() const { return size; }
+
+    inline bool is_mapped() const { return mapped; }
+};
+
+#endif //CODE_SOURCE_H
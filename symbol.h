@@ -0,0 +1,66 @@
+//
+// Created by Kevin Tan on 2022/3/13.
+//
+
+#ifndef CODE_SYMBOL_H
+#define CODE_SYMBOL_H
+
+#include <memory>
+#include "source.h"
+
+using SymbolId = int;
+
+// Every distinct identifier spelling is interned once, during lexing, and gets a dense id.
+// Later phases hash and compare these ids instead of the characters.
+class SymbolPool {
+    static constexpr long long BLOCK_SIZE = 1 << 16;
+
+    unordered_map<StringRef, SymbolId> ids;
+    vector<StringRef> names;  // indexed by `SymbolId`
+    vector<std::unique_ptr<char[]>> blocks;  // owns the spellings, so they outlive any `SourceFile`
+    char *next = nullptr;
+    long long left = 0;
+
+    StringRef save(StringRef name) {
+        if (name.length > left) {
+            left = name.length > BLOCK_SIZE ? name.length : BLOCK_SIZE;
+            blocks.emplace_back(new char[left]);
+            next = blocks.back().get();
+        }
+        memcpy(next, name.data, name.length);
+        StringRef saved(next, name.length);
+        next += name.length;
+        left -= name.length;
+        return saved;
+    }
+
+public:
+    SymbolPool() = default;
+
+    SymbolPool(const SymbolPool &) = delete;
+
+    SymbolPool &operator=(const SymbolPool &) = delete;
+
+    static inline SymbolPool &global() {
+        static SymbolPool pool;
+        return pool;
+    }
+
+    inline SymbolId intern(StringRef name) {
+        auto it = ids.find(name);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        StringRef saved = save(name);
+        auto id = (SymbolId) names.size();
+        names.push_back(saved);
+        ids.emplace(saved, id);
+        return id;
+    }
+
+    inline StringRef name(SymbolId id) const { return names[id]; }
+
+    inline long long size() const { return (long long) names.size(); }
+};
+
+#endif //CODE_SYMBOL_H
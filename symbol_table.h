@@ -0,0 +1,74 @@
+//
+// Created by Kevin Tan on 2022/3/19.
+//
+
+#ifndef CODE_SYMBOL_TABLE_H
+#define CODE_SYMBOL_TABLE_H
+
+#include "object.h"
+#include "symbol.h"
+
+using HashMap = unordered_map<SymbolId, ObjectP>;
+
+// Nested scopes in one table: each name leads straight to its innermost binding, which links to the one it shadows.
+// Entering a scope is O(1), and leaving it undoes only the bindings made in it.
+class SymbolTable {
+    struct Binding {
+        SymbolId name;
+        ObjectP object;
+        int shadowed;  // index of the binding it hides, -1 if none
+    };
+
+    vector<int> innermost;  // by `SymbolId`, index into `bindings`, -1 if none
+    vector<Binding> bindings;  // a stack, in declaration order
+    vector<int> scopes;  // where the bindings of each scope start
+    int hidden_begin = 0, hidden_end = 0;  // bindings not found
+
+    inline int lookup(SymbolId name) const {
+        int i = (size_t) name < innermost.size() ? innermost[name] : -1;
+        return i < hidden_begin || i >= hidden_end ? i : -1;
+    }
+
+public:
+    inline int depth() const { return (int) scopes.size(); }  // 1 in the global scope
+
+    inline int size() const { return (int) bindings.size(); }
+
+    // hides the bindings from `begin` to `end`, as if they were not made yet, they must not shadow any
+    inline void hide(int begin, int end) {
+        hidden_begin = begin;
+        hidden_end = end;
+    }
+
+    inline void enter() { scopes.push_back((int) bindings.size()); }
+
+    void leave() {
+        for (auto start = (size_t) scopes.back(); bindings.size() > start; bindings.pop_back()) {
+            innermost[bindings.back().name] = bindings.back().shadowed;
+        }
+        scopes.pop_back();
+    }
+
+    inline ObjectP find(SymbolId name) const {
+        int i = lookup(name);
+        return i < 0 ? nullptr : bindings[i].object;
+    }
+
+    inline bool declared_here(SymbolId name) const {  // in the innermost scope
+        return lookup(name) >= scopes.back();
+    }
+
+    void declare(SymbolId name, const ObjectP &object) {  // must not be `declared_here`
+        if ((size_t) name >= innermost.size()) {
+            innermost.resize((size_t) name + 1, -1);
+        }
+        bindings.push_back({name, object, innermost[name]});
+        innermost[name] = (int) bindings.size() - 1;
+    }
+
+    inline void rebind(SymbolId name, const ObjectP &object) {  // replaces the innermost binding
+        bindings[lookup(name)].object = object;
+    }
+};
+
+#endif //CODE_SYMBOL_TABLE_H
@@ -5,199 +5,254 @@
 #ifndef CODE_TOKEN_H
 #define CODE_TOKEN_H
 
+#include <climits>
 #include <cstring>
 #include <string>
 #include <regex>
 #include <utility>
 #include "object.h"
+#include "source.h"
+#include "symbol.h"
 #include "util.h"
 #include "error.h"
 
 #define NAME(name) name, #name
 
-struct Token : public Element {
-    const int line;
-    TokenCode token_type;
+// what reading past the last token gives
+constexpr TokenCode END_OF_TOKENS = (TokenCode) (TokenCode::RBRACE + 1);
 
-    Token(int line, TokenCode type) : line(line), token_type(type) {}
+// indexed by `TokenCode`
+static const char *const TOKEN_NAMES[] = {
+        "IDENFR", "INTCON", "STRCON", "MAINTK", "CONSTTK", "INTTK", "VOIDTK", "BREAKTK", "CONTINUETK", "IFTK",
+        "ELSETK", "NOT", "AND", "OR", "WHILETK", "GETINTTK", "PRINTFTK", "RETURNTK", "PLUS", "MINU", "MULT", "DIV",
+        "MOD", "LSS", "LEQ", "GRE", "GEQ", "EQL", "NEQ", "ASSIGN", "SEMICN", "COMMA", "LPARENT", "RPARENT",
+        "LBRACK", "RBRACK", "LBRACE", "RBRACE", "EOF"
+};
 
-    Token(int line, TokenCode type, string &&name) : Element(move(name)), line(line), token_type(type) {}
+static const char *const TOKEN_SPELLINGS[] = {
+        "", "", "", "main", "const", "int", "void", "break", "continue", "if",
+        "else", "!", "&&", "||", "while", "getint", "printf", "return", "+", "-", "*", "/",
+        "%", "<", "<=", ">", ">=", "==", "!=", "=", ";", ",", "(", ")",
+        "[", "]", "{", "}", ""
 };
 
-using TokenP = shared_ptr<Token>;
+struct FormatLiteral {
+    StringRef literal;  // with the quotes, points into the source
+    int fmt_char_cnt;
+};
 
-struct Identifier : public Token {
-    string name;
+class TokenStream;
 
-    Identifier(int line, const string &name) : Token(line, IDENFR), name(name) {
-        this->fullname = "IDENFR " + name;
-    }
+class TokenSource {  // lexes tokens on demand, see `TokenStream::source`
+public:
+    virtual bool pull(TokenStream &tokens) = 0;  // appends at least one token, or returns false at the end
 
-    Identifier(int line, const char *start, long long length) : Token(line, IDENFR) {
-        this->name.assign(start, length);
-        this->fullname = "IDENFR " + name;
-    }
+    virtual ~TokenSource() = default;
 };
 
-struct IntLiteral : public Token, public IntObject {  // it's an r-data
-    IntLiteral(int line, int value) : Token(line, INTCON), IntObject(value) {
-        this->fullname = "INTCON " + std::to_string(value);
-        this->is_const = true;
-    }
-};
+// A token read out of a `TokenStream`. It is a small value; `operator->` only lets it be used
+// through `TokenIter` as if the iterator pointed to it.
+struct Token {
+    const TokenStream *stream;
+    TokenCode token_type;
+    int line;
+    int value;  // see `TokenStream::values`
 
-struct FormatString : public Token, public StringObject {  // it's an r-data
-    int fmt_char_cnt = 0;
-    vector<string> segments;
+    inline const Token *operator->() const { return this; }
 
-    FormatString(int line, const char *start, long long length, int fmt_char_cnt, vector<string> segments) :
-            Token(line, STRCON), StringObject(start, length), fmt_char_cnt(fmt_char_cnt), segments(move(segments)) {
-        this->fullname = "STRCON " + this->value;
-    }
+    friend ostream &operator<<(ostream &out, const Token &self);
 };
 
-using FormatStringP = shared_ptr<FormatString>;
+class TokenIter {
+    TokenStream *stream = nullptr;
+    long long index = 0;
 
-struct MainToken : public Token, public FuncObject {
-    explicit MainToken(int line) : Token(line, NAME(MAINTK)" main"), FuncObject(TypeCode::INT) {
-        this->ident_info = make_shared<Identifier>(line, "main");
-    }
-};
+    inline long long key() const;  // the same for all iterators past the last token
+public:
+    static constexpr long long END_INDEX = LLONG_MAX;
 
-struct ConstToken : public Token {
-    explicit ConstToken(int line) : Token(line, NAME(CONSTTK)" const") {}
-};
+    TokenIter() = default;
 
-struct IntToken : public Token {
-    explicit IntToken(int line) : Token(line, NAME(INTTK)" int") {}
-};
+    TokenIter(TokenStream *stream, long long index) : stream(stream), index(index) {}
 
-struct VoidToken : public Token {
-    explicit VoidToken(int line) : Token(line, NAME(VOIDTK)" void") {}
-};
+    inline Token operator*() const;
 
-struct BreakToken : public Token {
-    explicit BreakToken(int line) : Token(line, NAME(BREAKTK)" break") {}
-};
+    inline Token operator->() const { return **this; }
 
-struct ContinueToken : public Token {
-    explicit ContinueToken(int line) : Token(line, NAME(CONTINUETK)" continue") {}
-};
+    inline long long position() const { return index; }
 
-struct IfToken : public Token {
-    explicit IfToken(int line) : Token(line, NAME(IFTK)" if") {}
-};
+    inline TokenIter &operator++() {
+        ++index;
+        return *this;
+    }
 
-struct ElseToken : public Token {
-    explicit ElseToken(int line) : Token(line, NAME(ELSETK)" else") {}
-};
+    inline TokenIter operator++(int) { return {stream, index++}; }
 
-struct WhileToken : public Token {
-    explicit WhileToken(int line) : Token(line, NAME(WHILETK)" while") {}
-};
+    inline TokenIter operator+(long long n) const { return {stream, index + n}; }
 
-struct GetintToken : public Token {
-    explicit GetintToken(int line) : Token(line, NAME(GETINTTK)" getint") {}
-};
+    inline TokenIter operator-(long long n) const { return {stream, index - n}; }
 
-struct PrintfToken : public Token {
-    explicit PrintfToken(int line) : Token(line, NAME(PRINTFTK)" printf") {}
-};
+    inline bool operator==(const TokenIter &other) const { return key() == other.key(); }
 
-struct ReturnToken : public Token {
-    explicit ReturnToken(int line) : Token(line, NAME(RETURNTK)" return") {}
-};
+    inline bool operator!=(const TokenIter &other) const { return key() != other.key(); }
 
-struct NotToken : public Token {
-    explicit NotToken(int line) : Token(line, NAME(NOT)" !") {}
+    inline bool operator<(const TokenIter &other) const { return key() < other.key(); }
 };
 
-struct AndToken : public Token {
-    explicit AndToken(int line) : Token(line, NAME(AND)" &&") {}
-};
+// Tokens stored as parallel arrays, 9 bytes per token plus the literal tables,
+// instead of one heap object per token.
+// With a `source`, tokens are lexed when they are first read, and those before the last `release`
+// are dropped, so only a window of the tokens is kept in memory.
+class TokenStream {
+    long long base = 0;  // index of the first token kept
+    long long released = 0;  // tokens before it are no longer read
 
-struct OrToken : public Token {
-    explicit OrToken(int line) : Token(line, NAME(OR)" ||") {}
-};
+    bool fill(long long index) {  // pulls tokens until `index` can be read
+        while (index >= size()) {
+            if (source == nullptr) {  // all lexed, may be read by several parsers at once
+                return false;
+            }
+            if (!source->pull(*this)) {
+                source = nullptr;
+                return false;
+            }
+            if (released - base > (long long) types.size() / 2) {  // so that every token is moved at most once
+                drop_released();
+            }
+        }
+        return true;
+    }
 
-struct AddToken : public Token {
-    explicit AddToken(int line) : Token(line, NAME(PLUS)" +") {}
-};
+    void drop_released() {
+        auto dead = (long) (released - base);
+        types.erase(types.begin(), types.begin() + dead);
+        lines.erase(lines.begin(), lines.begin() + dead);
+        values.erase(values.begin(), values.begin() + dead);
+        base = released;
+    }
 
-struct SubToken : public Token {
-    explicit SubToken(int line) : Token(line, NAME(MINU)" -") {}
-};
+public:
+    vector<unsigned char> types;  // TokenCode
+    vector<int> lines;
+    vector<int> values;  // IDENFR: the `SymbolId`, INTCON: the value, STRCON: index into `strings`
+    vector<FormatLiteral> strings;  // never dropped, tokens in the syntax tree refer to them
+    TokenSource *source = nullptr;
 
-struct MulToken : public Token {
-    explicit MulToken(int line) : Token(line, NAME(MULT)" *") {}
-};
+    inline long long size() const { return base + (long long) types.size(); }  // lexed so far
 
-struct DivToken : public Token {
-    explicit DivToken(int line) : Token(line, NAME(DIV)" /") {}
-};
+    inline TokenIter begin() { return {this, base}; }
 
-struct ModToken : public Token {
-    explicit ModToken(int line) : Token(line, NAME(MOD)" %") {}
-};
+    inline TokenIter end() { return {this, TokenIter::END_INDEX}; }
 
-struct LtToken : public Token {
-    explicit LtToken(int line) : Token(line, NAME(LSS)" <") {}
-};
+    inline bool has(long long index) { return index < size() || fill(index); }
 
-struct LeToken : public Token {
-    explicit LeToken(int line) : Token(line, NAME(LEQ)" <=") {}
-};
+    inline Token operator[](long long index) const {  // must have been lexed and not dropped
+        return {this, (TokenCode) types[index - base], lines[index - base], values[index - base]};
+    }
 
-struct GtToken : public Token {
-    explicit GtToken(int line) : Token(line, NAME(GRE)" >") {}
-};
+    inline Token at(long long index) {
+        if (has(index)) {
+            return (*this)[index];
+        }
+        return {this, END_OF_TOKENS, types.empty() ? 0 : lines.back(), 0};
+    }
 
-struct GeToken : public Token {
-    explicit GeToken(int line) : Token(line, NAME(GEQ)" >=") {}
-};
+    void skip_rest() {  // lexes the rest of the source, for its errors, without keeping the tokens
+        while (source != nullptr && source->pull(*this)) {
+            released = size();
+            drop_released();
+        }
+        source = nullptr;
+    }
 
-struct EqToken : public Token {
-    explicit EqToken(int line) : Token(line, NAME(EQL)" ==") {}
-};
+    inline void release(const TokenIter &tk) {  // keeps the token before `tk` for error messages
+        if (source != nullptr && tk.position() - 1 > released) {
+            released = tk.position() - 1;
+        }
+    }
 
-struct NeToken : public Token {
-    explicit NeToken(int line) : Token(line, NAME(NEQ)" !=") {}
-};
+    inline void push(TokenCode type, int line, int value = 0) {
+        types.push_back((unsigned char) type);
+        lines.push_back(line);
+        values.push_back(value);
+    }
 
-struct AssignToken : public Token {
-    explicit AssignToken(int line) : Token(line, NAME(ASSIGN)" =") {}
-};
+    inline void push_identifier(int line, SymbolId symbol) {
+        push(IDENFR, line, symbol);
+    }
 
-struct Semicolon : public Token {
-    explicit Semicolon(int line) : Token(line, NAME(SEMICN)" ;") {}
-};
+    inline void push_string(int line, StringRef literal, int fmt_char_cnt) {
+        push(STRCON, line, (int) strings.size());
+        strings.push_back({literal, fmt_char_cnt});
+    }
 
-struct Comma : public Token {
-    explicit Comma(int line) : Token(line, NAME(COMMA)" ,") {}
-};
+    inline SymbolId symbol(const Token &token) const { return token.value; }
 
-struct LParen : public Token {
-    explicit LParen(int line) : Token(line, NAME(LPARENT)" (") {}
-};
+    inline StringRef identifier(const Token &token) const { return SymbolPool::global().name(token.value); }
 
-struct RParen : public Token {
-    explicit RParen(int line) : Token(line, NAME(RPARENT)" )") {}
-};
+    inline const FormatLiteral &string_literal(const Token &token) const { return strings[token.value]; }
 
-struct LBracket : public Token {
-    explicit LBracket(int line) : Token(line, NAME(LBRACK)" [") {}
+    friend ostream &operator<<(ostream &out, const TokenStream &self) {
+        for (long long i = self.base; i < self.size(); i++) {
+            out << self[i] << endl;
+        }
+        return out;
+    }
 };
 
-struct RBracket : public Token {
-    explicit RBracket(int line) : Token(line, NAME(RBRACK)" ]") {}
-};
+inline Token TokenIter::operator*() const { return stream->at(index); }
 
-struct LBrace : public Token {
-    explicit LBrace(int line) : Token(line, NAME(LBRACE)" {") {}
+inline long long TokenIter::key() const { return index != END_INDEX && stream->has(index) ? index : END_INDEX; }
+
+inline ostream &operator<<(ostream &out, const Token &self) {
+    switch (self.token_type) {
+        case IDENFR:
+            out << "IDENFR " << self.stream->identifier(self);
+            break;
+        case INTCON:
+            out << "INTCON " << self.value;
+            break;
+        case STRCON:
+            out << "STRCON " << self.stream->string_literal(self).literal;
+            break;
+        default:
+            out << TOKEN_NAMES[self.token_type] << ' ' << TOKEN_SPELLINGS[self.token_type];
+    }
+    return out;
+}
+
+struct Identifier {
+    SymbolId symbol;
+    int line;
+
+    Identifier(int line, SymbolId symbol) : symbol(symbol), line(line) {}
+
+    inline StringRef name() const { return SymbolPool::global().name(symbol); }
 };
 
-struct RBrace : public Token {
-    explicit RBrace(int line) : Token(line, NAME(RBRACE)" }") {}
+struct FormatString : public StringObject {  // it's an r-data
+    int fmt_char_cnt = 0;
+    vector<string> segments;  // split at each "%d" with "\\n" unescaped
+
+    explicit FormatString(const FormatLiteral &literal) :
+            StringObject(literal.literal), fmt_char_cnt(literal.fmt_char_cnt) {
+        string s;
+        for (long long i = 1; i < value.length && value[i] != '"'; i++) {
+            if (value[i] == '%' && value[i + 1] == 'd') {
+                segments.push_back(s);
+                s.clear();
+                i++;
+            } else if (value[i] == '\\' && value[i + 1] == 'n') {
+                s += '\n';
+                i++;
+            } else {
+                s += value[i];
+            }
+        }
+        segments.push_back(s);
+    }
 };
 
+using FormatStringP = shared_ptr<FormatString>;
+
 #endif //CODE_TOKEN_H
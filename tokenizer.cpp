@@ -2,151 +2,314 @@
 // Created by Kevin Tan on 2021/9/24.
 //
 
+#include <algorithm>
+#include <climits>
+#include <thread>
+#include "scan.h"
 #include "tokenizer.h"
 
-Tokenizer::Tokenizer(const string& filename, Error &error) {
-//    FILE *fp = fopen("testfile.txt", "rb");
-//    fseek(fp, 0, SEEK_END);
-//    long size = ftell(fp);
-//    rewind(fp);
-//    char *buffer = new char[size + 1];
-//    fread(buffer, 1, size, fp);
-//    buffer[size] = '\0';
-//    fclose(fp);
-    ifstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
-        perror(("Failed to open source code file " + filename).c_str());
-        exit(EXIT_FAILURE);
+namespace {
+    constexpr CharClass E = END_CHAR, N = NEWLINE_CHAR, S = SPACE_CHAR, D = DIGIT_CHAR, I = IDENT_CHAR,
+            Q = QUOTE_CHAR, L = SLASH_CHAR, P = PUNCT_CHAR, O = OTHER_CHAR;
+}
+
+const CharClass Tokenizer::char_class[256] = {  // non-ASCII bytes are OTHER_CHAR
+        E, O, O, O, O, O, O, O, O, S, N, S, S, S, O, O,
+        O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O,
+        S, P, Q, O, O, P, P, O, P, P, P, P, P, P, O, L,
+        D, D, D, D, D, D, D, D, D, D, O, P, P, P, P, O,
+        O, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,
+        I, I, I, I, I, I, I, I, I, I, I, P, O, P, O, I,
+        O, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I,
+        I, I, I, I, I, I, I, I, I, I, I, P, P, P, O, O,
+};
+
+const Keyword Tokenizer::keywords[16] = {  // indexed by the hash in `find_keyword`
+        {"while",    5, WHILETK},
+        {"",         0, IDENFR},
+        {"void",     4, VOIDTK},
+        {"if",       2, IFTK},
+        {"continue", 8, CONTINUETK},
+        {"",         0, IDENFR},
+        {"printf",   6, PRINTFTK},
+        {"getint",   6, GETINTTK},
+        {"return",   6, RETURNTK},
+        {"int",      3, INTTK},
+        {"",         0, IDENFR},
+        {"const",    5, CONSTTK},
+        {"",         0, IDENFR},
+        {"break",    5, BREAKTK},
+        {"else",     4, ELSETK},
+        {"main",     4, MAINTK},
+};
+
+Tokenizer::Tokenizer(const string &filename, Error &error, bool use_mmap, int threads, bool streaming) :
+        source(make_shared<SourceFile>(filename, use_mmap)) {
+    tokenize(source->data(), source->length(), error, threads, streaming);
+}
+
+void Tokenizer::tokenize(const char *buffer, long long size, Error &error, int threads, bool streaming) {
+    if (streaming) {
+        stream_error = &error;
+        pending.stop = buffer;
+        pending.line = 1;
+        source_end = buffer + size;
+        tokens.source = this;
+        return;
     }
-    file.seekg(0, ifstream::end);
-    long long size = file.tellg();
-    file.seekg(ifstream::beg);
+    if (threads > size / MIN_CHUNK_SIZE) {
+        threads = (int) (size / MIN_CHUNK_SIZE);
+    }
+    if (threads > 1) {
+        tokenize_parallel(buffer, size, error, threads);
+        return;
+    }
+    Chunk chunk;
+    chunk.begin = chunk.sync_limit = buffer;
+    chunk.end = buffer + size;
+    chunk.line = 1;
+    lex(chunk, chunk.tokens, SymbolPool::global());
+    swap(tokens, chunk.tokens);
+    for (int line: chunk.error_lines) {
+        error(ErrorCode::ILLEGAL_CHAR, line);
+    }
+}
 
-    char *buffer = new char[size + 1];
-    char *original = buffer;
-    buffer[size] = '\0';
-    file.read(buffer, size);
-    file.close();
+void Tokenizer::tokenize_parallel(const char *buffer, long long size, Error &error, int threads) {
+    // Each chunk is lexed as if a token started at its beginning, which may be inside a comment or a string.
+    // The chunk before it lexes past their border up to a token boundary; if the chunk also passed that
+    // boundary, lexing converged and its tokens from there on are what a serial lexer would produce.
+    // Otherwise the chunk is lexed again from that boundary, which is rare because chunks begin at a new line.
+    vector<unique_ptr<Chunk>> chunks;
+    const char *end = buffer + size;
+    for (int i = 0; i < threads; i++) {
+        const char *begin = i == 0 ? buffer : buffer + size * i / threads;
+        if (i > 0) {
+            begin = scan::skip_line(max(begin, chunks.back()->begin));
+            begin += *begin == '\n';
+        }
+        chunks.emplace_back(new Chunk);
+        chunks.back()->begin = begin;
+        chunks.back()->sync_limit = begin + SYNC_WINDOW;
+        chunks.back()->line = i == 0 ? 1 : 0;
+    }
+    for (int i = 0; i < threads; i++) {
+        chunks[i]->end = i + 1 < threads ? chunks[i + 1]->begin : end;
+    }
+    vector<std::thread> workers;
+    for (int i = 1; i < threads; i++) {
+        workers.emplace_back([&chunks, i]() { lex(*chunks[i], chunks[i]->tokens, chunks[i]->symbols); });
+    }
+    lex(*chunks[0], chunks[0]->tokens, SymbolPool::global());
+    for (auto &worker: workers) {
+        worker.join();
+    }
 
+    SymbolPool &symbols = SymbolPool::global();
+    const char *resume = buffer;
     int line = 1;
-    long number;
-    for (char *current = buffer; *buffer != '\0'; current = buffer) {
-        if (*buffer == '\n') {
-            line++;
-            buffer++;
-        } else if (isspace(*buffer)) {  // cannot omit this
-            buffer++;
-        } else if (*buffer == '+') {
-            this->tokens.push_back(make_shared<AddToken>(line));
-            buffer++;
-        } else if (*buffer == '-') {
-            this->tokens.push_back(make_shared<SubToken>(line));
-            buffer++;
-        } else if ((number = strtol(current, &buffer, 10)) || current != buffer) {
-            // Must be after the leading 3! Expression cannot be simplified!
-            this->tokens.push_back(make_shared<IntLiteral>(line, number));
-        } else if (*buffer == '"') {
-            int cnt = 0;
-            string s;
-            vector<string> segments;
-            bool is_valid = true;
-            while (*++buffer != '"') {
-                if (*buffer == '\0' || !(*buffer == ' ' || *buffer == '!' ||
-                                         *buffer == '\\' && *(buffer + 1) == 'n' ||
-                                         *buffer == '%' && *(buffer + 1) == 'd' ||
-                                         *buffer != '\\' && '(' <= *buffer && *buffer <= '~')) {
-                    if (is_valid) {
-                        error(ErrorCode::ILLEGAL_CHAR, line);
+    for (int i = 0; i < threads && resume < end; i++) {
+        Chunk *chunk = chunks[i].get();
+        if (resume >= chunk->stop) {
+            continue;  // covered by a comment or string that began in an earlier chunk
+        }
+        auto sync = lower_bound(chunk->sync_points.begin(), chunk->sync_points.end(), resume,
+                                [](const SyncPoint &p, const char *position) { return p.position < position; });
+        Chunk again;
+        if (sync == chunk->sync_points.end() || sync->position != resume) {
+            again.begin = resume;
+            again.end = chunk->end;
+            again.sync_limit = resume + 1;
+            again.line = line;
+            lex(again, again.tokens, again.symbols);
+            chunk = &again;
+            sync = again.sync_points.begin();
+        }
+        int line_offset = line - sync->line;
+        bool is_global_pool = chunk == chunks[0].get();  // see `lex` of the first chunk above
+        vector<SymbolId> symbol_map((size_t) chunk->symbols.size(), -1);
+        for (long long j = sync->token_cnt; j < chunk->tokens.size(); j++) {
+            Token token = chunk->tokens[j];
+            int token_line = token.line + line_offset;
+            switch (token.token_type) {
+                case IDENFR: {
+                    SymbolId symbol = token.value;
+                    if (!is_global_pool) {
+                        SymbolId &mapped = symbol_map[symbol];
+                        if (mapped < 0) {
+                            mapped = symbols.intern(chunk->symbols.name(symbol));
+                        }
+                        symbol = mapped;
                     }
-                    is_valid = false;
+                    tokens.push_identifier(token_line, symbol);
+                    break;
                 }
-                if (*buffer == '%' && *(buffer + 1) == 'd') {
-                    segments.push_back(s);
-                    s.clear();
-                    cnt++;
-                    buffer++;
-                } else if (*buffer == '\\' && *(buffer + 1) == 'n') {
-                    s += '\n';
-                    buffer++;
-                } else {
-                    s += *buffer;
+                case STRCON: {
+                    const FormatLiteral &literal = chunk->tokens.string_literal(token);
+                    tokens.push_string(token_line, literal.literal, literal.fmt_char_cnt);
+                    break;
                 }
+                default:
+                    tokens.push(token.token_type, token_line, token.value);
             }
-            segments.push_back(s);
-            this->tokens.push_back(make_shared<FormatString>(line, current, ++buffer - current, cnt, segments));
-        } else if (startswith(&buffer, "//")) {
-            while (*buffer++ != '\n') {
-                if (*buffer == '\0') { return; }
+        }
+        for (auto j = (size_t) sync->error_cnt; j < chunk->error_lines.size(); j++) {
+            error(ErrorCode::ILLEGAL_CHAR, chunk->error_lines[j] + line_offset);
+        }
+        resume = chunk->stop;
+        line = chunk->line + line_offset;
+    }
+}
+
+bool Tokenizer::pull(TokenStream &stream) {
+    // lexes the next `PULL_SIZE` bytes or so, more if they do not end a token
+    for (long long size = stream.size(); stream.size() == size;) {
+        if (pending.stop == source_end) {
+            return false;
+        }
+        pending.begin = pending.sync_limit = pending.stop;
+        pending.end = source_end - pending.begin > PULL_SIZE ? pending.begin + PULL_SIZE : source_end;
+        lex(pending, stream, SymbolPool::global());
+        for (int line: pending.error_lines) {
+            (*stream_error)(ErrorCode::ILLEGAL_CHAR, line);
+        }
+        pending.error_lines.clear();
+    }
+    return true;
+}
+
+const char *Tokenizer::lex(Chunk &chunk, TokenStream &tokens, SymbolPool &symbols) {
+    // every position is dispatched once on its character class, so lexing is linear in the source size
+    const char *buffer = chunk.begin;
+    int line = chunk.line;
+    for (const char *current = buffer; current < chunk.end; current = buffer) {
+        if (current < chunk.sync_limit) {
+            chunk.sync_points.push_back({current, line, tokens.size(), (long long) chunk.error_lines.size()});
+        }
+        switch (classify(*buffer)) {
+            case END_CHAR:
+                chunk.line = line;
+                return chunk.stop = buffer;
+            case NEWLINE_CHAR:
+            case SPACE_CHAR:
+                buffer = scan::skip_whitespace(buffer, line);
+                break;
+            case OTHER_CHAR:
+                buffer++;
+                break;
+            case DIGIT_CHAR: {
+                long number = 0;
+                bool overflow = false;
+                do {  // saturates like the `strtol` it replaces
+                    int digit = *buffer - '0';
+                    if (number > (LONG_MAX - digit) / 10) {
+                        overflow = true;
+                    } else {
+                        number = number * 10 + digit;
+                    }
+                } while (classify(*++buffer) == DIGIT_CHAR);
+                tokens.push(INTCON, line, (int) (overflow ? LONG_MAX : number));
+                break;
             }
-            line++;
-        } else if (startswith(&buffer, "/*")) {
-            while (true) {
-                while (*buffer++ != '*') {
-                    if (*buffer == '\n') { line++; }
-                    else if (*buffer == '\0') { return; }  // Bad Comment
+            case IDENT_CHAR: {
+                while (isalnum_(*++buffer));
+                const Keyword *keyword = find_keyword(current, buffer - current);
+                if (keyword != nullptr) {
+                    tokens.push(keyword->type, line);
+                } else {
+                    tokens.push_identifier(line, symbols.intern(StringRef(current, buffer - current)));
                 }
-                if (*buffer == '/') { buffer++; break; }
-                else if (*buffer == '\n') { buffer++; line++; }
-                else if (*buffer == '\0') { return; }  // Bad Comment
+                break;
             }
-        } else if (startswith(&buffer, "&&")) {
-            this->tokens.push_back(make_shared<AndToken>(line));
-        } else if (startswith(&buffer, "||")) {
-            this->tokens.push_back(make_shared<OrToken>(line));
-        } else if (startswith(&buffer, "<=")) {
-            this->tokens.push_back(make_shared<LeToken>(line));
-        } else if (startswith(&buffer, ">=")) {
-            this->tokens.push_back(make_shared<GeToken>(line));
-        } else if (startswith(&buffer, "==")) {
-            this->tokens.push_back(make_shared<EqToken>(line));
-        } else if (startswith(&buffer, "!=")) {
-            this->tokens.push_back(make_shared<NeToken>(line));
-        } else if (startswith(&buffer, "main")) {
-            this->tokens.push_back(get_ident_or_keyword<MainToken>(&buffer, current, line));
-        } else if (startswith(&buffer, "const")) {
-            this->tokens.push_back(get_ident_or_keyword<ConstToken>(&buffer, current, line));
-        } else if (startswith(&buffer, "int")) {
-            this->tokens.push_back(get_ident_or_keyword<IntToken>(&buffer, current, line));
-        } else if (startswith(&buffer, "void")) {
-            this->tokens.push_back(get_ident_or_keyword<VoidToken>(&buffer, current, line));
-        } else if (startswith(&buffer, "break")) {
-            this->tokens.push_back(get_ident_or_keyword<BreakToken>(&buffer, current, line));
-        } else if (startswith(&buffer, "continue")) {
-            this->tokens.push_back(get_ident_or_keyword<ContinueToken>(&buffer, current, line));
-        } else if (startswith(&buffer, "if")) {
-            this->tokens.push_back(get_ident_or_keyword<IfToken>(&buffer, current, line));
-        } else if (startswith(&buffer, "else")) {
-            this->tokens.push_back(get_ident_or_keyword<ElseToken>(&buffer, current, line));
-        } else if (startswith(&buffer, "while")) {
-            this->tokens.push_back(get_ident_or_keyword<WhileToken>(&buffer, current, line));
-        } else if (startswith(&buffer, "getint")) {
-            this->tokens.push_back(get_ident_or_keyword<GetintToken>(&buffer, current, line));
-        } else if (startswith(&buffer, "printf")) {
-            this->tokens.push_back(get_ident_or_keyword<PrintfToken>(&buffer, current, line));
-        } else if (startswith(&buffer, "return")) {
-            this->tokens.push_back(get_ident_or_keyword<ReturnToken>(&buffer, current, line));
-        } else if (isalpha(*buffer) || *buffer == '_') {
-            while (isalnum_(*++buffer));
-            this->tokens.push_back(make_shared<Identifier>(line, current, buffer - current));
-        } else {
-            switch (*buffer++) {
-                case '*': this->tokens.push_back(make_shared<MulToken>(line)); break;
-                case '/': this->tokens.push_back(make_shared<DivToken>(line)); break;
-                case '%': this->tokens.push_back(make_shared<ModToken>(line)); break;
-                case '!': this->tokens.push_back(make_shared<NotToken>(line)); break;
-                case ',': this->tokens.push_back(make_shared<Comma>(line)); break;
-                case ';': this->tokens.push_back(make_shared<Semicolon>(line)); break;
-                case '=': this->tokens.push_back(make_shared<AssignToken>(line)); break;
-                case '<': this->tokens.push_back(make_shared<LtToken>(line)); break;
-                case '>': this->tokens.push_back(make_shared<GtToken>(line)); break;
-                case '(': this->tokens.push_back(make_shared<LParen>(line)); break;
-                case ')': this->tokens.push_back(make_shared<RParen>(line)); break;
-                case '[': this->tokens.push_back(make_shared<LBracket>(line)); break;
-                case ']': this->tokens.push_back(make_shared<RBracket>(line)); break;
-                case '{': this->tokens.push_back(make_shared<LBrace>(line)); break;
-                case '}': this->tokens.push_back(make_shared<RBrace>(line)); break;
+            case QUOTE_CHAR: {  // only validated here, segments are built when the parser needs them
+                int cnt = 0;
+                int start_line = line;  // where it is reported, the lines it spans still count for what follows
+                bool is_valid = true;
+                buffer++;
+                while (true) {
+                    buffer = scan::skip_format_chars(buffer);
+                    if (*buffer == '"') {
+                        buffer++;
+                        break;
+                    } else if ((*buffer == '%' && *(buffer + 1) == 'd') || (*buffer == '\\' && *(buffer + 1) == 'n')) {
+                        cnt += *buffer == '%';
+                        buffer += 2;
+                        continue;
+                    }
+                    if (is_valid) {
+                        chunk.error_lines.push_back(start_line);
+                        if (chunk.token_starts != nullptr) {
+                            chunk.error_tokens.push_back(tokens.size());
+                        }
+                    }
+                    is_valid = false;
+                    if (*buffer == '\0') { break; }  // unterminated string
+                    if (*buffer++ == '\n') { line++; }
+                }
+                tokens.push_string(start_line, StringRef(current, buffer - current), cnt);
+                break;
             }
+            case SLASH_CHAR:
+                if (*(buffer + 1) == '/') {
+                    buffer = scan::skip_line(buffer + 2);  // the newline is counted by the main loop
+                } else if (*(buffer + 1) == '*') {
+                    buffer += 2;
+                    while (true) {
+                        buffer = scan::skip_comment(buffer, line);
+                        if (*buffer == '\0') {  // Bad Comment
+                            chunk.line = line;
+                            return chunk.stop = buffer;
+                        }
+                        else if (*++buffer == '/') { buffer++; break; }
+                    }
+                } else {
+                    tokens.push(DIV, line);
+                    buffer++;
+                }
+                break;
+            case PUNCT_CHAR:
+                switch (*buffer++) {
+                    case '+': tokens.push(PLUS, line); break;
+                    case '-': tokens.push(MINU, line); break;
+                    case '*': tokens.push(MULT, line); break;
+                    case '%': tokens.push(MOD, line); break;
+                    case ',': tokens.push(COMMA, line); break;
+                    case ';': tokens.push(SEMICN, line); break;
+                    case '(': tokens.push(LPARENT, line); break;
+                    case ')': tokens.push(RPARENT, line); break;
+                    case '[': tokens.push(LBRACK, line); break;
+                    case ']': tokens.push(RBRACK, line); break;
+                    case '{': tokens.push(LBRACE, line); break;
+                    case '}': tokens.push(RBRACE, line); break;
+                    case '!':
+                        if (*buffer == '=') { buffer++; tokens.push(NEQ, line); }
+                        else { tokens.push(NOT, line); }
+                        break;
+                    case '=':
+                        if (*buffer == '=') { buffer++; tokens.push(EQL, line); }
+                        else { tokens.push(ASSIGN, line); }
+                        break;
+                    case '<':
+                        if (*buffer == '=') { buffer++; tokens.push(LEQ, line); }
+                        else { tokens.push(LSS, line); }
+                        break;
+                    case '>':
+                        if (*buffer == '=') { buffer++; tokens.push(GEQ, line); }
+                        else { tokens.push(GRE, line); }
+                        break;
+                    case '&':  // a single '&' or '|' is skipped
+                        if (*buffer == '&') { buffer++; tokens.push(AND, line); }
+                        break;
+                    case '|':
+                        if (*buffer == '|') { buffer++; tokens.push(OR, line); }
+                        break;
+                }
+                break;
+        }
+        if (chunk.token_starts != nullptr) {
+            chunk.token_starts->resize((size_t) tokens.size(), current);
         }
     }
-    delete[] original;
+    chunk.line = line;
+    return chunk.stop = buffer;
 }
@@ -8,40 +8,106 @@
 #include <cctype>
 #include "token.h"
 
-class Tokenizer {
+enum CharClass : unsigned char {
+    OTHER_CHAR,  // skipped silently, as are unpaired '&' and '|'
+    SPACE_CHAR,
+    NEWLINE_CHAR,
+    DIGIT_CHAR,
+    IDENT_CHAR,  // letters and '_'
+    QUOTE_CHAR,
+    SLASH_CHAR,
+    PUNCT_CHAR,  // may start a one or two character operator
+    END_CHAR
+};
+
+struct Keyword {
+    const char *spelling;
+    long long length;
+    TokenCode type;
+};
+
+struct SyncPoint {  // a token boundary, where lexing can be resumed
+    const char *position;
+    int line;
+    long long token_cnt;
+    long long error_cnt;
+};
+
+struct Chunk {  // a part of the source that is lexed on its own, see `Tokenizer::tokenize_parallel`
+    const char *begin = nullptr;
+    const char *end = nullptr;  // lexing goes on until the first token boundary at or after it
+    const char *sync_limit = nullptr;  // token boundaries before it are recorded in `sync_points`
+    const char *stop = nullptr;  // where lexing stopped
+    int line = 0;  // counted from the start of the chunk until `stop`, fixed up when merged
+    TokenStream tokens;
+    SymbolPool symbols;  // only used off the main thread, merged into the global pool in token order
+    vector<int> error_lines;  // of illegal characters
+    vector<SyncPoint> sync_points;
+    vector<const char *> *token_starts = nullptr;  // if set, gets where each token starts, indexed like `tokens`
+    vector<long long> error_tokens;  // with `token_starts`, the index of the string each illegal character is in
+};
+
+class Tokenizer : public TokenSource {
+    friend class Session;
+
+    static constexpr long long MIN_CHUNK_SIZE = 1 << 18;
+    static constexpr long long SYNC_WINDOW = 1 << 12;
+    static constexpr long long PULL_SIZE = 1 << 12;
+
+    shared_ptr<SourceFile> source;  // kept alive for the `StringRef`s in tokens
+    static const CharClass char_class[256];
+    static const Keyword keywords[16];
+
+    Error *stream_error = nullptr;  // only used when streaming
+    Chunk pending;  // what is left of the source when streaming
+    const char *source_end = nullptr;
+
+    static const char *lex(Chunk &chunk, TokenStream &tokens, SymbolPool &symbols);
+
+    void tokenize(const char *buffer, long long size, Error &error, int threads, bool streaming);
+
+    void tokenize_parallel(const char *buffer, long long size, Error &error, int threads);
+
 public:
-    vector<TokenP> tokens;
+    TokenStream tokens;
 
-    explicit Tokenizer(const string &filename, Error &error);
+    // More than one thread splits sources larger than `MIN_CHUNK_SIZE` into chunks, the tokens are the same.
+    // When streaming, nothing is lexed here but as the parser reads `tokens`, and `error` must outlive them.
+    explicit Tokenizer(const string &filename, Error &error, bool use_mmap = false, int threads = 1,
+                       bool streaming = false);
 
-    static inline bool isalnum_(char c) {
-        return isalnum(c) || c == '_';
+    // tokenizes an in-memory source, which must outlive the tokens
+    Tokenizer(const char *source, long long size, Error &error, int threads = 1, bool streaming = false) {
+        assert(source[size] == '\0');
+        tokenize(source, size, error, threads, streaming);
     }
 
-    static inline bool startswith(char **buffer, const char *keyword) {
-        if (strstr(*buffer, keyword) == *buffer) {
-            (*buffer) += strlen(keyword);
-            return true;
-        } else {
-            return false;
-        }
+    Tokenizer(const Tokenizer &) = delete;
+
+    Tokenizer &operator=(const Tokenizer &) = delete;
+
+    bool pull(TokenStream &stream) override;
+
+    static inline CharClass classify(char c) {
+        return char_class[(unsigned char) c];
+    }
+
+    static inline bool isalnum_(char c) {
+        CharClass cc = classify(c);
+        return cc == IDENT_CHAR || cc == DIGIT_CHAR;
     }
 
-    template<typename KeywordTokenClass>
-    static inline TokenP get_ident_or_keyword(char **buffer, const char *current, int line) {
-        if (isalnum_(*(*buffer)++)) {
-            while (isalnum_(*(*buffer)++));
-            return make_shared<Identifier>(line, current, --(*buffer) - current);
-        } else {
-            (*buffer)--;
-            return make_shared<KeywordTokenClass>(line);
+    static inline const Keyword *find_keyword(const char *start, long long length) {
+        // perfect hash over the first and last characters and the length of the 12 keywords
+        const Keyword &k = keywords[(5 * start[0] + 8 * length + start[length - 1]) & 15];
+        if (k.length == length && memcmp(k.spelling, start, length) == 0) {
+            return &k;
         }
+        return nullptr;
     }
 
     friend ostream &operator<<(ostream &out, const Tokenizer &self) {
-        for (const auto &token: self.tokens) {
-            out << *token << endl;
-        }
+        out << self.tokens;
         return out;
     }
 };
@@ -4,59 +4,268 @@
 
 #include "vm.h"
 
+// What each instruction a superinstruction can run does, moving `pc` past it or to where it jumps.
+
+template<>
+inline void StackMachine::step<LOAD_FAST>(const Code *&pc, const Code *) {
+    stack->push_back(bytecode.constants[pc->arg]);
+    ++pc;
+}
+
+template<>
+inline void StackMachine::step<LOAD_NAME>(const Code *&pc, const Code *) {
+    stack->push_back(globals[pc->arg]);
+    ++pc;
+}
+
+template<>
+inline void StackMachine::step<STORE_NAME>(const Code *&pc, const Code *) {
+    ObjectP &o = globals[pc->arg];
+    if (o->type == TypeCode::INT_ARRAY) {
+        cast<ArrayObject>(o)->data = cast<ArrayObject>(stack->back())->data;
+    } else {
+        o = stack->back()->copy();  // replace store, must be copied
+    }
+    if (pc->op) {
+        stack->back() = o;  // as LOAD_NAME would have pushed
+    } else {
+        stack->pop_back();
+    }
+    ++pc;
+}
+
+inline ObjectP &StackMachine::local(int slot) {
+    ObjectP &o = frames.back()->slots[slot];
+    if (o == nullptr) {
+        auto &info = frames.back()->func->locals[slot];
+        cerr << "WARNING: use of unbound name " << info->ident_info->name() << " (declared in line "
+             << info->ident_info->line << "), has bound its value to 0" << endl;
+        o = make_shared<IntObject>();
+    }
+    return o;
+}
+
+inline void StackMachine::store_local(const Code *pc, int value) {
+    ObjectP &slot = frames.back()->slots[pc->arg];
+    slot = make_shared<IntObject>(value);
+    if (pc->op) {
+        stack->push_back(slot);
+    }
+}
+
+template<>
+inline void StackMachine::step<LOAD_LOCAL>(const Code *&pc, const Code *) {
+    stack->push_back(local(pc->arg));
+    ++pc;
+}
+
+template<>
+inline void StackMachine::step<STORE_LOCAL>(const Code *&pc, const Code *) {
+    auto &frame = frames.back();
+    if (stack->back()->type == TypeCode::INT_ARRAY) {
+        cast<ArrayObject>(stack->back())->dims = cast<ArrayObject>(frame->func->locals[pc->arg])->dims;
+    }  // dim of array on stack may be unknown, so we need to copy them
+    ObjectP &slot = frame->slots[pc->arg];
+    slot = stack->back()->copy();  // replace store, must be copied
+    if (pc->op) {
+        stack->back() = slot;  // as LOAD_LOCAL would have pushed
+    } else {
+        stack->pop_back();
+    }
+    ++pc;
+}
+
+template<>
+inline void StackMachine::step<POP_TOP>(const Code *&pc, const Code *) {
+    stack->pop_back();
+    ++pc;
+}
+
+template<>
+inline void StackMachine::step<STORE_SUBSCR>(const Code *&pc, const Code *) {
+    auto value = cast<IntObject>(stack->back())->value;
+    stack->pop_back();
+    cast<IntObject>(stack->back())->value = value;  // in-place store, must not be copied
+    stack->pop_back();
+    ++pc;
+}
+
+template<>
+inline void StackMachine::step<SUBSCR_ARRAY>(const Code *&pc, const Code *) {
+    long long index = cast<IntObject>(stack->back())->value;
+    stack->pop_back();
+    ArrayObjectP array = cast<ArrayObject>(stack->back());
+    stack->pop_back();
+    stack->push_back((*array)[index]);
+    ++pc;
+}
+
+template<>
+inline void StackMachine::step<JUMP_ABSOLUTE>(const Code *&pc, const Code *begin) {
+    pc = begin + pc->arg;
+}
+
+template<>
+inline void StackMachine::step<POP_JUMP_IF_FALSE>(const Code *&pc, const Code *begin) {
+    long long value = cast<IntObject>(stack->back())->value;
+    stack->pop_back();
+    if (!value) {
+        pc = begin + pc->arg;
+    } else {
+        ++pc;
+    }
+}
+
+template<>
+inline void StackMachine::step<POP_JUMP_IF_TRUE>(const Code *&pc, const Code *begin) {
+    long long value = cast<IntObject>(stack->back())->value;
+    stack->pop_back();
+    if (value) {
+        pc = begin + pc->arg;
+    } else {
+        ++pc;
+    }
+}
+
+template<>
+inline void StackMachine::step<UNARY_OP>(const Code *&pc, const Code *) {
+    auto value = cast<IntObject>(stack->back())->value;
+    stack->pop_back();
+    stack->push_back(make_shared<IntObject>(util::unary_operation((UnaryOpCode) pc->op, value)));
+    ++pc;
+}
+
+template<>
+inline void StackMachine::step<BINARY_OP>(const Code *&pc, const Code *) {
+    auto right = cast<IntObject>(stack->back())->value;
+    stack->pop_back();
+    auto left = cast<IntObject>(stack->back())->value;
+    stack->pop_back();
+    stack->push_back(make_shared<IntObject>(util::binary_operation((BinaryOpCode) pc->op, left, right)));
+    ++pc;
+}
+
+// The hottest superinstructions, run without moving what they compute through the stack. The values they read
+// are known to be ints, or an array for SUBSCR_ARRAY, so they are not checked like `cast` does.
+
+static inline int value_of(const ObjectP &o) {
+    return static_cast<const IntObject *>(o.get())->value;
+}
+
+static inline void jump_if(bool jump, const Code *&pc, const Code *begin) {
+    pc = jump ? begin + pc->arg : pc + 1;
+}
+
+#define LOCAL_FAST_BINARY(pc) util::binary_operation((BinaryOpCode) (pc)[2].op, value_of(local((pc)[0].arg)), \
+                                                     value_of(bytecode.constants[(pc)[1].arg]))
+
+template<>
+inline void StackMachine::run_fused<LOAD_LOCAL, LOAD_FAST, BINARY_OP, STORE_LOCAL>(const Code *&pc, const Code *) {
+    store_local(pc + 3, LOCAL_FAST_BINARY(pc));
+    pc += 4;
+}
+
+template<>
+inline void StackMachine::run_fused<LOAD_LOCAL, LOAD_FAST, BINARY_OP, POP_JUMP_IF_FALSE>(const Code *&pc,
+                                                                                         const Code *begin) {
+    bool jump = !LOCAL_FAST_BINARY(pc);
+    pc += 3;
+    jump_if(jump, pc, begin);
+}
+
+template<>
+inline void StackMachine::run_fused<LOAD_LOCAL, LOAD_FAST, BINARY_OP, POP_JUMP_IF_TRUE>(const Code *&pc,
+                                                                                        const Code *begin) {
+    bool jump = LOCAL_FAST_BINARY(pc);
+    pc += 3;
+    jump_if(jump, pc, begin);
+}
+
+template<>
+inline void StackMachine::run_fused<LOAD_LOCAL, LOAD_FAST, BINARY_OP>(const Code *&pc, const Code *) {
+    stack->push_back(make_shared<IntObject>(LOCAL_FAST_BINARY(pc)));
+    pc += 3;
+}
+
+#undef LOCAL_FAST_BINARY
+
+template<>
+inline void StackMachine::run_fused<LOAD_NAME, LOAD_LOCAL, SUBSCR_ARRAY>(const Code *&pc, const Code *) {
+    stack->push_back((*static_cast<const ArrayObject *>(globals[pc->arg].get()))[value_of(local(pc[1].arg))]);
+    pc += 3;
+}
+
+template<>
+inline void StackMachine::run_fused<LOAD_LOCAL, SUBSCR_ARRAY>(const Code *&pc, const Code *) {
+    ObjectP element = (*static_cast<const ArrayObject *>(stack->back().get()))[value_of(local(pc->arg))];
+    stack->back() = move(element);
+    pc += 2;
+}
+
+template<>
+inline void StackMachine::run_fused<LOAD_FAST, BINARY_OP>(const Code *&pc, const Code *) {
+    stack->back() = make_shared<IntObject>(util::binary_operation((BinaryOpCode) pc[1].op, value_of(stack->back()),
+                                                                  value_of(bytecode.constants[pc->arg])));
+    pc += 2;
+}
+
+template<>
+inline void StackMachine::run_fused<BINARY_OP, STORE_LOCAL>(const Code *&pc, const Code *) {
+    int right = value_of(stack->back());
+    stack->pop_back();
+    int left = value_of(stack->back());
+    stack->pop_back();
+    store_local(pc + 1, util::binary_operation((BinaryOpCode) pc->op, left, right));
+    pc += 2;
+}
+
+template<>
+inline void StackMachine::run_fused<BINARY_OP, POP_JUMP_IF_FALSE>(const Code *&pc, const Code *begin) {
+    int right = value_of(stack->back());
+    stack->pop_back();
+    int left = value_of(stack->back());
+    stack->pop_back();
+    bool jump = !util::binary_operation((BinaryOpCode) pc->op, left, right);
+    pc += 1;
+    jump_if(jump, pc, begin);
+}
+
 void StackMachine::run() {
-    auto pc = instructions.begin();
-    while (pc < instructions.end()) {
-        switch ((*pc)->opcode) {
+    execute<false>(nullptr);
+}
+
+void StackMachine::run(vector<long long> &dispatched) {
+    execute<true>(&dispatched);
+}
+
+template<bool counting>
+void StackMachine::execute(vector<long long> *dispatched) {
+    const Code *begin = bytecode.code.data(), *end = begin + bytecode.code.size(), *pc = begin;
+    if (counting) {
+        dispatched->assign(bytecode.code.size(), 0);
+    }
+    while (pc < end) {
+        if (counting) {
+            (*dispatched)[pc - begin]++;
+        }
+        switch (pc->opcode) {
             case OpCode::LOAD_FAST:
-                stack->push_back(cast<LoadFast>(*pc)->object);
-                ++pc;
+                step<LOAD_FAST>(pc, begin);
                 break;
-            case OpCode::LOAD_NAME: {
-                ObjectP info = cast<LoadName>(*pc)->object;
-                if (info->is_global) {
-                    stack->push_back(globals[info->ident_info->name]);
-                } else {
-                    auto &objects = frames.back()->objects;
-                    auto it = objects.find(info->ident_info);
-                    if (it != objects.end()) {
-                        stack->push_back((*it).second);
-                    } else {
-                        cerr << "WARNING: use of unbound name " << info->ident_info->name << " (declared in line "
-                             << info->ident_info->line << "), has bound its value to 0" << endl;
-                        IntObjectP o = make_shared<IntObject>();
-                        objects[info->ident_info] = o;
-                        stack->push_back(o);
-                    }
-                }
-                ++pc;
+            case OpCode::LOAD_NAME:
+                step<LOAD_NAME>(pc, begin);
                 break;
-            }
-            case OpCode::STORE_NAME: {
-                ObjectP o = cast<StoreName>(*pc)->object;
-                auto &name = o->ident_info->name;
-                auto &locals = frames.back()->objects;
-                if (o->is_const) {
-                    ERROR_NOT_SUPPORTED(modifing const);
-                } else if (o->is_global) {
-                    if (o->type == TypeCode::INT_ARRAY) {
-                        cast<ArrayObject>(globals[name])->data = cast<ArrayObject>(stack->back())->data;
-                    } else {
-                        globals[name] = stack->back()->copy();  // replace store, must be copied
-                    }
-                } else {
-                    if (o->type == TypeCode::INT_ARRAY) {
-                        cast<ArrayObject>(stack->back())->dims = cast<ArrayObject>(o)->dims;
-                    }  // dim of array on stack may be unknown, so we need to copy them
-                    locals[o->ident_info] = stack->back()->copy();  // replace store, must be copied
-                }
-                stack->pop_back();
-                ++pc;
+            case OpCode::STORE_NAME:
+                step<STORE_NAME>(pc, begin);
+                break;
+            case OpCode::LOAD_LOCAL:
+                step<LOAD_LOCAL>(pc, begin);
+                break;
+            case OpCode::STORE_LOCAL:
+                step<STORE_LOCAL>(pc, begin);
                 break;
-            }
             case OpCode::POP_TOP:
-                stack->pop_back();
-                ++pc;
+                step<POP_TOP>(pc, begin);
                 break;
             case OpCode::BUILD_ARRAY: {
                 long long size = cast<IntObject>(stack->back())->value;
@@ -83,23 +292,12 @@ void StackMachine::run() {
                 ++pc;
                 break;
             }
-            case OpCode::STORE_SUBSCR: {
-                auto value = cast<IntObject>(stack->back())->value;
-                stack->pop_back();
-                cast<IntObject>(stack->back())->value = value;  // in-place store, must not be copied
-                stack->pop_back();
-                ++pc;
+            case OpCode::STORE_SUBSCR:
+                step<STORE_SUBSCR>(pc, begin);
                 break;
-            }
-            case OpCode::SUBSCR_ARRAY: {
-                long long index = cast<IntObject>(stack->back())->value;
-                stack->pop_back();
-                ArrayObjectP array = cast<ArrayObject>(stack->back());
-                stack->pop_back();
-                stack->push_back((*array)[index]);
-                ++pc;
+            case OpCode::SUBSCR_ARRAY:
+                step<SUBSCR_ARRAY>(pc, begin);
                 break;
-            }
             case OpCode::CALL_GETINT: {
                 int n;
                 cin >> n;
@@ -108,30 +306,16 @@ void StackMachine::run() {
                 break;
             }
             case OpCode::JUMP_ABSOLUTE:
-                pc = instructions.begin() + cast<JumpAbsolute>(*pc)->get_offset();
+                step<JUMP_ABSOLUTE>(pc, begin);
                 break;
-            case OpCode::POP_JUMP_IF_FALSE: {
-                long long value = cast<IntObject>(stack->back())->value;
-                stack->pop_back();
-                if (!value) {
-                    pc = instructions.begin() + cast<PopJumpIfFalse>(*pc)->get_offset();
-                } else {
-                    ++pc;
-                }
+            case OpCode::POP_JUMP_IF_FALSE:
+                step<POP_JUMP_IF_FALSE>(pc, begin);
                 break;
-            }
-            case OpCode::POP_JUMP_IF_TRUE: {
-                long long value = cast<IntObject>(stack->back())->value;
-                stack->pop_back();
-                if (value) {
-                    pc = instructions.begin() + cast<PopJumpIfTrue>(*pc)->get_offset();
-                } else {
-                    ++pc;
-                }
+            case OpCode::POP_JUMP_IF_TRUE:
+                step<POP_JUMP_IF_TRUE>(pc, begin);
                 break;
-            }
             case OpCode::CALL_PRINTF: {
-                FormatStringP fmt_str = cast<PrintF>(*pc)->format_string;
+                const FormatString *fmt_str = bytecode.formats[pc->arg].get();
                 auto seg_it = fmt_str->segments.begin();
                 outs << *seg_it;
                 for (auto it = stack->end() - fmt_str->fmt_char_cnt; it != stack->end(); ++it) {
@@ -146,19 +330,34 @@ void StackMachine::run() {
             case OpCode::EXIT_INTERP:
                 return;
             case OpCode::CALL_FUNCTION: {
-                FrameP new_frame = make_shared<Frame>();
-                new_frame->return_offset = pc - instructions.begin() + 1;
-                FuncObjectP func = cast<CallFunction>(*pc)->get_func();
+                const FuncObject *func = bytecode.funcs[pc->arg].get();
+                if (func->code_offset < 0) {  // every call site goes straight to it once it is loaded
+                    auto offset = pc - begin;
+                    size_t loaded = instructions->size();
+                    if (loader == nullptr || !loader->load(bytecode.funcs[pc->arg])) {
+                        return;
+                    }
+                    bytecode.assemble(*instructions, loaded);
+                    begin = bytecode.code.data();  // appended to
+                    end = begin + bytecode.code.size();
+                    pc = begin + offset;
+                    if (counting) {
+                        dispatched->resize(bytecode.code.size());
+                    }
+                }
+                FrameP new_frame = make_shared<Frame>((size_t) func->slot_cnt);
+                new_frame->return_offset = pc - begin + 1;
+                new_frame->func = func;
                 auto &params = func->params;
                 for (auto i = (long long) params.size() - 1; i >= 0; i--) {
                     ObjectP o = stack->back();
                     switch (o->type) {
                         case TypeCode::INT:
-                            new_frame->objects[params[i]->ident_info] = cast<IntObject>(o)->copy();
+                            new_frame->slots[params[i]->slot] = cast<IntObject>(o)->copy();
                             break;
                         case TypeCode::INT_ARRAY: {
                             ArrayObjectP array = cast<ArrayObject>(o->copy());
-                            new_frame->objects[params[i]->ident_info] = array;
+                            new_frame->slots[params[i]->slot] = array;
                             array->dims = cast<ArrayObject>(params[i])->dims;
                             break;  // note the dimension difference when addressing
                         }
@@ -169,7 +368,7 @@ void StackMachine::run() {
                 }
                 stack = new_frame->stack;
                 frames.push_back(new_frame);
-                pc = instructions.begin() + func->code_offset;
+                pc = begin + func->code_offset;
                 break;
             }
             case OpCode::RETURN_VALUE: {
@@ -177,12 +376,12 @@ void StackMachine::run() {
                     assert(stack->size() == 1);
                     ObjectP value = stack->back();
                     stack->pop_back();
-                    pc = instructions.begin() + frames.back()->return_offset;
+                    pc = begin + frames.back()->return_offset;
                     frames.pop_back();
                     stack = frames.back()->stack;
                     stack->push_back(value);
                 } else {
-                    pc = instructions.begin() + frames.back()->return_offset;
+                    pc = begin + frames.back()->return_offset;
                     frames.pop_back();
                     stack = frames.back()->stack;
                     stack->push_back(make_shared<Object>());
@@ -191,22 +390,18 @@ void StackMachine::run() {
                 }
                 break;
             }
-            case OpCode::UNARY_OP: {
-                auto value = cast<IntObject>(stack->back())->value;
-                stack->pop_back();
-                stack->push_back(make_shared<IntObject>(util::unary_operation(cast<UnaryOperation>(*pc)->unary_opcode, value)));
-                ++pc;
+            case OpCode::UNARY_OP:
+                step<UNARY_OP>(pc, begin);
                 break;
-            }
-            case OpCode::BINARY_OP: {
-                auto right = cast<IntObject>(stack->back())->value;
-                stack->pop_back();
-                auto left = cast<IntObject>(stack->back())->value;
-                stack->pop_back();
-                stack->push_back(make_shared<IntObject>(util::binary_operation(cast<BinaryOperation>(*pc)->binary_opcode, left, right)));
-                ++pc;
+            case OpCode::BINARY_OP:
+                step<BINARY_OP>(pc, begin);
                 break;
-            }
+#define SUPERINSTRUCTION_CASE(name, ...) \
+            case OpCode::name: \
+                run_fused<__VA_ARGS__>(pc, begin); \
+                break;
+            SUPERINSTRUCTIONS(SUPERINSTRUCTION_CASE)
+#undef SUPERINSTRUCTION_CASE
             default:
                 ++pc;
         }
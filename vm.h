@@ -5,17 +5,18 @@
 #ifndef CODE_VM_H
 #define CODE_VM_H
 
-#include "instruction.h"
+#include "bytecode.h"
 
 using Stack = vector<ObjectP>;
 using StackP = shared_ptr<Stack>;
 
 struct Frame {
-    unordered_map<IdentP, ObjectP> objects{CACHE_LINE_SIZE / sizeof(ObjectP)};
+    vector<ObjectP> slots;  // locals by `Object::slot`, null until stored
     StackP stack = make_shared<Stack>();
     long long return_offset = 0;
+    const FuncObject *func = nullptr;  // being run, whose `locals` tell what its slots were declared as
 
-    Frame() {
+    explicit Frame(size_t slot_cnt = 0) : slots(slot_cnt) {
         stack->reserve(CACHE_LINE_SIZE / sizeof(ObjectP));
     }
 };
@@ -24,22 +25,52 @@ using FrameP = shared_ptr<Frame>;
 
 class StackMachine {
 public:
-    vector<InstructionP> &instructions;
-    unordered_map<string, ObjectP> &globals;
+    vector<InstructionP> *instructions = nullptr;  // what `bytecode` is assembled from, if it is
+    Bytecode bytecode;  // what is run, with what `loader` appends to `instructions` assembled as it is called
+    vector<ObjectP> globals;  // the data segment, by `Object::slot`
     ostream &outs;
+    CodeLoader *loader;  // for the functions not compiled yet
     vector<FrameP> frames{make_shared<Frame>()};  // dummy frame
     StackP stack = frames.back()->stack;
 
-    explicit StackMachine(vector<InstructionP> &instructions, unordered_map<string, ObjectP> &globals,
-                          ostream &outs) : instructions(instructions), globals(globals), outs(outs) {};
+    // runs on `data_image` in place, pass a copy to keep it
+    explicit StackMachine(vector<InstructionP> &instructions, vector<ObjectP> data_image, ostream &outs,
+                          CodeLoader *loader = nullptr) :
+            instructions(&instructions), globals(move(data_image)), outs(outs), loader(loader) {
+        bytecode.assemble(instructions);
+    };
 
-    void run();
+    StackMachine(Bytecode bytecode, vector<ObjectP> data_image, ostream &outs) :
+            bytecode(move(bytecode)), globals(move(data_image)), outs(outs), loader(nullptr) {};
 
-    friend ostream &operator<<(ostream &out, const StackMachine &self) {
-        for (int i = 0; i < self.instructions.size(); i++) {
-            out << i << '\t' << *self.instructions[i] << endl;
-        }
-        return out;
+    void run();  // stops early if a function fails to load
+
+    void run(vector<long long> &dispatched);  // counting the dispatches of the instruction at each offset
+
+    friend ostream &operator<<(ostream &out, const StackMachine &self) {  // the listing
+        return out << Disassembler(self.bytecode);
+    }
+
+private:
+    template<bool counting>
+    void execute(vector<long long> *dispatched);
+
+    template<OpCode opcode>
+    inline void step(const Code *&pc, const Code *begin);  // one instruction that `Bytecode::can_fuse`
+
+    inline ObjectP &local(int slot);  // as LOAD_LOCAL pushes it
+
+    inline void store_local(const Code *pc, int value);  // as STORE_LOCAL stores it
+
+    template<OpCode opcode>
+    inline void run_fused(const Code *&pc, const Code *begin) {
+        step<opcode>(pc, begin);
+    }
+
+    template<OpCode opcode, OpCode next, OpCode... rest>
+    inline void run_fused(const Code *&pc, const Code *begin) {  // what a superinstruction runs, as `SUPERINSTRUCTIONS`
+        step<opcode>(pc, begin);
+        run_fused<next, rest...>(pc, begin);
     }
 };
 